@@ -24,27 +24,26 @@ void mj::DirectoryNavigationPanel::Breadcrumb::Destroy()
   this->breadcrumb.Destroy();
 }
 
-bool mj::DirectoryNavigationPanel::Breadcrumb::Add(const wchar_t* pStringLiteral)
+bool mj::DirectoryNavigationPanel::Breadcrumb::Add(uint32_t node)
 {
-  return this->breadcrumb.Add(pStringLiteral);
-}
-
-bool mj::DirectoryNavigationPanel::Breadcrumb::Add(const StringView& string)
-{
-  return this->breadcrumb.Add(string);
+  return this->breadcrumb.Add(node) != nullptr;
 }
 
 void mj::DirectoryNavigationPanel::Breadcrumb::GoUpByOne()
 {
-  this->breadcrumb.Pop();
+  size_t size = this->breadcrumb.Size();
+  if (size > 0)
+  {
+    static_cast<void>(this->breadcrumb.Erase(size - 1, 1));
+  }
 }
 
-mj::StringView* mj::DirectoryNavigationPanel::Breadcrumb::Last()
+uint32_t* mj::DirectoryNavigationPanel::Breadcrumb::Last()
 {
   size_t size = this->breadcrumb.Size();
   if (size > 0)
   {
-    return this->breadcrumb[size - 1];
+    return &this->breadcrumb[size - 1];
   }
 
   return nullptr;
@@ -75,20 +74,34 @@ namespace mj
   namespace detail
   {
     struct ListFolderContentsTask;
+    struct CreateVisibleTextLayoutsTask;
     void OnListFolderContentsDone(mj::DirectoryNavigationPanel* pThis, detail::ListFolderContentsTask* pTask);
     void SetTextLayout(mj::DirectoryNavigationPanel* pThis, mj::Entry* pEntry, IDWriteTextLayout* pTextLayout);
+    size_t GetNumRowsInView(const mj::DirectoryNavigationPanel* pThis);
+    struct FilterJob;
+    void OnFilterChunkDone(mj::DirectoryNavigationPanel* pThis, FilterJob* pJob);
+    void ReleaseFilterJob(mj::DirectoryNavigationPanel* pThis, FilterJob* pJob);
+    void ApplyFilter(mj::DirectoryNavigationPanel* pThis);
+    struct IndexFolderTask;
+    void OnIndexFolderDone(mj::DirectoryNavigationPanel* pThis, IndexFolderTask* pTask);
 
     struct ListFolderContentsTask : public mj::Task
     {
+      // Enumeration blocks on the disk, the text layouts of the continuation run on the compute workers
+      static constexpr const mj::ETaskKind::Enum TASK_KIND = mj::ETaskKind::IO;
+
       // In
       MJ_UNINITIALIZED mj::DirectoryNavigationPanel* pParent;
-      MJ_UNINITIALIZED mj::StringView directory;
+      mj::StringAlloc directory; // Null-terminated path of the folder, e.g. "C:\\"
+      mj::StringAlloc pattern; // Files that do not match are never added, empty to list everything
+      CreateVisibleTextLayoutsTask* pTextLayouts; // Continuation, or nullptr if there is no text format yet
 
       // Out
       MJ_UNINITIALIZED HRESULT status;
       mj::ArrayList<size_t> folders;
       mj::ArrayList<size_t> files;
       mj::StringCache stringCache;
+      mj::DirectoryColumns columns; // Metadata of the names in stringCache
 
       // Private
       MJ_UNINITIALIZED mj::HeapAllocator allocator;
@@ -100,11 +113,24 @@ namespace mj
         this->files.Init(&this->allocator);
         this->folders.Init(&this->allocator);
         this->stringCache.Init(&this->allocator);
+        this->columns.Init(&this->allocator);
         this->status = 0;
 
-        MJ_UNINITIALIZED WIN32_FIND_DATA findData;
-        HANDLE hFind = ::FindFirstFileW(this->directory.ptr, &findData);
-        if (hFind == INVALID_HANDLE_VALUE)
+        mj::GlobMatcher glob;
+        glob.Init(&this->allocator);
+        MJ_DEFER(glob.Destroy());
+        if (!this->pattern.IsEmpty())
+        {
+          MJ_UNINITIALIZED StringView patterns;
+          patterns.Init(this->pattern.Get(), this->pattern.Length());
+
+          // On failure, everything is listed
+          static_cast<void>(glob.Compile(patterns));
+        }
+
+        mj::DirectoryReader reader;
+        MJ_DEFER(reader.Destroy());
+        if (!reader.Init(this->directory.Get(), &this->allocator))
         {
           // TODO: Handle ::GetLastError().
           // Example: 0x00000005 --> Access is denied.
@@ -112,45 +138,51 @@ namespace mj
           return;
         }
 
-        do
+        MJ_UNINITIALIZED mj::DirectoryEntry entry;
+        while (reader.Next(&entry))
         {
-          if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_SYSTEM))
+          // Large folders take a while, stop when the user has navigated away
+          if (this->token.IsCancelled())
           {
-            MJ_UNINITIALIZED StringView string;
-            string.Init(findData.cFileName);
+            break;
+          }
 
-            // Ignore "." and ".."
-            if (string.Equals(L".") || string.Equals(L".."))
-            {
-              continue;
-            }
+          if (entry.attributes & FILE_ATTRIBUTE_SYSTEM)
+          {
+            continue;
+          }
 
-            if (!this->stringCache.Add(string))
-            {
-              this->files.Destroy();
-              this->folders.Destroy();
-              this->stringCache.Destroy();
-              break;
-            }
+          // Folders are always listed, so the pattern still applies after navigating
+          if (!(entry.attributes & FILE_ATTRIBUTE_DIRECTORY) && !glob.Matches(entry.name))
+          {
+            continue;
+          }
 
-            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+          // The name is copied out of the reader's buffer, the metadata comes from the same record
+          if (!this->stringCache.Add(entry.name) || !this->columns.Add(entry))
+          {
+            this->files.Destroy();
+            this->folders.Destroy();
+            this->stringCache.Destroy();
+            this->columns.Destroy();
+            break;
+          }
+
+          if (entry.attributes & FILE_ATTRIBUTE_DIRECTORY)
+          {
+            if (!this->Add(this->folders, this->stringCache.Size() - 1))
             {
-              if (!this->Add(this->folders, this->stringCache.Size() - 1))
-              {
-                break;
-              }
+              break;
             }
-            else
+          }
+          else
+          {
+            if (!this->Add(this->files, this->stringCache.Size() - 1))
             {
-              if (!this->Add(this->files, this->stringCache.Size() - 1))
-              {
-                break;
-              }
+              break;
             }
           }
-        } while (::FindNextFileW(hFind, &findData) != 0);
-
-        ::FindClose(hFind);
+        }
       }
 
       virtual void OnDone() override
@@ -164,6 +196,9 @@ namespace mj
         this->files.Destroy();
         this->folders.Destroy();
         this->stringCache.Destroy();
+        this->columns.Destroy();
+        this->directory.Destroy(&this->allocator);
+        this->pattern.Destroy(&this->allocator);
       }
 
     private:
@@ -176,6 +211,7 @@ namespace mj
           this->files.Destroy();
           this->folders.Destroy();
           this->stringCache.Destroy();
+          this->columns.Destroy();
           return false;
         }
 
@@ -185,35 +221,378 @@ namespace mj
       }
     };
 
-    struct CreateTextLayoutTask : public mj::Task
+    /// <summary>
+    /// Number of names an IndexFolderTask collects before it hands its segment to the index.
+    /// </summary>
+    static constexpr const size_t INDEX_BATCH_SIZE = 64 * 1024;
+
+    /// <summary>
+    /// Walks a folder tree depth-first and builds one TrigramSegment of the names it finds.
+    /// Stops after INDEX_BATCH_SIZE names, the folders it did not get to are returned to the panel.
+    /// Stops early when its token is cancelled, see DirectoryNavigationPanel::indexing.
+    /// The walk records folders in a PathTree of its own, which the panel merges into the shared one.
+    /// </summary>
+    struct IndexFolderTask : public mj::Task
     {
+      static constexpr const mj::ETaskKind::Enum TASK_KIND = mj::ETaskKind::IO;
+
       // In
       MJ_UNINITIALIZED mj::DirectoryNavigationPanel* pParent;
-      MJ_UNINITIALIZED mj::Entry* pEntry;
+      MJ_UNINITIALIZED mj::AllocatorBase* pSegmentAllocator; // Thread-safe, owned by the index afterwards
+      MJ_UNINITIALIZED uint32_t rootNode;                    // Node of the folder in the panel's tree
+      mj::StringAlloc folder;                                // Full path of the folder
 
       // Out
-      MJ_UNINITIALIZED IDWriteTextLayout* pTextLayout;
+      mj::TrigramSegment* pSegment = nullptr; // Folders are nodes of pFolders
+      mj::PathTree* pFolders       = nullptr; // Node 0 is the folder, as a single name
+      mj::ArrayList<uint32_t> pending;        // Nodes of pFolders that have not been walked
+
+      // Private
+      MJ_UNINITIALIZED mj::HeapAllocator allocator;
 
       virtual void Execute() override
       {
         ZoneScoped;
 
-        MJ_ERR_HRESULT(svc::DWriteFactory()->CreateTextLayout(this->pEntry->pName->ptr,                      //
-                                                              static_cast<UINT32>(this->pEntry->pName->len), //
-                                                              pParent->pTextFormat,                          //
-                                                              1024.0f,                                       //
-                                                              1024.0f,                                       //
-                                                              &this->pTextLayout));
+        this->pending.Init(&this->allocator);
+        this->pFolders = this->allocator.New<mj::PathTree>();
+        if (!this->pFolders)
+        {
+          return;
+        }
+        this->pFolders->Init(&this->allocator);
+
+        this->pSegment = this->pSegmentAllocator->New<mj::TrigramSegment>();
+        if (!this->pSegment)
+        {
+          return;
+        }
+        this->pSegment->Init(this->pSegmentAllocator);
+
+        MJ_UNINITIALIZED mj::StringView root;
+        root.Init(this->folder.Get(), this->folder.Length());
+        uint32_t rootFolder = this->pFolders->Add(mj::PathTree::NO_NODE, root);
+        if (rootFolder == mj::PathTree::NO_NODE || !this->pending.Add(rootFolder))
+        {
+          return;
+        }
+
+        mj::ArrayList<wchar_t> buffer;
+        buffer.Init(&this->allocator);
+        MJ_DEFER(buffer.Destroy());
+
+        // The wildcard is cut off again, leaving a trailing separator so drive roots open as "C:\\"
+        MJ_UNINITIALIZED mj::StringView wildcard;
+        wildcard.Init(L"*");
+
+        while (this->pending.Size() > 0 && this->pSegment->NumNames() < INDEX_BATCH_SIZE &&
+               !this->token.IsCancelled())
+        {
+          uint32_t parent = this->pending[this->pending.Size() - 1];
+          static_cast<void>(this->pending.Erase(this->pending.Size() - 1, 1));
+
+          mj::StringView path = this->pFolders->GetPath(parent, wildcard, buffer);
+          if (path.IsEmpty())
+          {
+            continue;
+          }
+          buffer[path.len - 1] = L'\0';
+
+          mj::DirectoryReader reader;
+          MJ_DEFER(reader.Destroy());
+          if (!reader.Init(path.ptr, &this->allocator))
+          {
+            // Access denied, or the folder is gone
+            continue;
+          }
+
+          MJ_UNINITIALIZED mj::DirectoryEntry entry;
+          while (reader.Next(&entry))
+          {
+            // Large folders take a while, stop when the panel is destroyed
+            if (this->token.IsCancelled())
+            {
+              break;
+            }
+
+            if (entry.attributes & FILE_ATTRIBUTE_SYSTEM)
+            {
+              continue;
+            }
+
+            bool isFolder = (entry.attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            if (!this->pSegment->AddName(parent, entry.name, isFolder))
+            {
+              break;
+            }
+
+            // Reparse points can form cycles
+            if (isFolder && !(entry.attributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            {
+              uint32_t child = this->pFolders->Add(parent, entry.name);
+              if (child == mj::PathTree::NO_NODE || !this->pending.Add(child))
+              {
+                break;
+              }
+            }
+          }
+        }
+
+        // Not handed to the panel, Destroy frees it
+        if (this->token.IsCancelled())
+        {
+          return;
+        }
+
+        if (!this->pSegment->Build())
+        {
+          this->pSegment->Destroy();
+          this->pSegmentAllocator->Free(this->pSegment);
+          this->pSegment = nullptr;
+        }
+      }
+
+      virtual void OnDone() override
+      {
+        ZoneScoped;
+        OnIndexFolderDone(this->pParent, this);
+      }
+      virtual void Destroy() override
+      {
+        ZoneScoped;
+        if (this->pSegment)
+        {
+          this->pSegment->Destroy();
+          this->pSegmentAllocator->Free(this->pSegment);
+        }
+        if (this->pFolders)
+        {
+          this->pFolders->Destroy();
+          this->allocator.Free(this->pFolders);
+        }
+        this->pending.Destroy();
+        this->folder.Destroy(&this->allocator);
+      }
+    };
+
+    /// <summary>
+    /// Number of text layouts a worker creates at once.
+    /// </summary>
+    static constexpr const size_t TEXT_LAYOUT_GRAIN_SIZE = 16;
+
+    /// <summary>
+    /// Creates the text layouts of a page of entries, as many as fit in the view.
+    /// They are delivered to the main thread together, with a single repaint.
+    /// </summary>
+    struct CreateTextLayoutsBatch : public mj::BatchTask
+    {
+      // In
+      MJ_UNINITIALIZED mj::DirectoryNavigationPanel* pParent;
+      MJ_UNINITIALIZED mj::Entry* pEntries; // First entry of the page
+      MJ_UNINITIALIZED size_t page;
+      MJ_UNINITIALIZED size_t numEntries;
+
+      // Out
+      IDWriteTextLayout** ppTextLayouts = nullptr; // One per entry, allocated and cleared before submitting
+
+      // Private
+      MJ_UNINITIALIZED mj::HeapAllocator allocator;
+      MJ_UNINITIALIZED mj::ETaskPriority::Enum wantedPriority; // Main thread only, see PrioritizeTextLayouts
+
+      virtual void ExecuteRange(size_t begin, size_t end) override
+      {
+        ZoneScoped;
+
+        for (size_t i = begin; i < end && !this->token.IsCancelled(); i++)
+        {
+          const mj::StringView* pName = this->pEntries[i].pName;
+          MJ_ERR_HRESULT(svc::DWriteFactory()->CreateTextLayout(pName->ptr,                      //
+                                                                static_cast<UINT32>(pName->len), //
+                                                                this->pParent->pTextFormat,      //
+                                                                1024.0f,                         //
+                                                                1024.0f,                         //
+                                                                &this->ppTextLayouts[i]));
+        }
+      }
+      virtual void OnDone() override
+      {
+        ZoneScoped;
+        this->pParent->textLayoutBatches[this->page] = nullptr;
+        for (size_t i = 0; this->ppTextLayouts && i < this->numEntries; i++)
+        {
+          IDWriteTextLayout* pTextLayout = this->ppTextLayouts[i];
+          if (pTextLayout && !this->pEntries[i].pTextLayout)
+          {
+            pTextLayout->AddRef();
+            SetTextLayout(this->pParent, &this->pEntries[i], pTextLayout);
+          }
+        }
+        mj::InvalidateRect();
+      }
+      virtual void Destroy() override
+      {
+        if (this->ppTextLayouts)
+        {
+          for (size_t i = 0; i < this->numEntries; i++)
+          {
+            MJ_SAFE_RELEASE(this->ppTextLayouts[i]);
+          }
+          this->allocator.Free(this->ppTextLayouts);
+        }
+      }
+    };
+
+    /// <summary>
+    /// Continuation of a ListFolderContentsTask that creates the text layouts of the rows that fit in the view,
+    /// so they can be shown as soon as the listing reaches the main thread.
+    /// The listing takes the layouts in its OnDone, the other rows are created in batches.
+    /// </summary>
+    struct CreateVisibleTextLayoutsTask : public mj::Task
+    {
+      // In
+      MJ_UNINITIALIZED ListFolderContentsTask* pListing;
+      MJ_UNINITIALIZED IDWriteTextFormat* pTextFormat; // Referenced
+      MJ_UNINITIALIZED size_t maxTextLayouts;
+
+      // Out, in entry order: folders, then files
+      IDWriteTextLayout** ppTextLayouts = nullptr;
+      size_t numTextLayouts             = 0;
+
+      // Private
+      MJ_UNINITIALIZED mj::HeapAllocator allocator;
+
+      virtual void Execute() override
+      {
+        ZoneScoped;
+
+        auto* pListing    = this->pListing;
+        size_t numFolders = pListing->folders.Size();
+        size_t numNames   = mj::min(this->maxTextLayouts, numFolders + pListing->files.Size());
+        if (pListing->status != 0 || numNames == 0)
+        {
+          return;
+        }
+
+        mj::Allocation allocation = this->allocator.Allocation(numNames * sizeof(IDWriteTextLayout*));
+        if (!allocation.Ok())
+        {
+          return;
+        }
+        this->ppTextLayouts = static_cast<IDWriteTextLayout**>(allocation.pAddress);
+
+        for (size_t i = 0; i < numNames && !this->token.IsCancelled(); i++)
+        {
+          auto* pName = i < numFolders ? pListing->stringCache[pListing->folders[i]]
+                                       : pListing->stringCache[pListing->files[i - numFolders]];
+          MJ_ERR_HRESULT(svc::DWriteFactory()->CreateTextLayout(pName->ptr,                      //
+                                                                static_cast<UINT32>(pName->len), //
+                                                                this->pTextFormat,               //
+                                                                1024.0f,                         //
+                                                                1024.0f,                         //
+                                                                &this->ppTextLayouts[i]));
+          this->numTextLayouts++;
+        }
+      }
+      virtual void Destroy() override
+      {
+        for (size_t i = 0; i < this->numTextLayouts; i++)
+        {
+          this->ppTextLayouts[i]->Release();
+        }
+        if (this->ppTextLayouts)
+        {
+          this->allocator.Free(this->ppTextLayouts);
+        }
+        this->pTextFormat->Release();
+      }
+    };
+
+    /// <summary>
+    /// Number of names scanned by a single FilterTask. Smaller candidate sets are filtered on the main thread.
+    /// </summary>
+    static constexpr const size_t FILTER_CHUNK_SIZE = 64 * 1024;
+
+    /// <summary>
+    /// Copy of the entry names of the current listing, in entry order.
+    /// Reference counted by the panel and by running filter jobs, so opening another folder
+    /// does not free names that are still being scanned. Only accessed from the main thread,
+    /// except for reading the names.
+    /// </summary>
+    struct FilterSource
+    {
+      mj::CompactStringCache names;
+      mj::ArrayList<uint64_t> charMasks; // FuzzyCharMask of each name
+      uint32_t refCount;
+    };
+
+    /// <summary>
+    /// Number of best fuzzy matches that are shown.
+    /// </summary>
+    static constexpr const size_t FUZZY_MAX_RESULTS = 1024;
+
+    /// <summary>
+    /// A filter run, split into chunks of FILTER_CHUNK_SIZE candidates.
+    /// A substring filter filters each chunk of candidates in place, and the chunks are concatenated in order.
+    /// A fuzzy filter keeps the best matches of each chunk, and the best of those are kept at the end.
+    /// </summary>
+    struct FilterJob
+    {
+      FilterSource* pSource;
+      size_t* pNumResults;      // Per chunk
+      uint32_t* pIndices;       // Substring: candidates, overwritten with results per chunk
+      mj::FuzzyMatch* pMatches; // Fuzzy: FUZZY_MAX_RESULTS per chunk
+      size_t numCandidates;
+      size_t numChunks;
+      size_t numChunksDone;
+      uint32_t generation;
+      uint32_t refCount; // Number of tasks that have not been destroyed yet
+      bool fuzzy;
+      mj::FilterQuery query;
+      mj::FuzzyQuery fuzzyQuery;
+    };
+
+    void RunFilterChunk(FilterJob* pJob, size_t chunk)
+    {
+      ZoneScoped;
+
+      size_t begin    = chunk * FILTER_CHUNK_SIZE;
+      size_t numChunk = mj::min(FILTER_CHUNK_SIZE, pJob->numCandidates - begin);
+
+      if (pJob->fuzzy)
+      {
+        // Fuzzy filters always scan all entries, so candidates are entry indices
+        mj::FuzzyTopK topK;
+        topK.Init(pJob->pMatches + chunk * FUZZY_MAX_RESULTS, FUZZY_MAX_RESULTS);
+        mj::FuzzySearch(pJob->fuzzyQuery, pJob->pSource->names, pJob->pSource->charMasks.Get(), begin,
+                        begin + numChunk, topK);
+        pJob->pNumResults[chunk] = topK.Size();
+      }
+      else
+      {
+        uint32_t* pChunk         = pJob->pIndices + begin;
+        pJob->pNumResults[chunk] = mj::FilterNames(pJob->query, pJob->pSource->names, pChunk, numChunk, pChunk);
+      }
+    }
+
+    struct FilterTask : public mj::Task
+    {
+      // In
+      MJ_UNINITIALIZED mj::DirectoryNavigationPanel* pParent;
+      MJ_UNINITIALIZED FilterJob* pJob;
+      MJ_UNINITIALIZED size_t chunk;
+
+      virtual void Execute() override
+      {
+        RunFilterChunk(this->pJob, this->chunk);
       }
       virtual void OnDone() override
       {
         ZoneScoped;
-        this->pTextLayout->AddRef();
-        SetTextLayout(this->pParent, this->pEntry, this->pTextLayout);
+        OnFilterChunkDone(this->pParent, this->pJob);
       }
       virtual void Destroy() override
       {
-        this->pTextLayout->Release();
+        ReleaseFilterJob(this->pParent, this->pJob);
       }
     };
 
@@ -282,114 +661,558 @@ namespace mj
       MJ_UNINITIALIZED ID2D1Bitmap* pBitmap;
       MJ_ERR_HRESULT(pRenderTarget->CreateBitmapFromWicBitmap(pConverter, nullptr, &pBitmap));
 
-      return pBitmap;
-    }
+      return pBitmap;
+    }
+
+    void TrySetCurrentFolderText(mj::DirectoryNavigationPanel* pThis)
+    {
+      // Set the current folder string at the top of the control
+      auto* pFactory = svc::DWriteFactory();
+      if (pFactory && !pThis->currentFolderText.IsEmpty())
+      {
+        if (pThis->pCurrentFolderTextLayout)
+        {
+          pThis->pCurrentFolderTextLayout->Release();
+          pThis->pCurrentFolderTextLayout = nullptr;
+        }
+        MJ_ERR_HRESULT(pFactory->CreateTextLayout(pThis->currentFolderText.Get(), pThis->currentFolderText.Length(),
+                                                  pThis->pTextFormat, 1024.0f, 1024.0f,
+                                                  &pThis->pCurrentFolderTextLayout));
+
+        // Test caption button glyphs
+        // Note: Hard-coding "Segoe MDL2 Assets" is probably OK. Haven't found a good way to get it programmatically.
+        // const wchar_t bla[] = L"\xE949, \xE739, \xE923, \xE106";
+        // MJ_ERR_HRESULT(pFactory->CreateTextLayout(bla, 12, pThis->pTextFormat, 1024.0f, 1024.0f,
+        // &pThis->pCurrentFolderTextLayout));
+      }
+    }
+
+    /// <summary>
+    /// Cancels the tasks started for the current listing. Cancelled tasks end without OnDone, so the batches
+    /// are forgotten here instead: they can be freed before the next PrioritizeTextLayouts.
+    /// Queued batches move to Background, so they do not delay the tasks of the next listing.
+    /// </summary>
+    void CancelNavigation(mj::DirectoryNavigationPanel* pThis)
+    {
+      pThis->navigation.Cancel();
+      for (auto* pBatch : pThis->textLayoutBatches)
+      {
+        if (pBatch)
+        {
+          mj::ThreadpoolSetBatchPriority(pBatch, mj::ETaskPriority::Background);
+        }
+      }
+      pThis->textLayoutBatches.Clear();
+    }
+
+    void OpenFolder(mj::DirectoryNavigationPanel* pThis, uint32_t folder)
+    {
+      // Stops the listing and the text layouts of the previous folder, even while they run
+      CancelNavigation(pThis);
+
+      pThis->currentFolderText.Init(pThis->pathTree.GetPath(folder, pThis->pathBuffer), pThis->pAllocator);
+      TrySetCurrentFolderText(pThis);
+      pThis->searchResults = false;
+
+      // The filter applies to the current folder only
+      pThis->filterLength = 0;
+      ApplyFilter(pThis);
+
+      ::QueryPerformanceCounter(&pThis->openFolderTime);
+
+      pThis->pListFolderContentsTask               = mj::ThreadpoolCreateTask<mj::detail::ListFolderContentsTask>();
+      pThis->pListFolderContentsTask->pParent      = pThis;
+      pThis->pListFolderContentsTask->pTextLayouts = nullptr;
+      pThis->pListFolderContentsTask->token        = pThis->navigation.GetToken();
+
+      // Copied, the task must not read the path buffer.
+      // The wildcard is cut off again, leaving a trailing separator so drive roots open as "C:\\"
+      MJ_UNINITIALIZED mj::StringView wildcard;
+      wildcard.Init(L"*");
+      mj::StringView directory = pThis->pathTree.GetPath(folder, wildcard, pThis->pathBuffer);
+      directory.len            = directory.len > 0 ? directory.len - 1 : 0;
+      pThis->pListFolderContentsTask->directory.Init(directory, &pThis->pListFolderContentsTask->allocator, true);
+      if (!pThis->listingPattern.IsEmpty())
+      {
+        // Copied, the pattern can change while the task is running
+        MJ_UNINITIALIZED mj::StringView pattern;
+        pattern.Init(pThis->listingPattern.Get(), pThis->listingPattern.Length());
+        pThis->pListFolderContentsTask->pattern.Init(pattern, &pThis->pListFolderContentsTask->allocator);
+      }
+
+      // The rows in view get their text layouts on the worker, without a round trip through the main thread
+      if (pThis->pTextFormat)
+      {
+        auto* pTextLayouts           = mj::ThreadpoolCreateTask<mj::detail::CreateVisibleTextLayoutsTask>();
+        pTextLayouts->pListing       = pThis->pListFolderContentsTask;
+        pTextLayouts->pTextFormat    = pThis->pTextFormat;
+        pTextLayouts->maxTextLayouts = GetNumRowsInView(pThis);
+        pTextLayouts->token          = pThis->navigation.GetToken();
+        pTextLayouts->pTextFormat->AddRef();
+        mj::ThreadpoolThen(pThis->pListFolderContentsTask, pTextLayouts);
+        pThis->pListFolderContentsTask->pTextLayouts = pTextLayouts;
+      }
+      mj::ThreadpoolSubmitTask(pThis->pListFolderContentsTask);
+    }
+
+    void OpenSubFolder(mj::DirectoryNavigationPanel* pThis, const wchar_t* pFolder)
+    {
+      uint32_t* pLast = pThis->breadcrumb.Last();
+      if (pLast)
+      {
+        MJ_UNINITIALIZED mj::StringView name;
+        name.Init(pFolder);
+
+        // Search results are named by their full path
+        uint32_t folder = pThis->searchResults ? pThis->pathTree.AddPath(mj::PathTree::NO_NODE, name)
+                                               : pThis->pathTree.Add(*pLast, name);
+        if (folder != mj::PathTree::NO_NODE && pThis->breadcrumb.Add(folder))
+        {
+          OpenFolder(pThis, folder);
+        }
+      }
+    }
+
+    /// <summary>
+    /// Lists the current folder again, e.g. after the listing pattern has changed.
+    /// </summary>
+    void ReopenFolder(mj::DirectoryNavigationPanel* pThis)
+    {
+      uint32_t* pLast = pThis->breadcrumb.Last();
+      if (pLast)
+      {
+        OpenFolder(pThis, *pLast);
+      }
+    }
+
+    mj::Entry* TestMouseEntry(mj::DirectoryNavigationPanel* pThis, int16_t x, int16_t y, RECT* pRect,
+                              size_t* pRow = nullptr)
+    {
+      // Rows have a fixed height, so there is no need to test every row
+      int32_t pointY = y - pThis->scrollOffset;
+      if (x < 0 || x >= pThis->rect.width || pointY < 0)
+      {
+        return nullptr;
+      }
+
+      size_t row = static_cast<size_t>(pointY / ENTRY_HEIGHT);
+      if (row >= pThis->visibleEntries.Size())
+      {
+        return nullptr;
+      }
+
+      auto& entry = pThis->entries[pThis->visibleEntries[row]];
+      if (!entry.pTextLayout)
+      {
+        return nullptr;
+      }
+
+      if (pRect)
+      {
+        pRect->left   = 0;
+        pRect->right  = pThis->rect.width;
+        pRect->top    = pThis->scrollOffset + static_cast<LONG>(row) * ENTRY_HEIGHT;
+        pRect->bottom = pRect->top + ENTRY_HEIGHT;
+      }
+      if (pRow)
+      {
+        *pRow = row;
+      }
+      return &entry;
+    }
+
+    void SetTextLayout(mj::DirectoryNavigationPanel* pThis, mj::Entry* pEntry, IDWriteTextLayout* pTextLayout)
+    {
+      pEntry->pTextLayout = pTextLayout;
+
+#ifdef _DEBUG
+      if (pThis->openFolderTime.QuadPart != 0)
+      {
+        // Time to first row: from OpenFolder until the first row can be drawn
+        MJ_UNINITIALIZED LARGE_INTEGER now;
+        MJ_UNINITIALIZED LARGE_INTEGER frequency;
+        ::QueryPerformanceCounter(&now);
+        ::QueryPerformanceFrequency(&frequency);
+
+        mj::StringBuilder sb;
+        sb.Init(pThis->pAllocator);
+        MJ_DEFER(sb.Destroy());
+        sb.Append(L"First row after ")
+            .AppendUInt64(static_cast<uint64_t>((now.QuadPart - pThis->openFolderTime.QuadPart) * 1000000 /
+                                                frequency.QuadPart))
+            .Append(L" us\r\n");
+        ::OutputDebugStringW(sb.ToStringClosed().ptr);
+      }
+#endif
+      pThis->openFolderTime.QuadPart = 0;
+
+      // The scroll position is kept: the pages in view load first, so the user may have scrolled already.
+      // Listings start at the top, see OnFilterApplied.
+      if (++pThis->numEntriesDoneLoading == pThis->entries.Size())
+      {
+        mj::InvalidateRect();
+      }
+    }
+
+    size_t GetNumRowsInView(const mj::DirectoryNavigationPanel* pThis)
+    {
+      // Same as PaintEntryList: a partial row at the top and at the bottom
+      return static_cast<size_t>(mj::max<int16_t>(pThis->rect.height, 0) / ENTRY_HEIGHT + 2);
+    }
+
+    /// <summary>
+    /// Rows in view first, then the rows up to a screen away, the rest in the background.
+    /// </summary>
+    mj::ETaskPriority::Enum GetTextLayoutPriority(const mj::DirectoryNavigationPanel* pThis, size_t row)
+    {
+      size_t numRows  = GetNumRowsInView(pThis);
+      size_t firstRow = static_cast<size_t>(-pThis->scrollOffset / ENTRY_HEIGHT);
+      if (row >= firstRow && row < firstRow + numRows)
+      {
+        return mj::ETaskPriority::Interactive;
+      }
+      if (row + numRows >= firstRow && row < firstRow + 2 * numRows)
+      {
+        return mj::ETaskPriority::VisibleSoon;
+      }
+      return mj::ETaskPriority::Background;
+    }
+
+    /// <summary>
+    /// Moves the queued text layout batches to the lane of their most urgent row, after scrolling or filtering.
+    /// </summary>
+    void PrioritizeTextLayouts(mj::DirectoryNavigationPanel* pThis)
+    {
+      ZoneScoped;
+
+      if (pThis->textLayoutBatches.Size() == 0)
+      {
+        return;
+      }
+
+      for (auto* pBatch : pThis->textLayoutBatches)
+      {
+        if (pBatch)
+        {
+          pBatch->wantedPriority = mj::ETaskPriority::Background;
+        }
+      }
+
+      // Only rows up to a screen away from the view are more urgent
+      size_t numRows  = GetNumRowsInView(pThis);
+      size_t firstRow = static_cast<size_t>(-pThis->scrollOffset / ENTRY_HEIGHT);
+      size_t beginRow = firstRow > numRows ? firstRow - numRows : 0;
+      size_t endRow   = mj::min(pThis->visibleEntries.Size(), firstRow + 2 * numRows);
+      for (size_t row = beginRow; row < endRow; row++)
+      {
+        auto* pBatch = pThis->textLayoutBatches[pThis->visibleEntries[row] / pThis->textLayoutPageSize];
+        if (pBatch)
+        {
+          pBatch->wantedPriority = mj::min(pBatch->wantedPriority, GetTextLayoutPriority(pThis, row));
+        }
+      }
+
+      // In page order, so pages that move to the same lane are taken top to bottom
+      for (auto* pBatch : pThis->textLayoutBatches)
+      {
+        if (pBatch)
+        {
+          mj::ThreadpoolSetBatchPriority(pBatch, pBatch->wantedPriority);
+        }
+      }
+    }
+
+    void ReleaseFilterSource(mj::DirectoryNavigationPanel* pThis, FilterSource* pSource)
+    {
+      if (pSource && --pSource->refCount == 0)
+      {
+        pSource->names.Destroy();
+        pSource->charMasks.Destroy();
+        pThis->pAllocator->Free(pSource);
+      }
+    }
+
+    void ReleaseFilterJob(mj::DirectoryNavigationPanel* pThis, FilterJob* pJob)
+    {
+      if (--pJob->refCount == 0)
+      {
+        ReleaseFilterSource(pThis, pJob->pSource);
+        pThis->pAllocator->Free(pJob);
+      }
+    }
+
+    /// <summary>
+    /// Creates the FilterSource from the names of all entries.
+    /// </summary>
+    void CreateFilterSource(mj::DirectoryNavigationPanel* pThis)
+    {
+      ZoneScoped;
+
+      FilterSource* pSource = static_cast<FilterSource*>(pThis->pAllocator->Allocate(sizeof(FilterSource)));
+      MJ_EXIT_NULL(pSource);
+      pSource->names       = {};
+      pSource->charMasks   = {};
+      pSource->refCount    = 1;
+      pThis->pFilterSource = pSource;
+
+      pSource->names.Init(pThis->pAllocator);
+      pSource->charMasks.Init(pThis->pAllocator);
+
+      size_t numChars = 0;
+      for (const auto& entry : pThis->entries)
+      {
+        numChars += entry.pName->len;
+      }
+      MJ_EXIT_NULL(pSource->names.Reserve(pThis->entries.Size(), numChars));
+
+      uint64_t* pCharMasks = pSource->charMasks.Emplace(pThis->entries.Size());
+      MJ_EXIT_NULL(pCharMasks);
+
+      for (const auto& entry : pThis->entries)
+      {
+        MJ_EXIT_NULL(pSource->names.Add(*entry.pName));
+        *pCharMasks++ = mj::FuzzyCharMask(*entry.pName);
+      }
+    }
+
+    /// <summary>
+    /// Shows all entries.
+    /// </summary>
+    void ResetVisibleEntries(mj::DirectoryNavigationPanel* pThis)
+    {
+      pThis->visibleEntries.Clear();
+
+      size_t numEntries = pThis->entries.Size();
+      if (numEntries > 0)
+      {
+        uint32_t* pIndices = pThis->visibleEntries.Emplace(numEntries);
+        MJ_EXIT_NULL(pIndices);
+        for (size_t i = 0; i < numEntries; i++)
+        {
+          pIndices[i] = static_cast<uint32_t>(i);
+        }
+      }
+    }
+
+    void UpdateFilterTextLayout(mj::DirectoryNavigationPanel* pThis)
+    {
+      MJ_SAFE_RELEASE(pThis->pFilterTextLayout);
+
+      auto* pFactory = svc::DWriteFactory();
+      if (pFactory && pThis->pTextFormat && (pThis->filterLength > 0 || !pThis->listingPattern.IsEmpty()))
+      {
+        static constexpr const wchar_t FUZZY_PREFIX[]     = L"Fuzzy: ";
+        static constexpr const size_t FUZZY_PREFIX_LENGTH = MJ_COUNTOF(FUZZY_PREFIX) - 1;
+        static constexpr const wchar_t VIEW_PREFIX[]      = L"View: ";
+        static constexpr const size_t VIEW_PREFIX_LENGTH  = MJ_COUNTOF(VIEW_PREFIX) - 1;
+
+        MJ_UNINITIALIZED wchar_t buffer[FUZZY_PREFIX_LENGTH + MJ_COUNTOF(pThis->filterText)];
+        size_t length = 0;
+        if (pThis->filterLength > 0)
+        {
+          if (pThis->fuzzyFilter)
+          {
+            static_cast<void>(::memcpy(buffer, FUZZY_PREFIX, FUZZY_PREFIX_LENGTH * sizeof(wchar_t)));
+            length = FUZZY_PREFIX_LENGTH;
+          }
+          static_cast<void>(::memcpy(buffer + length, pThis->filterText, pThis->filterLength * sizeof(wchar_t)));
+          length += pThis->filterLength;
+        }
+        else
+        {
+          // Show the listing pattern while nothing is typed
+          size_t patternLength = mj::min(pThis->listingPattern.Length(), MJ_COUNTOF(pThis->filterText));
+          static_cast<void>(::memcpy(buffer, VIEW_PREFIX, VIEW_PREFIX_LENGTH * sizeof(wchar_t)));
+          static_cast<void>(
+              ::memcpy(buffer + VIEW_PREFIX_LENGTH, pThis->listingPattern.Get(), patternLength * sizeof(wchar_t)));
+          length = VIEW_PREFIX_LENGTH + patternLength;
+        }
+
+        MJ_ERR_HRESULT(pFactory->CreateTextLayout(buffer,                      //
+                                                  static_cast<UINT32>(length), //
+                                                  pThis->pTextFormat,          //
+                                                  1024.0f,                     //
+                                                  1024.0f,                     //
+                                                  &pThis->pFilterTextLayout));
+      }
+    }
+
+    /// <summary>
+    /// Called when visibleEntries has changed.
+    /// </summary>
+    /// <param name="query">The substring query visibleEntries was computed with</param>
+    /// <param name="fuzzyResults">True if visibleEntries holds ranked fuzzy matches, which cannot be refined</param>
+    void OnFilterApplied(mj::DirectoryNavigationPanel* pThis, const mj::FilterQuery& query, bool fuzzyResults)
+    {
+      pThis->appliedFilter = query;
+      pThis->fuzzyResults  = fuzzyResults;
+      pThis->selectedEntry.Reset();
+      pThis->hoveredRow.Reset();
+      pThis->scrollOffset = 0;
+      PrioritizeTextLayouts(pThis);
+      mj::InvalidateRect();
+    }
+
+    void MergeFilterResults(mj::DirectoryNavigationPanel* pThis, FilterJob* pJob)
+    {
+      ZoneScoped;
+
+      pThis->visibleEntries.Clear();
+
+      if (pJob->fuzzy)
+      {
+        // Concatenate the best matches of each chunk, then keep the best of those
+        size_t numMatches = 0;
+        for (size_t i = 0; i < pJob->numChunks; i++)
+        {
+          size_t numResults = pJob->pNumResults[i];
+          static_cast<void>(::memmove(pJob->pMatches + numMatches, pJob->pMatches + i * FUZZY_MAX_RESULTS,
+                                      numResults * sizeof(mj::FuzzyMatch)));
+          numMatches += numResults;
+        }
+        mj::Sort(pJob->pMatches, pJob->pMatches + numMatches, mj::FuzzyBetter);
+
+        numMatches = mj::min(numMatches, FUZZY_MAX_RESULTS);
+        if (numMatches > 0)
+        {
+          uint32_t* pDest = pThis->visibleEntries.Emplace(numMatches);
+          MJ_EXIT_NULL(pDest);
+          for (size_t i = 0; i < numMatches; i++)
+          {
+            pDest[i] = pJob->pMatches[i].index;
+          }
+        }
 
-    void TrySetCurrentFolderText(mj::DirectoryNavigationPanel* pThis)
-    {
-      // Set the current folder string at the top of the control
-      auto* pFactory = svc::DWriteFactory();
-      if (pFactory && !pThis->currentFolderText.IsEmpty())
+        OnFilterApplied(pThis, {}, true);
+      }
+      else
       {
-        if (pThis->pCurrentFolderTextLayout)
+        for (size_t i = 0; i < pJob->numChunks; i++)
         {
-          pThis->pCurrentFolderTextLayout->Release();
-          pThis->pCurrentFolderTextLayout = nullptr;
+          size_t numResults = pJob->pNumResults[i];
+          if (numResults > 0)
+          {
+            uint32_t* pDest = pThis->visibleEntries.Emplace(numResults);
+            MJ_EXIT_NULL(pDest);
+            static_cast<void>(
+                ::memcpy(pDest, pJob->pIndices + i * FILTER_CHUNK_SIZE, numResults * sizeof(uint32_t)));
+          }
         }
-        MJ_ERR_HRESULT(pFactory->CreateTextLayout(pThis->currentFolderText.Get(), pThis->currentFolderText.Length(),
-                                                  pThis->pTextFormat, 1024.0f, 1024.0f,
-                                                  &pThis->pCurrentFolderTextLayout));
 
-        // Test caption button glyphs
-        // Note: Hard-coding "Segoe MDL2 Assets" is probably OK. Haven't found a good way to get it programmatically.
-        // const wchar_t bla[] = L"\xE949, \xE739, \xE923, \xE106";
-        // MJ_ERR_HRESULT(pFactory->CreateTextLayout(bla, 12, pThis->pTextFormat, 1024.0f, 1024.0f,
-        // &pThis->pCurrentFolderTextLayout));
+        OnFilterApplied(pThis, pJob->query, false);
       }
     }
 
-    void OpenFolder(mj::DirectoryNavigationPanel* pThis)
+    void OnFilterChunkDone(mj::DirectoryNavigationPanel* pThis, FilterJob* pJob)
     {
-      if (pThis->pListFolderContentsTask)
+      // Results are merged once, when the last chunk is done, and only if no newer filter was started since
+      if (++pJob->numChunksDone == pJob->numChunks && pJob->generation == pThis->filterGeneration)
       {
-        pThis->pListFolderContentsTask->cancelled = true;
+        MergeFilterResults(pThis, pJob);
       }
-
-      pThis->currentFolderText.Init(pThis->sbOpenFolder.ToStringOpen(), pThis->pAllocator);
-      TrySetCurrentFolderText(pThis);
-
-      // Note: The StringBuilder should already contain the folder here.
-      pThis->sbOpenFolder.Append(L"\\*");
-      pThis->pListFolderContentsTask            = mj::ThreadpoolCreateTask<mj::detail::ListFolderContentsTask>();
-      pThis->pListFolderContentsTask->pParent   = pThis;
-      pThis->pListFolderContentsTask->directory = pThis->sbOpenFolder.ToStringClosed();
-      mj::ThreadpoolSubmitTask(pThis->pListFolderContentsTask);
     }
 
-    void OpenSubFolder(mj::DirectoryNavigationPanel* pThis, const wchar_t* pFolder)
+    /// <summary>
+    /// Filters the entries using the current filter text.
+    /// If the new query refines the query of the visible entries, only those are scanned again.
+    /// </summary>
+    void ApplyFilter(mj::DirectoryNavigationPanel* pThis)
     {
-      mj::StringView* pLast = pThis->breadcrumb.Last();
-      if (pLast)
-      {
-        pThis->sbOpenFolder.Clear();
-        pThis->sbOpenFolder.Append(*pLast);
-        pThis->sbOpenFolder.Append(L"\\");
-        pThis->sbOpenFolder.Append(pFolder);
+      ZoneScoped;
 
-        mj::StringView str = pThis->sbOpenFolder.ToStringOpen();
-        pThis->breadcrumb.Add(str);
+      // Results of running filter jobs are discarded from now on
+      pThis->filterGeneration++;
+      UpdateFilterTextLayout(pThis);
 
-        OpenFolder(pThis);
+      if (!pThis->pFilterSource)
+      {
+        return;
       }
-    }
 
-    mj::Entry* TestMouseEntry(mj::DirectoryNavigationPanel* pThis, int16_t x, int16_t y, RECT* pRect)
-    {
-      LONG pointY = pThis->scrollOffset;
+      MJ_UNINITIALIZED mj::StringView text;
+      text.Init(pThis->filterText, pThis->filterLength);
+      MJ_UNINITIALIZED mj::FilterQuery query;
+      query.Init(text);
 
-      for (auto i = 0; i < pThis->entries.Size(); i++)
+      if (query.IsEmpty())
       {
-        auto& entry = pThis->entries[i];
-        if (entry.pTextLayout)
-        {
-          MJ_UNINITIALIZED RECT rect;
-          rect.left   = 0;
-          rect.right  = pThis->rect.width;
-          rect.top    = pointY;
-          rect.bottom = pointY + ENTRY_HEIGHT;
-
-          MJ_UNINITIALIZED POINT p;
-          p.x = x;
-          p.y = y;
+        ResetVisibleEntries(pThis);
+        OnFilterApplied(pThis, query, false);
+        return;
+      }
 
-          if (::PtInRect(&rect, p))
-          {
-            if (pRect)
-            {
-              *pRect = rect;
-            }
-            return &entry;
-          }
+      // Fuzzy results are ranked and truncated, so they are never refined
+      bool fuzzy           = pThis->fuzzyFilter;
+      bool refine          = !fuzzy && !pThis->fuzzyResults && query.Refines(pThis->appliedFilter);
+      size_t numCandidates = refine ? pThis->visibleEntries.Size() : pThis->entries.Size();
+      size_t numChunks     = (numCandidates + FILTER_CHUNK_SIZE - 1) / FILTER_CHUNK_SIZE;
+
+      size_t numBytes = sizeof(FilterJob) + numChunks * sizeof(size_t);
+      numBytes += fuzzy ? numChunks * FUZZY_MAX_RESULTS * sizeof(mj::FuzzyMatch) : numCandidates * sizeof(uint32_t);
+      FilterJob* pJob = static_cast<FilterJob*>(pThis->pAllocator->Allocate(numBytes));
+      MJ_EXIT_NULL(pJob);
+
+      pJob->pSource       = pThis->pFilterSource;
+      pJob->pNumResults   = reinterpret_cast<size_t*>(pJob + 1);
+      pJob->pIndices      = fuzzy ? nullptr : reinterpret_cast<uint32_t*>(pJob->pNumResults + numChunks);
+      pJob->pMatches      = fuzzy ? reinterpret_cast<mj::FuzzyMatch*>(pJob->pNumResults + numChunks) : nullptr;
+      pJob->numCandidates = numCandidates;
+      pJob->numChunks     = numChunks;
+      pJob->numChunksDone = 0;
+      pJob->generation    = pThis->filterGeneration;
+      pJob->refCount      = static_cast<uint32_t>(numChunks);
+      pJob->fuzzy         = fuzzy;
+      pJob->query         = query;
+      pJob->fuzzyQuery.Init(text);
+      pJob->pSource->refCount++;
+
+      if (refine)
+      {
+        static_cast<void>(::memcpy(pJob->pIndices, pThis->visibleEntries.begin(), numCandidates * sizeof(uint32_t)));
+      }
+      else if (!fuzzy)
+      {
+        for (size_t i = 0; i < numCandidates; i++)
+        {
+          pJob->pIndices[i] = static_cast<uint32_t>(i);
         }
-        pointY += ENTRY_HEIGHT;
       }
 
-      return nullptr;
-    }
-
-    void SetTextLayout(mj::DirectoryNavigationPanel* pThis, mj::Entry* pEntry, IDWriteTextLayout* pTextLayout)
-    {
-      pEntry->pTextLayout = pTextLayout;
+      if (numChunks <= 1)
+      {
+        // Small enough to filter on the main thread
+        if (numChunks == 1)
+        {
+          RunFilterChunk(pJob, 0);
+        }
+        pJob->refCount = 1;
+        MergeFilterResults(pThis, pJob);
+        ReleaseFilterJob(pThis, pJob);
+        return;
+      }
 
-      if (++pThis->numEntriesDoneLoading == pThis->entries.Size())
+      // Split across the threadpool. The visible entries stay as they are until all chunks are done.
+      for (size_t i = 0; i < numChunks; i++)
       {
-        pThis->scrollOffset = 0;
-        mj::InvalidateRect();
+        auto pTask     = mj::ThreadpoolCreateTask<mj::detail::FilterTask>();
+        pTask->pParent = pThis;
+        pTask->pJob    = pJob;
+        pTask->chunk   = i;
+        mj::ThreadpoolSubmitTask(pTask);
       }
     }
 
     void ClearEntries(mj::DirectoryNavigationPanel* pThis)
     {
+      // Running filter jobs refer to the old entries
+      pThis->filterGeneration++;
+      pThis->visibleEntries.Clear();
+      ReleaseFilterSource(pThis, pThis->pFilterSource);
+      pThis->pFilterSource = nullptr;
+
+      // Text layouts of the old entries are dropped
+      CancelNavigation(pThis);
+
       for (auto& element : pThis->entries)
       {
         // Only release if icon exists and is not a shared icon
@@ -461,7 +1284,59 @@ namespace mj
     }
 #endif
 
-    void TryCreateFolderContentTextLayouts(mj::DirectoryNavigationPanel* pThis)
+    /// <summary>
+    /// Starts a CreateTextLayoutsBatch for every page of entries that has no text layouts yet.
+    /// </summary>
+    void StartTextLayouts(mj::DirectoryNavigationPanel* pThis)
+    {
+      ZoneScoped;
+
+      size_t numEntries = pThis->entries.Size();
+      size_t pageSize   = GetNumRowsInView(pThis);
+      size_t numPages   = (numEntries + pageSize - 1) / pageSize;
+      auto** ppBatches  = pThis->textLayoutBatches.Emplace(numPages);
+      if (!ppBatches)
+      {
+        return;
+      }
+      pThis->textLayoutPageSize = pageSize;
+
+      for (size_t page = 0; page < numPages; page++)
+      {
+        size_t firstEntry = page * pageSize;
+        size_t numPage    = mj::min(pageSize, numEntries - firstEntry);
+        ppBatches[page]   = nullptr;
+
+        // The first page usually got its text layouts along with the listing
+        if (pThis->entries[firstEntry + numPage - 1].pTextLayout)
+        {
+          continue;
+        }
+
+        auto* pBatch       = mj::ThreadpoolCreateTask<mj::detail::CreateTextLayoutsBatch>();
+        pBatch->pParent    = pThis;
+        pBatch->pEntries   = &pThis->entries[firstEntry];
+        pBatch->page       = page;
+        pBatch->numEntries = numPage;
+        pBatch->priority   = GetTextLayoutPriority(pThis, firstEntry); // Not filtered yet, rows are entries
+        pBatch->token      = pThis->navigation.GetToken();
+
+        mj::Allocation allocation = pBatch->allocator.Allocation(numPage * sizeof(IDWriteTextLayout*));
+        if (allocation.Ok())
+        {
+          pBatch->ppTextLayouts = static_cast<IDWriteTextLayout**>(allocation.pAddress);
+          static_cast<void>(::memset(pBatch->ppTextLayouts, 0, numPage * sizeof(IDWriteTextLayout*)));
+        }
+
+        // Without layouts to fill in, the batch just ends
+        mj::ThreadpoolSubmitBatch(pBatch, pBatch->ppTextLayouts ? numPage : 0, TEXT_LAYOUT_GRAIN_SIZE);
+        ppBatches[page] = pBatch;
+      }
+    }
+
+    /// <param name="pTextLayouts">Text layouts created along with the listing, or nullptr</param>
+    void TryCreateFolderContentTextLayouts(mj::DirectoryNavigationPanel* pThis,
+                                           CreateVisibleTextLayoutsTask* pTextLayouts)
     {
       ZoneScoped;
 
@@ -475,7 +1350,8 @@ namespace mj
       // Skipping the check for DWrite because our TextFormat already depends on it.
       if (numItems > 0 && pThis->pTextFormat)
       {
-        pThis->pHoveredEntry = nullptr;
+        pThis->hoveredRow.Reset();
+        pThis->selectedEntry.Reset();
         if (pThis->entries.Emplace(numItems))
         {
           // Variable number of tasks with the same cancellation token
@@ -490,11 +1366,6 @@ namespace mj
             entry.pName =
                 pThis->listFolderContentsTaskResult.stringCache[pThis->listFolderContentsTaskResult.folders[i]];
             entry.pIcon = res::d2d1::FolderIcon();
-
-            auto pTask     = mj::ThreadpoolCreateTask<mj::detail::CreateTextLayoutTask>();
-            pTask->pParent = pThis;
-            pTask->pEntry  = &entry;
-            mj::ThreadpoolSubmitTask(pTask);
           }
 
           // Files
@@ -505,28 +1376,324 @@ namespace mj
             entry.type  = mj::EEntryType::File;
             entry.pName = pThis->listFolderContentsTaskResult.stringCache[pThis->listFolderContentsTaskResult.files[i]];
             entry.pIcon = res::d2d1::FileIcon();
+          }
 
-            auto pTask     = mj::ThreadpoolCreateTask<mj::detail::CreateTextLayoutTask>();
-            pTask->pParent = pThis;
-            pTask->pEntry  = &entry;
-            mj::ThreadpoolSubmitTask(pTask);
+          // Rows in view
+          for (size_t i = 0; pTextLayouts && i < pTextLayouts->numTextLayouts; i++)
+          {
+            pTextLayouts->ppTextLayouts[i]->AddRef();
+            SetTextLayout(pThis, &pThis->entries[i], pTextLayouts->ppTextLayouts[i]);
           }
+          StartTextLayouts(pThis);
+
+          CreateFilterSource(pThis);
+          ResetVisibleEntries(pThis);
+          OnFilterApplied(pThis, {}, false);
         }
       }
     }
 
+#ifdef _DEBUG
+    /// <summary>
+    /// Prints the memory a listed entry costs, split into names, metadata columns, and the panel's rows,
+    /// using OutputDebugStringW. Spare capacity is not counted.
+    /// </summary>
+    void ReportListingMemory(mj::DirectoryNavigationPanel* pThis)
+    {
+      auto& result      = pThis->listFolderContentsTaskResult;
+      size_t numEntries = result.stringCache.Size();
+      if (numEntries == 0)
+      {
+        return;
+      }
+
+      // StringCache: views + characters (including null terminators)
+      size_t numChars = 0;
+      for (const auto& string : result.stringCache)
+      {
+        numChars += string.len + 1;
+      }
+      size_t nameBytes   = numEntries * sizeof(mj::StringView) + numChars * sizeof(wchar_t);
+      size_t columnBytes = result.columns.ByteWidth();
+
+      // Folder and file lists, entries and visibleEntries
+      size_t rowBytes = result.folders.ByteWidth() + result.files.ByteWidth() +
+                        numEntries * (sizeof(mj::Entry) + sizeof(uint32_t));
+
+      // Results are rounded to one decimal
+      auto Round = [](double value) { return static_cast<double>(static_cast<int64_t>(value * 10.0 + 0.5)) / 10.0; };
+      auto BytesPerEntry = [&](size_t numBytes) {
+        return Round(static_cast<double>(numBytes) / static_cast<double>(numEntries));
+      };
+
+      mj::StringBuilder sb;
+      sb.Init(pThis->pAllocator);
+      MJ_DEFER(sb.Destroy());
+
+      sb.Append(L"Listing memory for ").AppendUInt64(numEntries).Append(L" entries: ");
+      sb.AppendDouble(BytesPerEntry(nameBytes + columnBytes + rowBytes)).Append(L" bytes/entry (names ");
+      sb.AppendDouble(BytesPerEntry(nameBytes)).Append(L", metadata ");
+      sb.AppendDouble(BytesPerEntry(columnBytes)).Append(L", rows ");
+      sb.AppendDouble(BytesPerEntry(rowBytes)).Append(L")\r\n");
+      ::OutputDebugStringW(sb.ToStringClosed().ptr);
+    }
+
+    /// <summary>
+    /// Compares the memory use and lookup cost of the alternative name layouts, see ReportStringCacheLayouts.
+    /// Builds every layout of the listing, which takes too long for the main thread in large folders.
+    /// </summary>
+    struct ReportStringCacheLayoutsTask : public mj::Task
+    {
+      // In
+      mj::StringCache stringCache; // Copy of the listing's names
+
+      // Private
+      MJ_UNINITIALIZED mj::HeapAllocator allocator;
+
+      virtual void Execute() override
+      {
+        ZoneScoped;
+        mj::ReportStringCacheLayouts(this->stringCache, &this->allocator);
+      }
+
+      virtual void Destroy() override
+      {
+        this->stringCache.Destroy();
+      }
+    };
+
+    void StartReportStringCacheLayouts(mj::DirectoryNavigationPanel* pThis)
+    {
+      auto* pTask = mj::ThreadpoolCreateTask<ReportStringCacheLayoutsTask>();
+      if (!pTask)
+      {
+        return;
+      }
+
+      pTask->priority = mj::ETaskPriority::Background;
+      pTask->token    = pThis->navigation.GetToken();
+      pTask->stringCache.Init(&pTask->allocator);
+
+      // Out of memory leaves the copy empty, and nothing is reported
+      static_cast<void>(pTask->stringCache.Copy(pThis->listFolderContentsTaskResult.stringCache));
+      mj::ThreadpoolSubmitTask(pTask);
+    }
+#endif
+
     void OnListFolderContentsDone(mj::DirectoryNavigationPanel* pThis, detail::ListFolderContentsTask* pTask)
     {
-      if (pTask->status == 0 &&                                               //
-          pThis->listFolderContentsTaskResult.files.Copy(pTask->files) &&     //
-          pThis->listFolderContentsTaskResult.folders.Copy(pTask->folders) && //
-          pThis->listFolderContentsTaskResult.stringCache.Copy(pTask->stringCache))
+      if (pTask->status == 0 &&                                                       //
+          pThis->listFolderContentsTaskResult.files.Copy(pTask->files) &&             //
+          pThis->listFolderContentsTaskResult.folders.Copy(pTask->folders) &&         //
+          pThis->listFolderContentsTaskResult.stringCache.Copy(pTask->stringCache) && //
+          pThis->listFolderContentsTaskResult.columns.Copy(pTask->columns))
       {
+#ifdef _DEBUG
+        StartReportStringCacheLayouts(pThis);
+        ReportListingMemory(pThis);
+#endif
+
         // TODO: Start icon, TextFormat tasks if preconditions are met
         // pThis->TryLoadFolderContentIcons();
-        TryCreateFolderContentTextLayouts(pThis);
+        TryCreateFolderContentTextLayouts(pThis, pTask->pTextLayouts);
+      }
+      pThis->pListFolderContentsTask = nullptr;
+    }
+
+    /// <summary>
+    /// Hands pending folders to idle index tasks.
+    /// </summary>
+    void ContinueIndexing(mj::DirectoryNavigationPanel* pThis);
+
+    /// <summary>
+    /// Starts the walk of the whole drive on the first search, so it does not compete with the first listing
+    /// for the IO workers. Names show up in search results as the walk finds them.
+    /// </summary>
+    void StartIndexing(mj::DirectoryNavigationPanel* pThis)
+    {
+      if (pThis->indexStarted)
+      {
+        return;
+      }
+
+      MJ_UNINITIALIZED mj::StringView drive;
+      drive.Init(L"C:");
+      uint32_t root = pThis->pathTree.Add(mj::PathTree::NO_NODE, drive);
+      if (root != mj::PathTree::NO_NODE && pThis->pendingIndexFolders.Add(root))
+      {
+        pThis->indexStarted = true;
+        ContinueIndexing(pThis);
+      }
+    }
+
+    void ContinueIndexing(mj::DirectoryNavigationPanel* pThis)
+    {
+      for (auto& pTask : pThis->pIndexTasks)
+      {
+        size_t numPending = pThis->pendingIndexFolders.Size();
+        if (!pTask && numPending > 0)
+        {
+          pTask = mj::ThreadpoolCreateTask<IndexFolderTask>();
+          if (!pTask)
+          {
+            break;
+          }
+
+          uint32_t folder = pThis->pendingIndexFolders[numPending - 1];
+          static_cast<void>(pThis->pendingIndexFolders.Erase(numPending - 1, 1));
+
+          pTask->pParent           = pThis;
+          pTask->pSegmentAllocator = pThis->pAllocator;
+          pTask->rootNode          = folder;
+          pTask->token             = pThis->indexing.GetToken();
+          pTask->folder.Init(pThis->pathTree.GetPath(folder, pThis->pathBuffer), &pTask->allocator);
+          mj::ThreadpoolSubmitTask(pTask);
+        }
+      }
+    }
+
+    /// <summary>
+    /// Adds the folders of a finished walk to the panel's tree.
+    /// </summary>
+    /// <param name="folders">Receives the panel node of each node of the task's tree</param>
+    bool MergeIndexedFolders(mj::DirectoryNavigationPanel* pThis, IndexFolderTask* pTask,
+                             mj::ArrayList<uint32_t>& folders)
+    {
+      size_t numFolders = pTask->pFolders ? pTask->pFolders->NumNodes() : 0;
+      uint32_t* pFolders = numFolders > 0 ? folders.Emplace(numFolders) : nullptr;
+      if (!pFolders)
+      {
+        return false;
+      }
+
+      // Node 0 is the walked folder itself. Parents are always added before their children.
+      pFolders[0] = pTask->rootNode;
+      for (uint32_t i = 1; i < numFolders; i++)
+      {
+        pFolders[i] = pThis->pathTree.Add(pFolders[pTask->pFolders->GetParent(i)], pTask->pFolders->GetName(i));
+        if (pFolders[i] == mj::PathTree::NO_NODE)
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    void OnIndexFolderDone(mj::DirectoryNavigationPanel* pThis, IndexFolderTask* pTask)
+    {
+      mj::ArrayList<uint32_t> folders;
+      folders.Init(pThis->pAllocator);
+      MJ_DEFER(folders.Destroy());
+
+      // On failure, the names and unwalked folders of this task are dropped
+      if (MergeIndexedFolders(pThis, pTask, folders))
+      {
+        if (pTask->pSegment)
+        {
+          pTask->pSegment->RemapFolders(folders.Get());
+          if (pThis->pathIndex.Add(pTask->pSegment))
+          {
+            // The index owns it now
+            pTask->pSegment = nullptr;
+          }
+        }
+
+        for (uint32_t folder : pTask->pending)
+        {
+          static_cast<void>(pThis->pendingIndexFolders.Add(folders[folder]));
+        }
+      }
+
+      for (auto& pIndexTask : pThis->pIndexTasks)
+      {
+        if (pIndexTask == pTask)
+        {
+          pIndexTask = nullptr;
+        }
+      }
+
+      ContinueIndexing(pThis);
+
+#ifdef _DEBUG
+      bool busy = false;
+      for (auto* pIndexTask : pThis->pIndexTasks)
+      {
+        busy = busy || pIndexTask;
+      }
+      if (!busy)
+      {
+        mj::StringBuilder sb;
+        sb.Init(pThis->pAllocator);
+        MJ_DEFER(sb.Destroy());
+
+        sb.Append(L"Indexed ").AppendUInt64(pThis->pathIndex.NumNames()).Append(L" names in ");
+        sb.AppendByteSize(pThis->pathIndex.ByteWidth()).Append(L"\r\n");
+        ::OutputDebugStringW(sb.ToStringClosed().ptr);
       }
+#endif
+    }
+
+    /// <summary>
+    /// Number of index hits that are shown.
+    /// </summary>
+    static constexpr const size_t SEARCH_MAX_RESULTS = 1024;
+
+    /// <summary>
+    /// Replaces the listing with the indexed paths that contain the filter text.
+    /// </summary>
+    void SearchAllPaths(mj::DirectoryNavigationPanel* pThis)
+    {
+      ZoneScoped;
+
+      StartIndexing(pThis);
+
+      MJ_UNINITIALIZED mj::StringView query;
+      query.Init(pThis->filterText, pThis->filterLength);
+
+      // The results buffer was meant for Everything results
+      auto* pHits    = static_cast<mj::TrigramHit*>(pThis->resultsBuffer.pAddress);
+      size_t maxHits = mj::min(SEARCH_MAX_RESULTS, pThis->resultsBuffer.numBytes / sizeof(mj::TrigramHit));
+      size_t numHits = pThis->pathIndex.Search(query, pHits, maxHits);
+
+      CancelNavigation(pThis);
       pThis->pListFolderContentsTask = nullptr;
+      pThis->openFolderTime.QuadPart = 0;
+
+      mj::StringBuilder sb;
+      sb.Init(pThis->pAllocator);
+      MJ_DEFER(sb.Destroy());
+      sb.Append(L"Search: ").Append(query);
+      pThis->currentFolderText.Init(sb.ToStringOpen(), pThis->pAllocator);
+      TrySetCurrentFolderText(pThis);
+
+      // Entries are named by their full path
+      auto& result = pThis->listFolderContentsTaskResult;
+      result.folders.Clear();
+      result.files.Clear();
+      result.stringCache.Clear();
+      result.columns.Clear(); // Not known for index hits
+      for (size_t i = 0; i < numHits; i++)
+      {
+        mj::StringView path = pThis->pathTree.GetPath(pThis->pathIndex.GetFolder(pHits[i]),
+                                                      pThis->pathIndex.GetName(pHits[i]), pThis->pathBuffer);
+        if (!result.stringCache.Add(path))
+        {
+          break;
+        }
+
+        auto& list = pThis->pathIndex.IsFolder(pHits[i]) ? result.folders : result.files;
+        if (!list.Add(result.stringCache.Size() - 1))
+        {
+          result.stringCache.Pop();
+          break;
+        }
+      }
+
+      pThis->searchResults = true;
+      pThis->filterLength  = 0;
+      ApplyFilter(pThis);
+      TryCreateFolderContentTextLayouts(pThis, nullptr);
     }
   } // namespace detail
 } // namespace mj
@@ -572,23 +1739,29 @@ void mj::DirectoryNavigationPanel::Init(mj::AllocatorBase* pAllocator)
   MJ_EXIT_NULL(this->searchBuffer.pAddress);
   MJ_EXIT_NULL(this->resultsBuffer.pAddress);
   this->entries.Init(this->pAllocator);
+  this->textLayoutBatches.Init(this->pAllocator);
+  this->visibleEntries.Init(this->pAllocator);
 
   this->listFolderContentsTaskResult.files.Init(this->pAllocator);
   this->listFolderContentsTaskResult.folders.Init(this->pAllocator);
   this->listFolderContentsTaskResult.stringCache.Init(this->pAllocator);
+  this->listFolderContentsTaskResult.columns.Init(this->pAllocator);
+  this->pathIndex.Init(this->pAllocator);
+  this->pendingIndexFolders.Init(this->pAllocator);
 
   // FIXME: When opening a folder, add all parent folders to the breadcrumb
   this->breadcrumb.Init(pAllocator);
-  this->sbOpenFolder.Init(pAllocator);
+  this->pathTree.Init(pAllocator);
+  this->pathBuffer.Init(pAllocator);
 
   // Start tasks
   MJ_UNINITIALIZED mj::StringView str;
   str.Init(L"C:");
-  this->sbOpenFolder.Clear();
-  this->sbOpenFolder.Append(str);
-  this->breadcrumb.Add(str);
-
-  detail::OpenFolder(this);
+  uint32_t root = this->pathTree.Add(PathTree::NO_NODE, str);
+  if (root != PathTree::NO_NODE && this->breadcrumb.Add(root))
+  {
+    detail::OpenFolder(this, root);
+  }
 
 #if 0
   {
@@ -616,14 +1789,27 @@ namespace mj
         pRenderTarget->DrawTextLayout(point, pThis->pCurrentFolderTextLayout, pBrush);
       }
     }
+    void PaintFilter(DirectoryNavigationPanel* pThis, ID2D1RenderTarget* pRenderTarget)
+    {
+      if (pThis->pFilterTextLayout)
+      {
+        // Right half of the breadcrumb bar
+        FLOAT left  = pThis->rect.width * 0.5f;
+        auto pBrush = res::d2d1::Brush();
+        pBrush->SetColor(D2D1::ColorF(0xFFFFFF));
+        pRenderTarget->FillRectangle(D2D1::RectF(left, 0.0f, pThis->rect.width, ENTRY_HEIGHT), pBrush);
+        pBrush->SetColor(D2D1::ColorF(0x000000));
+        pRenderTarget->DrawTextLayout(D2D1::Point2F(left + 4.0f, 0.0f), pThis->pFilterTextLayout, pBrush);
+      }
+    }
+
     void PaintEntryList(DirectoryNavigationPanel* pThis, ID2D1RenderTarget* pRenderTarget)
     {
-      auto point  = D2D1::Point2F(16.5f, static_cast<FLOAT>(pThis->scrollOffset));
       auto pBrush = res::d2d1::Brush();
 
-      if (pThis->pHoveredEntry)
+      MJ_UNINITIALIZED size_t index;
+      if (pThis->hoveredRow.TryGetValue(&index))
       {
-        ptrdiff_t index = pThis->pHoveredEntry - pThis->entries.begin();
         pBrush->SetColor(D2D1::ColorF(0xD3D8DB));
 
         MJ_UNINITIALIZED D2D1_RECT_F highlightRect;
@@ -635,7 +1821,6 @@ namespace mj
         pRenderTarget->FillRectangle(&highlightRect, pBrush);
       }
 
-      MJ_UNINITIALIZED size_t index;
       if (pThis->selectedEntry.TryGetValue(&index))
       {
         pBrush->SetColor(D2D1::ColorF(0xE5F3CC));
@@ -649,8 +1834,16 @@ namespace mj
         pRenderTarget->FillRectangle(&highlightRect, pBrush);
       }
 
-      for (const auto& entry : pThis->entries)
+      // Only draw the rows that intersect the view
+      size_t numRows  = pThis->visibleEntries.Size();
+      size_t firstRow = static_cast<size_t>(-pThis->scrollOffset / ENTRY_HEIGHT);
+      size_t lastRow  = mj::min(numRows, firstRow + pThis->rect.height / ENTRY_HEIGHT + 2);
+      int32_t firstY  = pThis->scrollOffset + static_cast<int32_t>(firstRow) * ENTRY_HEIGHT;
+      auto point      = D2D1::Point2F(16.5f, static_cast<FLOAT>(firstY));
+
+      for (size_t row = firstRow; row < lastRow; row++)
       {
+        const auto& entry = pThis->entries[pThis->visibleEntries[row]];
         if (entry.pTextLayout)
         {
           pBrush->SetColor(D2D1::ColorF(0x000000));
@@ -678,9 +1871,9 @@ namespace mj
 
       // Draw scrollbar
       const float SCROLLBAR_WIDTH = 16.0f;
-      if (pThis->rect.height > 0 && pThis->entries.Size() > 0)
+      if (pThis->rect.height > 0 && numRows > 0)
       {
-        FLOAT pixelHeight = static_cast<FLOAT>(pThis->entries.Size()) * ENTRY_HEIGHT;
+        FLOAT pixelHeight = static_cast<FLOAT>(numRows) * ENTRY_HEIGHT;
         FLOAT viewHeight  = pThis->rect.height;
         if (pixelHeight > viewHeight)
         {
@@ -720,6 +1913,7 @@ void mj::DirectoryNavigationPanel::Paint(ID2D1RenderTarget* pRenderTarget)
     auto childRect = PushRect(pRenderTarget, 0, 0, this->rect.width, ENTRY_HEIGHT);
     MJ_DEFER(childRect.Pop(pRenderTarget));
     detail::PaintBreadcrumb(this, pRenderTarget);
+    detail::PaintFilter(this, pRenderTarget);
   }
   {
     auto childRect = PushRect(pRenderTarget, 0, ENTRY_HEIGHT, this->rect.width, this->rect.height - ENTRY_HEIGHT);
@@ -733,23 +1927,35 @@ void mj::DirectoryNavigationPanel::Destroy()
   ZoneScoped;
 
   this->breadcrumb.Destroy();
-  this->sbOpenFolder.Destroy();
+  this->pathTree.Destroy();
+  this->pathBuffer.Destroy();
 
   this->pAllocator->Free(this->searchBuffer.pAddress);
   this->pAllocator->Free(this->resultsBuffer.pAddress);
 
   detail::ClearEntries(this);
   this->entries.Destroy();
+  this->textLayoutBatches.Destroy();
+  this->visibleEntries.Destroy();
+  MJ_SAFE_RELEASE(this->pFilterTextLayout);
+  this->listingPattern.Destroy(this->pAllocator);
 
   this->listFolderContentsTaskResult.files.Destroy();
   this->listFolderContentsTaskResult.folders.Destroy();
   this->listFolderContentsTaskResult.stringCache.Destroy();
+  this->listFolderContentsTaskResult.columns.Destroy();
+
+  detail::CancelNavigation(this);
+  this->pListFolderContentsTask = nullptr;
 
-  if (this->pListFolderContentsTask)
+  // Running walks stop at their next entry
+  this->indexing.Cancel();
+  for (auto& pTask : this->pIndexTasks)
   {
-    this->pListFolderContentsTask->cancelled = true;
-    this->pListFolderContentsTask            = nullptr;
+    pTask = nullptr;
   }
+  this->pathIndex.Destroy();
+  this->pendingIndexFolders.Destroy();
 
   if (this->pCurrentFolderTextLayout)
   {
@@ -768,17 +1974,18 @@ void mj::DirectoryNavigationPanel::OnMouseMove(MouseMoveEvent* pMouseMoveEvent)
   // Translate to entry list
   int16_t y = pMouseMoveEvent->y - ENTRY_HEIGHT;
 
-  auto pHoveredPrev   = this->pHoveredEntry;
-  this->pHoveredEntry = nullptr;
+  MJ_UNINITIALIZED size_t rowPrev;
+  bool hoveredPrev = this->hoveredRow.TryGetValue(&rowPrev);
+  this->hoveredRow.Reset();
 
-  MJ_UNINITIALIZED RECT rect;
-  mj::Entry* pEntry = detail::TestMouseEntry(this, pMouseMoveEvent->x, y, &rect);
+  MJ_UNINITIALIZED size_t row;
+  mj::Entry* pEntry = detail::TestMouseEntry(this, pMouseMoveEvent->x, y, nullptr, &row);
   if (pEntry)
   {
-    this->pHoveredEntry = pEntry;
+    this->hoveredRow = row;
   }
 
-  if (pHoveredPrev != this->pHoveredEntry)
+  if (hoveredPrev != (pEntry != nullptr) || (pEntry && row != rowPrev))
   {
     mj::InvalidateRect();
   }
@@ -803,15 +2010,19 @@ void mj::DirectoryNavigationPanel::OnDoubleClick(int16_t x, int16_t y, uint16_t
 
 void mj::DirectoryNavigationPanel::OnBackButton()
 {
+  // Leaving search results goes back to the folder they were searched from
+  if (this->searchResults)
+  {
+    detail::ReopenFolder(this);
+    return;
+  }
+
   this->breadcrumb.GoUpByOne();
 
-  mj::StringView* pLast = this->breadcrumb.Last();
+  uint32_t* pLast = this->breadcrumb.Last();
   if (pLast)
   {
-    this->sbOpenFolder.Clear();
-    this->sbOpenFolder.Append(*pLast);
-
-    detail::OpenFolder(this);
+    detail::OpenFolder(this, *pLast);
   }
 }
 
@@ -844,7 +2055,7 @@ void mj::DirectoryNavigationPanel::OnMouseWheel(int16_t x, int16_t y, uint16_t m
   if (diff != 0)
   {
     this->scrollOffset += diff;
-    int32_t pixelHeight = static_cast<int32_t>(this->entries.Size()) * ENTRY_HEIGHT;
+    int32_t pixelHeight = static_cast<int32_t>(this->visibleEntries.Size()) * ENTRY_HEIGHT;
     if (this->scrollOffset > 0 || pixelHeight < this->rect.height)
     {
       this->scrollOffset = 0;
@@ -854,6 +2065,7 @@ void mj::DirectoryNavigationPanel::OnMouseWheel(int16_t x, int16_t y, uint16_t m
       this->scrollOffset = this->rect.height - pixelHeight;
     }
 
+    detail::PrioritizeTextLayouts(this);
     mj::InvalidateRect();
   }
 }
@@ -874,15 +2086,12 @@ void mj::DirectoryNavigationPanel::OnContextMenu(int16_t clientX, int16_t client
       MJ_ERR_HRESULT(::SHGetDesktopFolder(&pDesktop));
       MJ_DEFER(pDesktop->Release());
 
-      StringView* pLast = this->breadcrumb.Last();
+      uint32_t* pLast = this->breadcrumb.Last();
       if (pLast)
       {
-        this->sbOpenFolder.Clear();
-        this->sbOpenFolder.Append(*pLast);
-        this->sbOpenFolder.Append(L"\\");
-        this->sbOpenFolder.Append(*pEntry->pName);
-
-        auto path = this->sbOpenFolder.ToStringClosed();
+        // Search results are named by their full path. Both are null-terminated.
+        StringView path = this->searchResults ? *pEntry->pName
+                                              : this->pathTree.GetPath(*pLast, *pEntry->pName, this->pathBuffer);
         MJ_UNINITIALIZED PIDLIST_RELATIVE pidl;
         MJ_ERR_HRESULT(pDesktop->ParseDisplayName(nullptr,                        //
                                                   nullptr,                        //
@@ -983,7 +2192,7 @@ void mj::DirectoryNavigationPanel::OnIDWriteFactoryAvailable(IDWriteFactory* pFa
 
 void mj::DirectoryNavigationPanel::MoveSelectionUp()
 {
-  size_t numEntries = this->entries.Size();
+  size_t numEntries = this->visibleEntries.Size();
   if (numEntries > 0)
   {
     MJ_UNINITIALIZED size_t val;
@@ -1004,7 +2213,7 @@ void mj::DirectoryNavigationPanel::MoveSelectionUp()
 
 void mj::DirectoryNavigationPanel::MoveSelectionDown()
 {
-  size_t numEntries = this->entries.Size();
+  size_t numEntries = this->visibleEntries.Size();
   if (numEntries > 0)
   {
     MJ_UNINITIALIZED size_t val;
@@ -1022,3 +2231,77 @@ void mj::DirectoryNavigationPanel::MoveSelectionDown()
     mj::InvalidateRect();
   }
 }
+
+void mj::DirectoryNavigationPanel::OnChar(wchar_t c)
+{
+  // Ignore control characters, these are handled as key presses
+  if (c < L' ' || c == 0x7F)
+  {
+    return;
+  }
+
+  if (this->filterLength < MJ_COUNTOF(this->filterText))
+  {
+    this->filterText[this->filterLength++] = c;
+    detail::ApplyFilter(this);
+  }
+}
+
+void mj::DirectoryNavigationPanel::OnBackspace()
+{
+  if (this->filterLength > 0)
+  {
+    this->filterLength--;
+    detail::ApplyFilter(this);
+  }
+  else
+  {
+    this->OnBackButton();
+  }
+}
+
+void mj::DirectoryNavigationPanel::ToggleFilterMode()
+{
+  this->fuzzyFilter = !this->fuzzyFilter;
+  detail::ApplyFilter(this);
+}
+
+void mj::DirectoryNavigationPanel::ClearFilter()
+{
+  if (this->filterLength > 0)
+  {
+    this->filterLength = 0;
+    detail::ApplyFilter(this);
+  }
+  else if (!this->listingPattern.IsEmpty())
+  {
+    this->listingPattern.Destroy(this->pAllocator);
+    detail::ReopenFolder(this);
+  }
+}
+
+void mj::DirectoryNavigationPanel::OnEnter()
+{
+  MJ_UNINITIALIZED StringView text;
+  text.Init(this->filterText, this->filterLength);
+  if (GlobMatcher::IsPattern(text))
+  {
+    this->ApplyListingPattern();
+  }
+  else if (!text.IsEmpty())
+  {
+    detail::SearchAllPaths(this);
+  }
+}
+
+void mj::DirectoryNavigationPanel::ApplyListingPattern()
+{
+  MJ_UNINITIALIZED StringView text;
+  text.Init(this->filterText, this->filterLength);
+  if (GlobMatcher::IsPattern(text))
+  {
+    // Opening the folder clears the filter
+    this->listingPattern.Init(text, this->pAllocator);
+    detail::ReopenFolder(this);
+  }
+}
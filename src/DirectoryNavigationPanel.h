@@ -6,6 +6,12 @@
 #include "Threadpool.h"
 #include "ResourcesD2D1.h"
 #include "mj_optional.h"
+#include "mj_filter.h"
+#include "mj_fuzzy.h"
+#include "mj_glob.h"
+#include "mj_trigram.h"
+#include "mj_pathtree.h"
+#include "mj_directory.h"
 
 namespace mj
 {
@@ -49,19 +55,24 @@ namespace mj
   namespace detail
   {
     struct ListFolderContentsTask;
-    struct CreateTextLayoutTask;
+    struct CreateTextLayoutsBatch;
     struct LoadFolderIconTask;
     struct LoadFileIconTask;
     struct EverythingQueryTask;
+    struct FilterSource;
+    struct IndexFolderTask;
   } // namespace detail
 
   struct DirectoryNavigationPanel : public svc::IDWriteFactoryObserver, //
                                     public res::d2d1::BitmapObserver
   {
+    /// <summary>
+    /// Folders that were navigated into, as PathTree nodes.
+    /// </summary>
     class Breadcrumb
     {
     private:
-      StringCache breadcrumb;
+      ArrayList<uint32_t> breadcrumb;
 
     public:
       /// <summary>
@@ -75,13 +86,11 @@ namespace mj
       /// </summary>
       void Destroy();
 
-      bool Add(const wchar_t* pStringLiteral);
-
-      bool Add(const StringView& string);
+      bool Add(uint32_t node);
 
       void GoUpByOne();
 
-      StringView* Last();
+      uint32_t* Last();
     };
 
     /// <summary>
@@ -93,14 +102,20 @@ namespace mj
     /// </summary>
     IDWriteTextLayout* pCurrentFolderTextLayout = nullptr;
     mj::StringAlloc currentFolderText           = {};
-    const Entry* pHoveredEntry                  = nullptr;
+    mj::optional<size_t> hoveredRow;
     Breadcrumb breadcrumb;
 
-    // Open folder
-    StringBuilder sbOpenFolder;
+    /// <summary>
+    /// Every folder the panel knows about, shared by the breadcrumb and the path index.
+    /// </summary>
+    PathTree pathTree;
+    ArrayList<wchar_t> pathBuffer; // Reused to materialize paths from pathTree
 
     AllocatorBase* pAllocator = nullptr;
     ArrayList<Entry> entries;
+    // Per page of entries, until its layouts are set or the navigation is cancelled
+    ArrayList<detail::CreateTextLayoutsBatch*> textLayoutBatches;
+    size_t textLayoutPageSize     = 0;
     int32_t numEntriesDoneLoading = 0;
     Allocation searchBuffer;
     Allocation resultsBuffer;
@@ -115,11 +130,44 @@ namespace mj
       mj::ArrayList<size_t> folders;
       mj::ArrayList<size_t> files;
       mj::StringCache stringCache;
+      mj::DirectoryColumns columns; // Row per name in stringCache, empty for search results
     } listFolderContentsTaskResult;
     detail::ListFolderContentsTask* pListFolderContentsTask = nullptr;
+    CancellationSource navigation; // Cancels the tasks started for the previous folder
+    LARGE_INTEGER openFolderTime                            = {}; // Until the first row has a text layout
 
     MJ_UNINITIALIZED Rect rect;
 
+    /// <summary>
+    /// Indices into entries of the rows that pass the filter, in display order.
+    /// Rows (hovered, selected) index into this list.
+    /// </summary>
+    ArrayList<uint32_t> visibleEntries;
+
+    // Filter
+    MJ_UNINITIALIZED wchar_t filterText[FilterQuery::MAX_LENGTH];
+    size_t filterLength                  = 0;
+    IDWriteTextLayout* pFilterTextLayout = nullptr;
+    FilterQuery appliedFilter            = {}; // The query visibleEntries was computed with
+    detail::FilterSource* pFilterSource  = nullptr;
+    uint32_t filterGeneration            = 0;
+    bool fuzzyFilter                     = false; // Rank entries by fuzzy match instead of substring filtering
+    bool fuzzyResults                    = false; // visibleEntries holds ranked fuzzy matches
+
+    /// <summary>
+    /// Wildcard patterns (GlobMatcher syntax) applied while listing folders. Empty to list everything.
+    /// </summary>
+    mj::StringAlloc listingPattern = {};
+
+    // Whole-drive search
+    static constexpr const size_t MAX_INDEX_TASKS = 4;
+    TrigramIndex pathIndex;
+    ArrayList<uint32_t> pendingIndexFolders; // pathTree nodes that have not been walked yet
+    detail::IndexFolderTask* pIndexTasks[MAX_INDEX_TASKS] = {};
+    CancellationSource indexing;                                   // Cancels the walks when the panel is destroyed
+    bool indexStarted                                     = false; // The walk starts on the first search
+    bool searchResults                                    = false; // entries are pathIndex hits, named by full path
+
     mj::optional<size_t> selectedEntry;
 
     void Init(AllocatorBase* pAllocator);
@@ -140,6 +188,36 @@ namespace mj
     void MoveSelectionUp();
     void MoveSelectionDown();
 
+    /// <summary>
+    /// Appends a character to the filter.
+    /// </summary>
+    void OnChar(wchar_t c);
+
+    /// <summary>
+    /// Removes the last character of the filter, or goes up one folder if the filter is empty.
+    /// </summary>
+    void OnBackspace();
+
+    /// <summary>
+    /// Clears the filter, or the listing pattern if the filter is empty.
+    /// </summary>
+    void ClearFilter();
+
+    /// <summary>
+    /// Lists the current folder again with the filter text as listing pattern, if it contains wildcards.
+    /// </summary>
+    void ApplyListingPattern();
+
+    /// <summary>
+    /// Applies wildcard filter text as listing pattern, otherwise searches all indexed paths for the filter text.
+    /// </summary>
+    void OnEnter();
+
+    /// <summary>
+    /// Switches between substring filtering and fuzzy matching.
+    /// </summary>
+    void ToggleFilterMode();
+
     virtual void OnIDWriteFactoryAvailable(IDWriteFactory* pFactory) override;
     virtual void OnIconBitmapAvailable(ID2D1Bitmap* pIconBitmap, WORD resource) override;
   };
@@ -15,6 +15,12 @@
 
 #define WM_MJTASKFINISH (WM_USER + 1)
 
+/// <summary>
+/// Main thread time per round of the message loop for ending finished tasks, so that thousands of tasks finishing
+/// at once, e.g. when a large folder opens, do not hold up input and paint.
+/// </summary>
+static constexpr uint32_t END_TASKS_BUDGET_US = 4000;
+
 static D2D1NullRenderTarget s_D2D1NullRenderTarget;
 
 struct EInvalidateRectThreadEvent
@@ -604,12 +610,24 @@ LRESULT CALLBACK mj::MainWindow::WindowProc(HWND hWnd, UINT message, WPARAM wPar
       pMainWindow->panel.MoveSelectionDown();
       break;
     case VK_BACK: // Backspace
-      pMainWindow->panel.OnBackButton();
+      pMainWindow->panel.OnBackspace();
+      break;
+    case VK_ESCAPE:
+      pMainWindow->panel.ClearFilter();
+      break;
+    case VK_TAB:
+      pMainWindow->panel.ToggleFilterMode();
+      break;
+    case VK_RETURN:
+      pMainWindow->panel.OnEnter();
       break;
     default:
       break;
     }
     break;
+  case WM_CHAR:
+    pMainWindow->panel.OnChar(static_cast<wchar_t>(wParam));
+    break;
   default:
     break;
   }
@@ -653,6 +671,48 @@ void mj::InvalidateRect()
   ::SetEvent(s_InvalidateRectThreadEvents[EInvalidateRectThreadEvent::InvalidateRect]);
 }
 
+/// <summary>
+/// Setting MJ_THREADPOOL_SEED to a number runs the threadpool in deterministic mode, for reproducible benchmarks.
+/// </summary>
+static mj::ThreadpoolConfig GetThreadpoolConfig()
+{
+  mj::ThreadpoolConfig config;
+
+  MJ_UNINITIALIZED wchar_t buffer[16];
+  DWORD length = ::GetEnvironmentVariableW(L"MJ_THREADPOOL_SEED", buffer, MJ_COUNTOF(buffer));
+  if (length > 0 && length < MJ_COUNTOF(buffer))
+  {
+    MJ_UNINITIALIZED mj::StringView seed;
+    seed.Init(buffer, length);
+    config.deterministic = seed.ParseNumber(&config.seed);
+  }
+
+  return config;
+}
+
+/// <summary>
+/// GetMessageW, but finished tasks that did not fit the last budget are ended here while there are no messages,
+/// and a deterministic threadpool runs its tasks here while there are no messages.
+/// </summary>
+/// <param name="pEndTasks">Set if finished tasks are left, see ThreadpoolEndTasks</param>
+static BOOL GetNextMessage(MSG* pMsg, bool* pEndTasks)
+{
+  // Messages that came in meanwhile go first, e.g. input and paint
+  while (*pEndTasks && !::PeekMessageW(pMsg, nullptr, 0, 0, PM_NOREMOVE))
+  {
+    *pEndTasks = mj::ThreadpoolEndTasks(END_TASKS_BUDGET_US);
+  }
+
+  if (mj::ThreadpoolIsDeterministic())
+  {
+    while (!::PeekMessageW(pMsg, nullptr, 0, 0, PM_NOREMOVE) && mj::ThreadpoolStep())
+    {
+    }
+  }
+
+  return ::GetMessageW(pMsg, nullptr, 0, 0);
+}
+
 void mj::MainWindow::Run()
 {
   MJ_DEFER(this->Destroy());
@@ -669,7 +729,7 @@ void mj::MainWindow::Run()
   mj::AllocatorBase* pAllocator = svc::GeneralPurposeAllocator();
 
   // Initialize thread pool
-  mj::ThreadpoolInit(::GetCurrentThreadId(), WM_MJTASKFINISH);
+  mj::ThreadpoolInit(::GetCurrentThreadId(), WM_MJTASKFINISH, GetThreadpoolConfig());
   MJ_DEFER(mj::ThreadpoolDestroy());
   HANDLE pInvalidateRectThread = ::CreateThread(nullptr, 0, InvalidateRectMain, nullptr, 0, nullptr);
 
@@ -729,7 +789,8 @@ void mj::MainWindow::Run()
 
   // Run the message loop.
   MJ_UNINITIALIZED MSG msg;
-  while (::GetMessageW(&msg, nullptr, 0, 0))
+  bool endTasks = false;
+  while (GetNextMessage(&msg, &endTasks))
   {
     // If the message is translated, the return value is nonzero.
     // If the message is not translated, the return value is zero.
@@ -745,7 +806,7 @@ void mj::MainWindow::Run()
       // Threadpool notifies the main thread using PostThreadMessage.
       // These messages are not associated with a window, so they must be
       // handled here, instead of in the WindowProc.
-      mj::ThreadpoolTaskEnd(reinterpret_cast<mj::Task*>(msg.wParam));
+      endTasks = mj::ThreadpoolEndTasks(END_TASKS_BUDGET_US);
     }
   }
 
@@ -2,7 +2,7 @@
 #include "ResourcesD2D1.h"
 #include "ErrorExit.h"
 #include "../vs/ManyFiles/resource.h"
-#include "Threadpool.h"
+#include "ThreadpoolCoroutine.h"
 #include "ServiceLocator.h"
 #include "stb_image.h"
 
@@ -117,41 +117,22 @@ void LoadThemeBitmap()
 #endif
 
 // Requires: D2D1RenderTarget
-struct LoadIconBitmapTask : public mj::Task
+static mj::Async LoadIconBitmap(WORD resource)
 {
-  // In
-  WORD resource = 0;
-
-  // Out
   ID2D1Bitmap* pBitmap = nullptr;
+  MJ_DEFER(MJ_SAFE_RELEASE(pBitmap));
 
-  virtual void Execute() override
-  {
-    ZoneScoped;
-    LoadBitmapFromResource(this->resource, &this->pBitmap);
-  }
-
-  virtual void OnDone() override
+  co_await mj::ToPool();
   {
-    ZoneScoped;
-    for (auto pObserver : s_BitmapObservers)
-    {
-      pObserver->OnIconBitmapAvailable(pBitmap, resource);
-    }
+    ZoneScopedN("LoadBitmapFromResource");
+    LoadBitmapFromResource(resource, &pBitmap);
   }
 
-  virtual void Destroy() override
+  co_await mj::ToMainThread();
+  for (auto pObserver : s_BitmapObservers)
   {
-    ZoneScoped;
-    MJ_SAFE_RELEASE(this->pBitmap);
+    pObserver->OnIconBitmapAvailable(pBitmap, resource);
   }
-};
-
-static void LoadIconBitmap(WORD resource)
-{
-  auto* pTask     = mj::ThreadpoolCreateTask<LoadIconBitmapTask>();
-  pTask->resource = resource;
-  mj::ThreadpoolSubmitTask(pTask);
 }
 
 void res::d2d1::Load(ID2D1RenderTarget* pRenderTarget)
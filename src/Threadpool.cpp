@@ -2,128 +2,2338 @@
 #include "Threadpool.h"
 #include "mj_win32.h"
 #include "mj_common.h"
+#include "mj_histogram.h"
+#include "mj_random.h"
+#include "mj_string.h"
 #include "ErrorExit.h"
 
-static constexpr auto MAX_TASKS   = 1024;
-static constexpr auto NUM_THREADS = 8;
-static mj::TaskContext s_TaskContextArray[MAX_TASKS];
-static mj::TaskContext* s_pTaskHead;
-static DWORD s_MainThreadId;
-static UINT s_Msg;
-static HANDLE s_Threads[NUM_THREADS];
-static HANDLE s_Iocp;
+static constexpr auto DEQUE_SIZE     = 1024; // Tasks, per worker and priority
+static constexpr auto MAX_THREADS    = 64;
+static constexpr auto MAX_IO_THREADS = 32;
+static constexpr auto MAX_CORES      = 256; // Cores beyond this are not used for placement
+static constexpr auto MAX_NODES      = 64;
 
 /// <summary>
-/// The return value of this function can be cast to anything you want
-/// (as long as its size is less or equal)
+/// Maximum number of tasks a worker takes from the injection queue at once.
+/// The first one is executed, the rest go to its deque where other workers can steal them.
 /// </summary>
-mj::TaskContext* mj::detail::ThreadpoolAllocTaskContext()
-{
-  MJ_EXIT_NULL(s_pTaskHead);
+static constexpr auto INJECT_BATCH_SIZE = 32;
 
-  mj::TaskContext* pTaskContext = s_pTaskHead;
+/// <summary>
+/// Every this many searches, a worker checks the background lane first, so it is never starved.
+/// </summary>
+static constexpr auto BACKGROUND_INTERVAL = 8;
 
-  s_pTaskHead = s_pTaskHead->pNextFreeNode;
+static constexpr uint32_t NUM_PRIORITIES = mj::ETaskPriority::Count;
 
-  return pTaskContext;
-}
+/// <summary>
+/// Larger batches get larger chunks, so a batch never takes more than this many task contexts.
+/// </summary>
+static constexpr auto MAX_BATCH_CHUNKS = 64;
+
+/// <summary>
+/// Task contexts are committed a slab at a time, in regions of address space that are reserved as needed.
+/// A context is identified by its index: region * REGION_SIZE + offset in the region.
+/// </summary>
+static constexpr uint32_t SLAB_SIZE   = 256;             // Contexts, 64 KiB
+static constexpr uint32_t REGION_SIZE = 256 * SLAB_SIZE; // Contexts, 16 MiB of address space
+static constexpr uint32_t MAX_REGIONS = 64;
+static constexpr uint32_t NO_CONTEXT  = 0xFFFFFFFFu;
+
+/// <summary>
+/// Free contexts kept by each thread, so most allocations do not touch the shared free list.
+/// </summary>
+static constexpr uint32_t CONTEXT_CACHE_SIZE = 64;
+
+/// <summary>
+/// Tasks larger than a TaskContext are carved from chunks of this size, one size class per chunk.
+/// </summary>
+static constexpr size_t LARGE_TASK_CHUNK_SIZE = 64 * 1024;
+
+/// <summary>
+/// Back-pressure: past this many live task contexts, compute tasks submitted by a task run on the submitting worker
+/// instead of being queued. The main thread is never throttled, because it ends the tasks that free contexts.
+/// </summary>
+static constexpr LONG THROTTLE_CONTEXTS = 16384;
+
+/// <summary>
+/// Task types with metrics of their own, see ThreadpoolReportMetrics.
+/// </summary>
+static constexpr uint32_t MAX_TASK_TYPES = 64;
+
+/// <summary>
+/// The busy ratio of the workers is plotted at most this often, so a plot point covers many tasks.
+/// </summary>
+static constexpr LONG64 PLOT_INTERVALS_PER_SECOND = 10;
+
+/// <summary>
+/// Delayed tasks wait in a hashed timer wheel with a slot per millisecond. A task that is due more than a round
+/// ahead stays in its slot for the rounds in between.
+/// </summary>
+static constexpr uint32_t TIMER_WHEEL_SIZE = 1024; // Slots, a round is about a second
+
+/// <summary>
+/// File transfers the completion thread dequeues at once, and that ThreadpoolSubmitFileIo queues at once.
+/// </summary>
+static constexpr auto FILE_IO_BATCH_SIZE = 64;
 
 namespace mj
 {
-  static void ThreadpoolFreeContext(TaskContext* pContext)
+  namespace detail
   {
-    // Write a new TaskContext over this piece of memory
-    TaskContext* pNode   = new (pContext) TaskContext;
-    pNode->pNextFreeNode = s_pTaskHead;
-    s_pTaskHead          = pNode;
-  }
+    /// <summary>
+    /// Chase-Lev work-stealing deque. The owning worker pushes and pops at the bottom (LIFO),
+    /// other workers steal from the top (FIFO). The buffer has a fixed size and never grows:
+    /// tasks that do not fit go to the injection queue of their priority instead.
+    /// </summary>
+    struct WorkerDeque
+    {
+      alignas(64) volatile LONG64 top;
+      alignas(64) volatile LONG64 bottom;
+      alignas(64) mj::Task* volatile tasks[DEQUE_SIZE];
+
+      /// <summary>
+      /// Owner only. Returns false if the deque is full.
+      /// </summary>
+      bool Push(mj::Task* pTask)
+      {
+        LONG64 b = this->bottom;
+        if (b - ::ReadAcquire64(&this->top) >= DEQUE_SIZE)
+        {
+          return false;
+        }
+
+        this->tasks[b % DEQUE_SIZE] = pTask;
+        ::WriteRelease64(&this->bottom, b + 1);
+        return true;
+      }
+
+      /// <summary>
+      /// Owner only.
+      /// </summary>
+      mj::Task* Pop()
+      {
+        LONG64 b = this->bottom - 1;
+        static_cast<void>(::InterlockedExchange64(&this->bottom, b)); // Full barrier before reading top
+        LONG64 t = ::ReadAcquire64(&this->top);
+
+        if (t > b)
+        {
+          // Empty
+          ::WriteRelease64(&this->bottom, t);
+          return nullptr;
+        }
+
+        mj::Task* pTask = this->tasks[b % DEQUE_SIZE];
+        if (t == b)
+        {
+          // Last task, race against thieves
+          if (::InterlockedCompareExchange64(&this->top, t + 1, t) != t)
+          {
+            pTask = nullptr;
+          }
+          ::WriteRelease64(&this->bottom, t + 1);
+        }
+
+        return pTask;
+      }
+
+      /// <summary>
+      /// Any thread. Returns nullptr if the deque is empty, or if another thread took the task first.
+      /// </summary>
+      mj::Task* Steal()
+      {
+        LONG64 t = ::ReadAcquire64(&this->top);
+        LONG64 b = ::ReadAcquire64(&this->bottom);
+        if (t >= b)
+        {
+          return nullptr;
+        }
+
+        mj::Task* pTask = this->tasks[t % DEQUE_SIZE];
+        if (::InterlockedCompareExchange64(&this->top, t + 1, t) != t)
+        {
+          return nullptr;
+        }
+
+        return pTask;
+      }
+    };
+
+    /// <summary>
+    /// Tasks that do not start on a worker deque: submitted from outside the compute workers, or IO tasks.
+    /// </summary>
+    struct TaskQueue
+    {
+      SRWLOCK lock      = SRWLOCK_INIT;
+      mj::Task** pTasks = nullptr; // Ring buffer, grows when full
+      size_t capacity   = 0;
+      size_t head       = 0;
+      size_t count      = 0;
+
+      void Push(mj::Task** ppTasks, size_t numTasks)
+      {
+        ::AcquireSRWLockExclusive(&this->lock);
+        MJ_DEFER(::ReleaseSRWLockExclusive(&this->lock));
+
+        while (this->count + numTasks > this->capacity)
+        {
+          this->Grow();
+        }
+
+        for (size_t i = 0; i < numTasks; i++)
+        {
+          this->pTasks[(this->head + this->count) % this->capacity] = ppTasks[i];
+          this->count++;
+        }
+      }
+
+      /// <summary>
+      /// Doubles the capacity, and moves the tasks to the start. Called with the lock held.
+      /// </summary>
+      void Grow()
+      {
+        mj::HeapAllocator alloc;
+        size_t capacity       = mj::max<size_t>(2 * this->capacity, DEQUE_SIZE);
+        Allocation allocation = alloc.Allocation(capacity * sizeof(mj::Task*));
+        MJ_EXIT_NULL(allocation.pAddress);
+
+        auto** ppTasks = static_cast<mj::Task**>(allocation.pAddress);
+        for (size_t i = 0; i < this->count; i++)
+        {
+          ppTasks[i] = this->pTasks[(this->head + i) % this->capacity];
+        }
+        if (this->pTasks)
+        {
+          alloc.Free(this->pTasks);
+        }
+
+        this->pTasks   = ppTasks;
+        this->capacity = capacity;
+        this->head     = 0;
+      }
+
+      /// <summary>
+      /// Takes up to maxTasks tasks in submission order, but leaves some for the other workers.
+      /// </summary>
+      size_t Pop(mj::Task** ppTasks, size_t maxTasks, size_t numWorkers)
+      {
+        ::AcquireSRWLockExclusive(&this->lock);
+        MJ_DEFER(::ReleaseSRWLockExclusive(&this->lock));
+
+        size_t numTasks = mj::min(this->count, mj::min(maxTasks, 1 + this->count / numWorkers));
+        for (size_t i = 0; i < numTasks; i++)
+        {
+          ppTasks[i] = this->pTasks[this->head];
+          this->head = (this->head + 1) % this->capacity;
+        }
+        this->count -= numTasks;
+
+        return numTasks;
+      }
+
+      /// <summary>
+      /// Removes a task that has not been taken yet. Linear, but only called when the user scrolls.
+      /// </summary>
+      bool Remove(mj::Task* pTask)
+      {
+        ::AcquireSRWLockExclusive(&this->lock);
+        MJ_DEFER(::ReleaseSRWLockExclusive(&this->lock));
+
+        for (size_t i = 0; i < this->count; i++)
+        {
+          if (this->pTasks[(this->head + i) % this->capacity] == pTask)
+          {
+            // Close the gap, keeping the order of the other tasks
+            for (size_t j = i + 1; j < this->count; j++)
+            {
+              this->pTasks[(this->head + j - 1) % this->capacity] = this->pTasks[(this->head + j) % this->capacity];
+            }
+            this->count--;
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      /// <summary>
+      /// Takes a task picked with the generator, for the deterministic mode. Returns nullptr if the queue is empty.
+      /// </summary>
+      mj::Task* PopRandom(mj::rng::xoshiro128plusplus& rng)
+      {
+        ::AcquireSRWLockExclusive(&this->lock);
+        MJ_DEFER(::ReleaseSRWLockExclusive(&this->lock));
+
+        if (this->count == 0)
+        {
+          return nullptr;
+        }
+
+        // Swapped with the head, so the rest of the queue does not move
+        size_t index        = (this->head + rng.next() % this->count) % this->capacity;
+        mj::Task* pTask     = this->pTasks[index];
+        this->pTasks[index] = this->pTasks[this->head];
+        this->head          = (this->head + 1) % this->capacity;
+        this->count--;
+
+        return pTask;
+      }
+    };
+
+    /// <summary>
+    /// Free blocks of one size class of large tasks. Large tasks are rare, so a lock is good enough.
+    /// </summary>
+    struct LargeTaskPool
+    {
+      struct Block
+      {
+        Block* pNext;
+      };
+
+      SRWLOCK lock = SRWLOCK_INIT;
+      Block* pFree = nullptr;
+    };
+
+    struct ContextCache
+    {
+      uint32_t contexts[CONTEXT_CACHE_SIZE]; // Indices of free task contexts
+      uint32_t count;
+    };
+
+    struct Worker
+    {
+      WorkerDeque deques[NUM_PRIORITIES];
+      ContextCache contexts;
+      mj::rng::xoshiro128plusplus rng; // Picks steal victims
+      uint32_t index;
+      uint32_t node;             // Index into s_Nodes
+      uint32_t numSearches;      // For BACKGROUND_INTERVAL
+      volatile LONG64 busyTicks; // Spent executing tasks. Written by the worker only.
+      bool io;                   // Takes IO tasks only, and leaves its deques empty
+    };
+
+    /// <summary>
+    /// Latencies in microseconds, see ThreadpoolReportMetrics.
+    /// </summary>
+    struct TaskTypeMetrics
+    {
+      const char* pName; // Signature of TaskType<T>::GetName, nullptr for the slot shared by the overflow
+      mj::Histogram wait;
+      mj::Histogram execute;
+      mj::Histogram done;
+    };
+
+    struct Core
+    {
+      GROUP_AFFINITY affinity; // All logical processors of the core
+      uint32_t node;           // Index into s_Nodes
+    };
+
+    /// <summary>
+    /// A range of the items of a batch. Chunks are the predecessors of their batch.
+    /// </summary>
+    struct BatchChunkTask : public mj::Task
+    {
+      MJ_UNINITIALIZED mj::BatchTask* pBatch;
+      MJ_UNINITIALIZED size_t begin;
+      MJ_UNINITIALIZED size_t end;
+      MJ_UNINITIALIZED BatchChunkTask* pNextChunk;
+
+      virtual void Execute() override
+      {
+        ZoneScoped;
+        this->pBatch->ExecuteRange(this->begin, this->end);
+      }
+    };
+
+    /// <summary>
+    /// Shared state of a parallel loop, and the continuation of all of its ranges.
+    /// Outlives every range, so a range never touches freed memory.
+    /// </summary>
+    struct ParallelForJoin : public mj::Task
+    {
+      MJ_UNINITIALIZED ParallelForRange pRange;
+      MJ_UNINITIALIZED const void* pFn;
+      MJ_UNINITIALIZED size_t grainSize;
+      MJ_UNINITIALIZED size_t numItems;
+      volatile LONG64 numDone = 0; // Indices whose calls have returned
+      volatile LONG finished  = 0; // Set when numDone reaches numItems, blocking loops wait for it
+
+      // Copy of the function of an asynchronous loop
+      alignas(16) MJ_UNINITIALIZED char fn[PARALLEL_FOR_MAX_FN_SIZE];
+
+      virtual void Execute() override
+      {
+        // Only joins, see ThreadpoolThen
+      }
+    };
+
+    struct ParallelForTask : public mj::Task
+    {
+      MJ_UNINITIALIZED ParallelForJoin* pJoin;
+      MJ_UNINITIALIZED size_t begin;
+      MJ_UNINITIALIZED size_t end;
+
+      virtual void Execute() override;
+    };
+  } // namespace detail
 } // namespace mj
 
-static DWORD WINAPI ThreadMain(LPVOID lpThreadParameter)
+// Task contexts. Tasks can be created and ended on any thread.
+static mj::TaskContext* s_ContextRegions[MAX_REGIONS]; // Reserved with VirtualAlloc, committed a slab at a time
+static uint32_t s_NumContextSlabs;                     // Committed, guarded by s_ContextGrowLock
+static SRWLOCK s_ContextGrowLock      = SRWLOCK_INIT;
+static volatile LONG64 s_FreeContexts = NO_CONTEXT; // Index of the first free context in the low half, ABA tag above
+static volatile LONG s_NumLiveContexts;             // Allocated and not freed yet, including large tasks
+static mj::detail::ContextCache s_MainContexts;     // Workers have their own
+
+// Tasks larger than a TaskContext, one pool per size class. The first is not used.
+static mj::detail::LargeTaskPool s_LargeTaskPools[mj::detail::NUM_TASK_SIZE_CLASSES];
+static DWORD s_MainThreadId;
+static UINT s_Msg;
+static mj::ThreadpoolConfig s_Config; // With defaults filled in
+static HANDLE s_Threads[MAX_THREADS + MAX_IO_THREADS];
+static mj::detail::Worker s_Workers[MAX_THREADS + MAX_IO_THREADS]; // Compute workers, then IO workers
+static DWORD s_WorkerTlsIndex = TLS_OUT_OF_INDEXES; // Points to the Worker of the calling thread
+
+// Topology
+static mj::ThreadpoolTopology s_Topology;
+static mj::detail::Core s_Cores[MAX_CORES];
+static uint32_t s_CoreOrder[MAX_CORES]; // Indices into s_Cores, in the order workers are placed
+static uint32_t s_NumCores;             // At most MAX_CORES
+static GROUP_AFFINITY s_Nodes[MAX_NODES];
+static uint32_t s_NumNodes; // At most MAX_NODES
+
+static mj::detail::TaskQueue s_InjectQueues[NUM_PRIORITIES]; // Compute tasks submitted from outside compute workers
+static mj::detail::TaskQueue s_IoQueues[NUM_PRIORITIES];     // All IO tasks, the only queues of the IO workers
+
+// Tasks for the main thread to end, see ThreadpoolEndTasks
+static mj::Task* volatile s_FinishedTasks; // Newest first, linked by pNextPredecessor
+static mj::Task* s_EndQueue;               // Oldest first, taken from s_FinishedTasks by the main thread
+static mj::Task** s_ppEndQueueTail = &s_EndQueue;
+
+// Metrics
+static mj::detail::TaskTypeMetrics s_TaskTypes[MAX_TASK_TYPES];
+static uint32_t s_NumTaskTypes; // Guarded by s_TaskTypeLock
+static SRWLOCK s_TaskTypeLock = SRWLOCK_INIT;
+static volatile LONG s_NumQueuedTasks; // Submitted and not started yet
+static volatile LONG s_MaxQueuedTasks;
+static volatile LONG s_NumFinishedTasks; // Waiting for the main thread to end them
+static volatile LONG s_MaxFinishedTasks;
+static LONG64 s_TicksPerSecond;    // Of QueryPerformanceCounter
+static LONG64 s_StartTicks;        // ThreadpoolInit
+static LONG64 s_LastPlotTicks;     // Main thread only
+static LONG64 s_LastPlotBusyTicks; // Main thread only
+
+// Parking. Idle workers wait for the epoch of their pool to change.
+static volatile LONG s_WakeEpoch;
+static volatile LONG s_NumSleeping;
+static volatile LONG s_IoWakeEpoch;
+static volatile LONG s_NumIoSleeping;
+static volatile LONG s_Running;
+
+// Timer wheel. Waiting tasks are linked through pNextPredecessor, and keep their due time in timestamp.
+static mj::Task* s_TimerSlots[TIMER_WHEEL_SIZE];
+static SRWLOCK s_TimerLock = SRWLOCK_INIT;
+static uint64_t s_TimerTime;       // Timer time the wheel was last advanced to, guarded by s_TimerLock
+static uint64_t s_TimerWakeTime;   // Of the first slot with tasks, guarded by s_TimerLock
+static volatile LONG s_TimerEpoch; // Changed to wake the timer thread early
+static HANDLE s_TimerThread;
+
+// File IO
+static HANDLE s_IoPort; // Not in deterministic mode
+static HANDLE s_IoThread;
+
+// Deterministic mode, main thread only
+static mj::rng::xoshiro128plusplus s_StepRng; // Picks the task of every step
+static uint32_t s_NumSteps;                   // Tasks executed so far, for BACKGROUND_INTERVAL
+static LONG64 s_VirtualTicks;                 // Microseconds
+
+namespace mj
 {
-#ifdef TRACY_ENABLE
-  tracy::SetThreadName("Threadpool thread");
-#endif
-  static_cast<void>(lpThreadParameter);
+  static TaskContext* ThreadpoolGetContext(uint32_t index)
+  {
+    return s_ContextRegions[index / REGION_SIZE] + index % REGION_SIZE;
+  }
+
+  static uint32_t ThreadpoolGetContextIndex(const TaskContext* pContext)
+  {
+    for (uint32_t region = 0; region < MAX_REGIONS; region++)
+    {
+      const TaskContext* pRegion = s_ContextRegions[region];
+      if (pContext >= pRegion && pContext < pRegion + REGION_SIZE)
+      {
+        return region * REGION_SIZE + static_cast<uint32_t>(pContext - pRegion);
+      }
+    }
 
-  while (true)
+    MJ_EXIT_NULL(0);
+    return NO_CONTEXT;
+  }
+
+  /// <summary>
+  /// The tag in the high half changes on every update, so a compare-exchange fails if the list changed in between,
+  /// even if the same context is at the head again (ABA).
+  /// </summary>
+  static LONG64 ThreadpoolMakeFreeHead(LONG64 previous, uint32_t first)
   {
-    MJ_UNINITIALIZED DWORD numBytes;
-    MJ_UNINITIALIZED mj::Task* pTask;
-    MJ_UNINITIALIZED LPOVERLAPPED pOverlapped;
+    uint64_t tag = (static_cast<uint64_t>(previous) >> 32) + 1;
+    return static_cast<LONG64>(tag << 32 | first);
+  }
 
+  /// <summary>
+  /// Pushes contexts linked by nextFree onto the shared free list, with one exchange.
+  /// </summary>
+  static void ThreadpoolPushFreeContexts(uint32_t first, uint32_t last)
+  {
+    TaskContext* pLast = ThreadpoolGetContext(last);
+    LONG64 head        = ::ReadAcquire64(&s_FreeContexts);
+    for (;;)
     {
-      ZoneScopedNC("Sleeping", 0x21231C);
-      BOOL ret =
-          ::GetQueuedCompletionStatus(s_Iocp, &numBytes, reinterpret_cast<PULONG_PTR>(&pTask), &pOverlapped, INFINITE);
-      if (ret == FALSE && ::GetLastError() == ERROR_ABANDONED_WAIT_0)
+      pLast->nextFree = static_cast<uint32_t>(head);
+      LONG64 previous = ::InterlockedCompareExchange64(&s_FreeContexts, ThreadpoolMakeFreeHead(head, first), head);
+      if (previous == head)
       {
-        break;
+        return;
       }
+      head = previous;
     }
+  }
 
-    if (pTask)
+  static uint32_t ThreadpoolPopFreeContext()
+  {
+    LONG64 head = ::ReadAcquire64(&s_FreeContexts);
+    for (;;)
     {
-      pTask->Execute();
+      uint32_t index = static_cast<uint32_t>(head);
+      if (index == NO_CONTEXT)
+      {
+        return NO_CONTEXT;
+      }
 
+      // Stale if another thread took the context first, but then the exchange fails.
+      // Contexts are never decommitted, so it is always safe to read.
+      uint32_t next   = ThreadpoolGetContext(index)->nextFree;
+      LONG64 previous = ::InterlockedCompareExchange64(&s_FreeContexts, ThreadpoolMakeFreeHead(head, next), head);
+      if (previous == head)
       {
-        ZoneScopedNC("PostMessageW", 0x31332C);
-        MJ_ERR_ZERO(::PostThreadMessageW(s_MainThreadId, s_Msg, reinterpret_cast<WPARAM>(pTask), 0));
+        return index;
       }
+      head = previous;
     }
   }
 
-  return 0;
+  /// <summary>
+  /// Commits another slab of contexts, and reserves a region of address space for it first if needed.
+  /// </summary>
+  /// <returns>False if out of memory</returns>
+  static bool ThreadpoolGrowContexts()
+  {
+    ZoneScoped;
+
+    ::AcquireSRWLockExclusive(&s_ContextGrowLock);
+    MJ_DEFER(::ReleaseSRWLockExclusive(&s_ContextGrowLock));
+
+    // Another thread may have grown the list while this one was waiting
+    if (static_cast<uint32_t>(::ReadAcquire64(&s_FreeContexts)) != NO_CONTEXT)
+    {
+      return true;
+    }
+
+    uint32_t first  = s_NumContextSlabs * SLAB_SIZE;
+    uint32_t region = first / REGION_SIZE;
+    if (region == MAX_REGIONS)
+    {
+      return false;
+    }
+
+    if (!s_ContextRegions[region])
+    {
+      s_ContextRegions[region] = static_cast<TaskContext*>(
+          ::VirtualAlloc(nullptr, REGION_SIZE * sizeof(TaskContext), MEM_RESERVE, PAGE_READWRITE));
+      if (!s_ContextRegions[region])
+      {
+        return false;
+      }
+    }
+
+    TaskContext* pSlab = ThreadpoolGetContext(first);
+    if (!::VirtualAlloc(pSlab, SLAB_SIZE * sizeof(TaskContext), MEM_COMMIT, PAGE_READWRITE))
+    {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < SLAB_SIZE - 1; i++)
+    {
+      pSlab[i].nextFree = first + i + 1;
+    }
+    s_NumContextSlabs++;
+    ThreadpoolPushFreeContexts(first, first + SLAB_SIZE - 1);
+
+    return true;
+  }
+
+  /// <summary>
+  /// Returns nullptr for threads that are not part of the threadpool and not the main thread.
+  /// </summary>
+  static detail::ContextCache* ThreadpoolGetContextCache()
+  {
+    auto* pWorker = static_cast<detail::Worker*>(::TlsGetValue(s_WorkerTlsIndex));
+    if (pWorker)
+    {
+      return &pWorker->contexts;
+    }
+    return ::GetCurrentThreadId() == s_MainThreadId ? &s_MainContexts : nullptr;
+  }
+
+  /// <returns>NO_CONTEXT if out of memory</returns>
+  static uint32_t ThreadpoolTakeFreeContext()
+  {
+    for (;;)
+    {
+      uint32_t index = ThreadpoolPopFreeContext();
+      if (index != NO_CONTEXT || !ThreadpoolGrowContexts())
+      {
+        return index;
+      }
+    }
+  }
+
+  /// <returns>NO_CONTEXT if out of memory</returns>
+  static uint32_t ThreadpoolAllocContext(detail::ContextCache* pCache)
+  {
+    if (!pCache)
+    {
+      return ThreadpoolTakeFreeContext();
+    }
+
+    if (pCache->count == 0)
+    {
+      uint32_t index = ThreadpoolTakeFreeContext();
+      if (index == NO_CONTEXT)
+      {
+        return NO_CONTEXT;
+      }
+      pCache->contexts[pCache->count++] = index;
+
+      // Half a cache, so a thread that allocates and frees in turn does not go to the shared list every time
+      while (pCache->count < CONTEXT_CACHE_SIZE / 2 && (index = ThreadpoolPopFreeContext()) != NO_CONTEXT)
+      {
+        pCache->contexts[pCache->count++] = index;
+      }
+    }
+
+    return pCache->contexts[--pCache->count];
+  }
+
+  static void ThreadpoolReleaseContext(detail::ContextCache* pCache, uint32_t index)
+  {
+    if (!pCache)
+    {
+      ThreadpoolPushFreeContexts(index, index);
+      return;
+    }
+
+    if (pCache->count == CONTEXT_CACHE_SIZE)
+    {
+      // Give the older half back
+      constexpr uint32_t half = CONTEXT_CACHE_SIZE / 2;
+      for (uint32_t i = 0; i < half - 1; i++)
+      {
+        ThreadpoolGetContext(pCache->contexts[i])->nextFree = pCache->contexts[i + 1];
+      }
+      ThreadpoolPushFreeContexts(pCache->contexts[0], pCache->contexts[half - 1]);
+      static_cast<void>(::memmove(pCache->contexts, pCache->contexts + half, half * sizeof(uint32_t)));
+      pCache->count = half;
+    }
+
+    pCache->contexts[pCache->count++] = index;
+  }
+
+  static void ThreadpoolFreeContext(TaskContext* pContext)
+  {
+    static_cast<void>(::InterlockedDecrement(&s_NumLiveContexts));
+
+    // Write a new TaskContext over this piece of memory
+    TaskContext* pNode = new (pContext) TaskContext;
+    ThreadpoolReleaseContext(ThreadpoolGetContextCache(), ThreadpoolGetContextIndex(pNode));
+  }
+
+  static void ThreadpoolFreeLargeTask(void* pStorage, uint8_t sizeClass)
+  {
+    static_cast<void>(::InterlockedDecrement(&s_NumLiveContexts));
+
+    detail::LargeTaskPool& pool = s_LargeTaskPools[sizeClass];
+    auto* pBlock                = static_cast<detail::LargeTaskPool::Block*>(pStorage);
+
+    ::AcquireSRWLockExclusive(&pool.lock);
+    MJ_DEFER(::ReleaseSRWLockExclusive(&pool.lock));
+
+    pBlock->pNext = pool.pFree;
+    pool.pFree    = pBlock;
+  }
+
+  /// <summary>
+  /// True on a worker while too many task contexts are live.
+  /// </summary>
+  static bool ThreadpoolIsThrottled()
+  {
+    return ::TlsGetValue(s_WorkerTlsIndex) && ::ReadAcquire(&s_NumLiveContexts) > THROTTLE_CONTEXTS;
+  }
+} // namespace mj
+
+/// <summary>
+/// The return value of this function can be cast to anything you want
+/// (as long as its size is less or equal).
+/// Returns nullptr only when out of memory.
+/// </summary>
+mj::TaskContext* mj::detail::ThreadpoolAllocTaskContext()
+{
+  uint32_t index = mj::ThreadpoolAllocContext(mj::ThreadpoolGetContextCache());
+  if (index == NO_CONTEXT)
+  {
+    return nullptr;
+  }
+
+  static_cast<void>(::InterlockedIncrement(&s_NumLiveContexts));
+  return mj::ThreadpoolGetContext(index);
 }
 
-void mj::ThreadpoolInit(DWORD threadId, UINT userMessage)
+void* mj::detail::ThreadpoolAllocLargeTask(uint8_t sizeClass)
 {
   ZoneScoped;
 
-  s_MainThreadId = threadId;
-  s_Msg          = userMessage;
+  LargeTaskPool& pool = s_LargeTaskPools[sizeClass];
+  ::AcquireSRWLockExclusive(&pool.lock);
+  MJ_DEFER(::ReleaseSRWLockExclusive(&pool.lock));
+
+  if (!pool.pFree)
+  {
+    // VirtualAlloc aligns the chunk, and every block is aligned to its size
+    auto* pChunk = static_cast<char*>(
+        ::VirtualAlloc(nullptr, LARGE_TASK_CHUNK_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (!pChunk)
+    {
+      return nullptr;
+    }
+
+    for (size_t offset = 0; offset < LARGE_TASK_CHUNK_SIZE; offset += TASK_SIZE_CLASSES[sizeClass])
+    {
+      auto* pBlock  = reinterpret_cast<LargeTaskPool::Block*>(pChunk + offset);
+      pBlock->pNext = pool.pFree;
+      pool.pFree    = pBlock;
+    }
+  }
 
-  MJ_ERR_IF(s_Iocp = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0), nullptr);
+  LargeTaskPool::Block* pBlock = pool.pFree;
+  pool.pFree                   = pBlock->pNext;
+
+  static_cast<void>(::InterlockedIncrement(&s_NumLiveContexts));
+  return pBlock;
+}
 
-  // Initialize free list
-  mj::TaskContext* pNext = nullptr;
-  for (int i = 0; i < MAX_TASKS; i++)
+void* mj::detail::ThreadpoolAllocStorage(size_t size)
+{
+  if (size > MAX_TASK_SIZE)
   {
-    s_TaskContextArray[i].pNextFreeNode = pNext;
-    pNext                               = &s_TaskContextArray[i];
+    mj::HeapAllocator alloc;
+    return alloc.Allocation(size).pAddress;
   }
-  s_pTaskHead = &s_TaskContextArray[MAX_TASKS - 1];
 
-  for (int i = 0; i < NUM_THREADS; i++)
+  uint8_t sizeClass = GetTaskSizeClass(size);
+  if (sizeClass == 0)
   {
-    ZoneScopedN("CreateThread");
-    MJ_ERR_IF(s_Threads[i] = ::CreateThread(nullptr,    // default security attributes
-                                            0,          // default stack size
-                                            ThreadMain, // entry point
-                                            nullptr,    // argument
-                                            0,          // default flags
-                                            nullptr),
-              nullptr);
+    return ThreadpoolAllocTaskContext();
   }
+  return ThreadpoolAllocLargeTask(sizeClass);
 }
 
-void mj::ThreadpoolTaskEnd(mj::Task* pTask)
+void mj::detail::ThreadpoolFreeStorage(void* pStorage, size_t size)
 {
-  if (!pTask->cancelled)
+  if (size > MAX_TASK_SIZE)
   {
-    pTask->OnDone();
+    mj::HeapAllocator alloc;
+    alloc.Free(pStorage);
+    return;
   }
-  pTask->Destroy();
-  mj::ThreadpoolFreeContext(reinterpret_cast<mj::TaskContext*>(pTask));
-}
 
-void mj::ThreadpoolDestroy()
-{
-  ::CloseHandle(s_Iocp);
-  s_Iocp = nullptr;
+  uint8_t sizeClass = GetTaskSizeClass(size);
+  if (sizeClass == 0)
+  {
+    mj::ThreadpoolFreeContext(static_cast<TaskContext*>(pStorage));
+  }
+  else
+  {
+    mj::ThreadpoolFreeLargeTask(pStorage, sizeClass);
+  }
 }
 
-void mj::ThreadpoolSubmitTask(mj::Task* pTask)
+namespace mj
 {
-  ::PostQueuedCompletionStatus(s_Iocp, 0, reinterpret_cast<ULONG_PTR>(pTask), nullptr);
+
+  static uint32_t CountBits(KAFFINITY mask)
+  {
+    uint32_t count = 0;
+    for (; mask != 0; mask &= mask - 1)
+    {
+      count++;
+    }
+    return count;
+  }
+
+  /// <summary>
+  /// Fills s_Topology, s_Cores and s_Nodes using GetLogicalProcessorInformationEx.
+  /// </summary>
+  static void ThreadpoolDetectTopology()
+  {
+    ZoneScoped;
+
+    // The first call fails, and returns the size of the buffer
+    DWORD numBytes = 0;
+    static_cast<void>(::GetLogicalProcessorInformationEx(RelationAll, nullptr, &numBytes));
+
+    mj::HeapAllocator alloc;
+    Allocation allocation = alloc.Allocation(numBytes);
+    if (allocation.Ok())
+    {
+      MJ_DEFER(alloc.Free(allocation.pAddress));
+      auto* pBuffer = static_cast<char*>(allocation.pAddress);
+      if (::GetLogicalProcessorInformationEx(RelationAll,
+                                             reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(pBuffer),
+                                             &numBytes))
+      {
+        // Entries have a variable size
+        for (DWORD offset = 0; offset < numBytes;)
+        {
+          auto* pInfo = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(pBuffer + offset);
+          switch (pInfo->Relationship)
+          {
+          case RelationProcessorCore:
+            s_Topology.numCores++;
+            for (WORD i = 0; i < pInfo->Processor.GroupCount; i++)
+            {
+              s_Topology.numLogicalProcessors += CountBits(pInfo->Processor.GroupMask[i].Mask);
+            }
+            if (s_NumCores < MAX_CORES)
+            {
+              // A core is always in a single processor group
+              s_Cores[s_NumCores].affinity = pInfo->Processor.GroupMask[0];
+              s_Cores[s_NumCores].node     = 0;
+              s_NumCores++;
+            }
+            break;
+          case RelationProcessorPackage:
+            s_Topology.numPackages++;
+            break;
+          case RelationNumaNode:
+            s_Topology.numNumaNodes++;
+            if (s_NumNodes < MAX_NODES)
+            {
+              s_Nodes[s_NumNodes++] = pInfo->NumaNode.GroupMask;
+            }
+            break;
+          default:
+            break;
+          }
+          offset += pInfo->Size;
+        }
+      }
+    }
+
+    if (s_Topology.numLogicalProcessors == 0)
+    {
+      // Unknown topology, workers are not placed
+      MJ_UNINITIALIZED SYSTEM_INFO systemInfo;
+      ::GetSystemInfo(&systemInfo);
+      s_Topology.numLogicalProcessors = systemInfo.dwNumberOfProcessors;
+      s_Topology.numCores             = systemInfo.dwNumberOfProcessors;
+      s_Topology.numPackages          = 1;
+      s_Topology.numNumaNodes         = 1;
+      s_NumCores                      = 0;
+      s_NumNodes                      = 0;
+      return;
+    }
+
+    for (uint32_t i = 0; i < s_NumCores; i++)
+    {
+      for (uint32_t j = 0; j < s_NumNodes; j++)
+      {
+        if (s_Cores[i].affinity.Group == s_Nodes[j].Group && (s_Cores[i].affinity.Mask & s_Nodes[j].Mask) != 0)
+        {
+          s_Cores[i].node = j;
+          break;
+        }
+      }
+    }
+
+    // Placement order: one core of every node in turn when NUMA-aware, enumeration order otherwise
+    uint32_t numOrdered = 0;
+    if (s_Config.numaAware && s_NumNodes > 1)
+    {
+      for (uint32_t round = 0; numOrdered < s_NumCores; round++)
+      {
+        for (uint32_t node = 0; node < s_NumNodes; node++)
+        {
+          for (uint32_t i = 0, seen = 0; i < s_NumCores; i++)
+          {
+            if (s_Cores[i].node == node && seen++ == round)
+            {
+              s_CoreOrder[numOrdered++] = i;
+              break;
+            }
+          }
+        }
+      }
+    }
+    for (uint32_t i = numOrdered; i < s_NumCores; i++)
+    {
+      s_CoreOrder[i] = i;
+    }
+  }
+
+  /// <summary>
+  /// Workers take every core before they share one with an SMT sibling.
+  /// </summary>
+  static void ThreadpoolPlaceWorker(HANDLE hThread, uint32_t worker)
+  {
+    if (s_NumCores == 0)
+    {
+      return;
+    }
+
+    const detail::Core& core = s_Cores[s_CoreOrder[worker % s_NumCores]];
+    s_Workers[worker].node   = core.node;
+
+    GROUP_AFFINITY affinity;
+    static_cast<void>(::memset(&affinity, 0, sizeof(affinity)));
+    if (s_Config.pinThreads)
+    {
+      // Clear the lowest bits to get the sibling-th logical processor of the core
+      KAFFINITY mask   = core.affinity.Mask;
+      uint32_t sibling = (worker / s_NumCores) % CountBits(mask);
+      for (uint32_t i = 0; i < sibling; i++)
+      {
+        mask &= mask - 1;
+      }
+      affinity.Group = core.affinity.Group;
+      affinity.Mask  = mask & (~mask + 1);
+    }
+    else if (s_Config.numaAware && s_NumNodes > 1)
+    {
+      affinity = s_Nodes[core.node];
+    }
+    else
+    {
+      return;
+    }
+
+    static_cast<void>(::SetThreadGroupAffinity(hThread, &affinity, nullptr));
+  }
+
+  /// <summary>
+  /// Writes the chosen configuration to the debug output.
+  /// </summary>
+  static void ThreadpoolReportTopology()
+  {
+    MJ_UNINITIALIZED wchar_t buffer[256];
+    MJ_UNINITIALIZED Allocation allocation;
+    allocation.pAddress  = buffer;
+    allocation.numBytes  = sizeof(buffer);
+    mj::StaticStringBuilder sb;
+    sb.Init(allocation);
+
+    sb.Append(L"Threadpool: ")
+        .AppendUInt64(s_Config.numThreads)
+        .Append(L" compute and ")
+        .AppendUInt64(s_Config.numIoThreads)
+        .Append(L" IO workers on ")
+        .AppendUInt64(s_Topology.numLogicalProcessors)
+        .Append(L" logical processors, ")
+        .AppendUInt64(s_Topology.numCores)
+        .Append(L" cores, ")
+        .AppendUInt64(s_Topology.numPackages)
+        .Append(L" packages, ")
+        .AppendUInt64(s_Topology.numNumaNodes)
+        .Append(L" NUMA nodes");
+    if (s_Config.pinThreads)
+    {
+      sb.Append(L", pinned");
+    }
+    if (s_Config.numaAware)
+    {
+      sb.Append(L", NUMA-aware");
+    }
+    if (s_Config.deterministic)
+    {
+      sb.Append(L", deterministic with seed ").AppendUInt64(s_Config.seed);
+    }
+    ::OutputDebugStringW(sb.Append(L"\r\n").ToStringClosed().ptr);
+  }
+
+  static LONG64 ThreadpoolGetTicks()
+  {
+    if (s_Config.deterministic)
+    {
+      return s_VirtualTicks;
+    }
+
+    MJ_UNINITIALIZED LARGE_INTEGER ticks;
+    static_cast<void>(::QueryPerformanceCounter(&ticks));
+    return ticks.QuadPart;
+  }
+
+  static uint64_t ThreadpoolTicksToMicroseconds(LONG64 ticks)
+  {
+    return static_cast<uint64_t>(mj::max<LONG64>(ticks, 0)) * 1000000 / static_cast<uint64_t>(s_TicksPerSecond);
+  }
+
+  /// <summary>
+  /// Finds a substring. Returns nullptr if it is not there.
+  /// </summary>
+  static const char* ThreadpoolFindString(const char* pString, const char* pPattern)
+  {
+    for (; *pString; pString++)
+    {
+      size_t i = 0;
+      while (pPattern[i] && pString[i] == pPattern[i])
+      {
+        i++;
+      }
+      if (!pPattern[i])
+      {
+        return pString;
+      }
+    }
+    return nullptr;
+  }
+
+  /// <summary>
+  /// Cuts the template argument out of the signature of TaskType<T>::GetName, as MSVC or GCC and Clang write it.
+  /// </summary>
+  static StringView ThreadpoolGetTaskTypeName(const char* pSignature, wchar_t* pBuffer, size_t maxChars)
+  {
+    const char* pBegin = ThreadpoolFindString(pSignature, "[with T = ");
+    const char* pEnd   = nullptr;
+    if (pBegin)
+    {
+      pBegin += 10;
+      pEnd = ThreadpoolFindString(pBegin, "]");
+    }
+    else if ((pBegin = ThreadpoolFindString(pSignature, "TaskType<")) != nullptr)
+    {
+      pBegin += 9;
+      for (const char* pFound = pBegin; (pFound = ThreadpoolFindString(pFound, ">::GetName")) != nullptr; pFound++)
+      {
+        pEnd = pFound;
+      }
+    }
+    if (!pBegin || !pEnd)
+    {
+      pBegin = pSignature;
+      pEnd   = pSignature + ::lstrlenA(pSignature);
+    }
+
+    static constexpr const char* PREFIXES[] = { "struct ", "class " };
+    for (const char* pPrefix : PREFIXES)
+    {
+      if (ThreadpoolFindString(pBegin, pPrefix) == pBegin)
+      {
+        pBegin += ::lstrlenA(pPrefix);
+      }
+    }
+
+    size_t numChars = 0;
+    for (; pBegin + numChars < pEnd && numChars < maxChars; numChars++)
+    {
+      pBuffer[numChars] = static_cast<wchar_t>(static_cast<unsigned char>(pBegin[numChars]));
+    }
+
+    MJ_UNINITIALIZED StringView name;
+    name.Init(pBuffer, numChars);
+    return name;
+  }
+
+  static void ThreadpoolAppendLatency(StaticStringBuilder& sb, const wchar_t* pLabel, const Histogram& histogram)
+  {
+    sb.Append(pLabel)
+        .AppendUInt64(histogram.ValueAtPermille(500))
+        .Append(L"/")
+        .AppendUInt64(histogram.ValueAtPermille(990))
+        .Append(L"/")
+        .AppendUInt64(histogram.Max())
+        .Append(L" us");
+  }
+
+  static LONG64 ThreadpoolGetBusyTicks()
+  {
+    LONG64 busyTicks = 0;
+    for (uint32_t i = 0; i < s_Config.numThreads; i++)
+    {
+      busyTicks += ::ReadNoFence64(&s_Workers[i].busyTicks);
+    }
+    return busyTicks;
+  }
+
+  /// <summary>
+  /// Feeds the Tracy plots. Called by the main thread for every task it ends.
+  /// </summary>
+  static void ThreadpoolPlotMetrics()
+  {
+#ifdef TRACY_ENABLE
+    LONG64 now = ThreadpoolGetTicks();
+    TracyPlot("Queued tasks", static_cast<int64_t>(::ReadAcquire(&s_NumQueuedTasks)));
+    TracyPlot("Finished tasks", static_cast<int64_t>(::ReadAcquire(&s_NumFinishedTasks)));
+    TracyPlot("Live tasks", static_cast<int64_t>(::ReadAcquire(&s_NumLiveContexts)));
+
+    LONG64 elapsed = now - s_LastPlotTicks;
+    if (elapsed >= s_TicksPerSecond / PLOT_INTERVALS_PER_SECOND)
+    {
+      LONG64 busyTicks = ThreadpoolGetBusyTicks();
+      TracyPlot("Busy workers (%)",
+                100.0 * static_cast<double>(busyTicks - s_LastPlotBusyTicks) /
+                    (static_cast<double>(elapsed) * s_Config.numThreads));
+      s_LastPlotTicks     = now;
+      s_LastPlotBusyTicks = busyTicks;
+    }
+#endif
+  }
+
+  /// <summary>
+  /// Wakes a worker of the pool that runs tasks of the kind.
+  /// </summary>
+  static void ThreadpoolWakeWorker(ETaskKind::Enum kind)
+  {
+    volatile LONG* pEpoch       = kind == ETaskKind::IO ? &s_IoWakeEpoch : &s_WakeEpoch;
+    volatile LONG* pNumSleeping = kind == ETaskKind::IO ? &s_NumIoSleeping : &s_NumSleeping;
+
+    // Both sides use a full barrier: a worker that is about to sleep either sees the new epoch,
+    // or is counted in the number of sleeping workers here.
+    static_cast<void>(::InterlockedIncrement(pEpoch));
+    if (::ReadAcquire(pNumSleeping) > 0)
+    {
+      ::WakeByAddressSingle(const_cast<LONG*>(pEpoch));
+    }
+  }
+
+  /// <summary>
+  /// Number of workers in the pool that runs tasks of the kind.
+  /// </summary>
+  static uint32_t ThreadpoolGetPoolSize(ETaskKind::Enum kind)
+  {
+    return kind == ETaskKind::IO ? s_Config.numIoThreads : s_Config.numThreads;
+  }
+
+  static void ThreadpoolUpdateMax(volatile LONG* pMax, LONG value)
+  {
+    LONG max = ::ReadAcquire(pMax);
+    while (value > max)
+    {
+      LONG previous = ::InterlockedCompareExchange(pMax, value, max);
+      if (previous == max)
+      {
+        break;
+      }
+      max = previous;
+    }
+  }
+
+  /// <summary>
+  /// Queues tasks with one operation on the queue they go to. All tasks must have the same kind and priority.
+  /// </summary>
+  static void ThreadpoolPush(Task** ppTasks, size_t numTasks)
+  {
+    LONG64 now = ThreadpoolGetTicks();
+    for (size_t i = 0; i < numTasks; i++)
+    {
+      ppTasks[i]->timestamp = now;
+    }
+
+    ThreadpoolUpdateMax(&s_MaxQueuedTasks, ::InterlockedAdd(&s_NumQueuedTasks, static_cast<LONG>(numTasks)));
+
+    auto* pWorker = static_cast<detail::Worker*>(::TlsGetValue(s_WorkerTlsIndex));
+    if (ppTasks[0]->kind == ETaskKind::IO)
+    {
+      s_IoQueues[ppTasks[0]->priority].Push(ppTasks, numTasks);
+    }
+    else if (pWorker && !pWorker->io)
+    {
+      // Submitted by a task: keep it local. Pushed in reverse, so they are popped in order.
+      for (size_t i = numTasks; i > 0; i--)
+      {
+        if (!pWorker->deques[ppTasks[i - 1]->priority].Push(ppTasks[i - 1]))
+        {
+          s_InjectQueues[ppTasks[i - 1]->priority].Push(&ppTasks[i - 1], 1);
+        }
+      }
+    }
+    else
+    {
+      s_InjectQueues[ppTasks[0]->priority].Push(ppTasks, numTasks);
+    }
+  }
+
+  /// <summary>
+  /// Takes a batch of tasks from an injection queue. Returns the first, the others are pushed to the deque
+  /// of the same priority.
+  /// </summary>
+  static Task* ThreadpoolTakeInjected(detail::Worker* pWorker, uint32_t priority)
+  {
+    MJ_UNINITIALIZED Task* batch[INJECT_BATCH_SIZE];
+    size_t numBatch = s_InjectQueues[priority].Pop(batch, INJECT_BATCH_SIZE, s_Config.numThreads);
+    if (numBatch == 0)
+    {
+      return nullptr;
+    }
+
+    // Pushed in reverse, so they are popped in submission order
+    for (size_t i = numBatch - 1; i > 0; i--)
+    {
+      if (!pWorker->deques[priority].Push(batch[i]))
+      {
+        s_InjectQueues[priority].Push(&batch[i], 1);
+      }
+    }
+    if (numBatch > 1)
+    {
+      ThreadpoolWakeWorker(ETaskKind::Compute);
+    }
+
+    return batch[0];
+  }
+
+  /// <summary>
+  /// IO workers take one task at a time, in the order of the lanes of ThreadpoolFindTask.
+  /// </summary>
+  static Task* ThreadpoolTakeIo(detail::Worker* pWorker)
+  {
+    MJ_UNINITIALIZED Task* pTask;
+    if (++pWorker->numSearches % BACKGROUND_INTERVAL == 0 &&
+        s_IoQueues[ETaskPriority::Background].Pop(&pTask, 1, 1) == 1)
+    {
+      return pTask;
+    }
+
+    for (uint32_t priority = 0; priority < NUM_PRIORITIES; priority++)
+    {
+      if (s_IoQueues[priority].Pop(&pTask, 1, 1) == 1)
+      {
+        return pTask;
+      }
+    }
+
+    return nullptr;
+  }
+
+  static Task* ThreadpoolSteal(detail::Worker* pWorker, uint32_t priority, bool sameNode)
+  {
+    // Start at a random victim
+    uint32_t first = pWorker->rng.next() % s_Config.numThreads;
+    for (uint32_t i = 0; i < s_Config.numThreads; i++)
+    {
+      detail::Worker* pVictim = &s_Workers[(first + i) % s_Config.numThreads];
+      if (pVictim != pWorker && (pVictim->node == pWorker->node) == sameNode)
+      {
+        Task* pTask = pVictim->deques[priority].Steal();
+        if (pTask)
+        {
+          return pTask;
+        }
+      }
+    }
+
+    return nullptr;
+  }
+
+  static Task* ThreadpoolFindTask(detail::Worker* pWorker, uint32_t priority)
+  {
+    // Own work first, most recently pushed first: its data is most likely still in cache
+    Task* pTask = pWorker->deques[priority].Pop();
+    if (pTask)
+    {
+      return pTask;
+    }
+
+    pTask = ThreadpoolTakeInjected(pWorker, priority);
+    if (pTask)
+    {
+      return pTask;
+    }
+
+    // Stealing across NUMA nodes is the last resort. Without NUMA placement, all workers are on node 0.
+    pTask = ThreadpoolSteal(pWorker, priority, true);
+    if (pTask)
+    {
+      return pTask;
+    }
+
+    return ThreadpoolSteal(pWorker, priority, false);
+  }
+
+  /// <summary>
+  /// Strict priority, except for every BACKGROUND_INTERVAL-th search.
+  /// </summary>
+  static Task* ThreadpoolFindTask(detail::Worker* pWorker)
+  {
+    Task* pTask = nullptr;
+    if (++pWorker->numSearches % BACKGROUND_INTERVAL == 0)
+    {
+      pTask = ThreadpoolFindTask(pWorker, ETaskPriority::Background);
+    }
+
+    for (uint32_t priority = 0; !pTask && priority < NUM_PRIORITIES; priority++)
+    {
+      pTask = ThreadpoolFindTask(pWorker, priority);
+    }
+
+    return pTask;
+  }
+
+  /// <summary>
+  /// Hands an executed task to its continuation. The last predecessor to finish submits the continuation
+  /// to its own deque, so it most likely runs next on the same worker. A continuation of the other kind
+  /// goes straight to the queues of the other pool.
+  /// </summary>
+  static void ThreadpoolFinishPredecessor(Task* pTask)
+  {
+    Task* pNext = pTask->pContinuation;
+
+    MJ_UNINITIALIZED Task* pHead;
+    do
+    {
+      pHead                   = pNext->pPredecessors;
+      pTask->pNextPredecessor = pHead;
+    } while (::InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&pNext->pPredecessors), pTask,
+                                                 pHead) != pHead);
+
+    if (::InterlockedDecrement(&pNext->numPending) == 0)
+    {
+      ThreadpoolSubmitTask(pNext);
+    }
+  }
+
+  static bool ThreadpoolIsGraphCancelled(Task* pTask)
+  {
+    if (pTask->cancelled || pTask->token.IsCancelled())
+    {
+      return true;
+    }
+    for (Task* pPredecessor = pTask->pPredecessors; pPredecessor; pPredecessor = pPredecessor->pNextPredecessor)
+    {
+      if (ThreadpoolIsGraphCancelled(pPredecessor))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void ThreadpoolEndGraph(Task* pTask, bool cancelled)
+  {
+    // Predecessors first, their OnDone comes before the OnDone of their continuation
+    Task* pPredecessor = pTask->pPredecessors;
+    while (pPredecessor)
+    {
+      Task* pNextPredecessor = pPredecessor->pNextPredecessor;
+      ThreadpoolEndGraph(pPredecessor, cancelled);
+      pPredecessor = pNextPredecessor;
+    }
+
+    if (!cancelled)
+    {
+      if (pTask->timestamp != 0)
+      {
+        s_TaskTypes[pTask->type].done.Record(ThreadpoolTicksToMicroseconds(ThreadpoolGetTicks() - pTask->timestamp));
+      }
+      pTask->OnDone();
+    }
+    pTask->Destroy();
+    if (pTask->sizeClass == 0)
+    {
+      ThreadpoolFreeContext(reinterpret_cast<TaskContext*>(pTask));
+    }
+    else
+    {
+      ThreadpoolFreeLargeTask(pTask, pTask->sizeClass);
+    }
+  }
+
+  /// <summary>
+  /// Takes a task that the calling worker queued itself, of any priority.
+  /// </summary>
+  static Task* ThreadpoolPopOwnTask(detail::Worker* pWorker)
+  {
+    for (uint32_t priority = 0; priority < NUM_PRIORITIES; priority++)
+    {
+      Task* pTask = pWorker->deques[priority].Pop();
+      if (pTask)
+      {
+        return pTask;
+      }
+    }
+    return nullptr;
+  }
+
+  /// <summary>
+  /// Hands the last task of a graph to the main thread, see ThreadpoolEndTasks. Only the first task of a backlog
+  /// posts a message, so the message queue of the main thread stays short however many tasks finish.
+  /// </summary>
+  static void ThreadpoolPushFinished(Task* pTask)
+  {
+    ThreadpoolUpdateMax(&s_MaxFinishedTasks, ::InterlockedIncrement(&s_NumFinishedTasks));
+
+    MJ_UNINITIALIZED Task* pHead;
+    do
+    {
+      pHead                   = s_FinishedTasks;
+      pTask->pNextPredecessor = pHead;
+    } while (::InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&s_FinishedTasks), pTask, pHead) !=
+             pHead);
+
+    if (!pHead)
+    {
+      ZoneScopedNC("PostMessageW", 0x31332C);
+      MJ_ERR_ZERO(::PostThreadMessageW(s_MainThreadId, s_Msg, 0, 0));
+    }
+  }
+
+  /// <summary>
+  /// Executes a task on the calling thread, and hands it to its continuation or the main thread.
+  /// </summary>
+  static void ThreadpoolRunTask(Task* pTask)
+  {
+    detail::TaskTypeMetrics& metrics = s_TaskTypes[pTask->type];
+    LONG64 start                     = ThreadpoolGetTicks();
+    if (pTask->timestamp != 0)
+    {
+      // Not queued if it ran inline
+      static_cast<void>(::InterlockedDecrement(&s_NumQueuedTasks));
+      metrics.wait.Record(ThreadpoolTicksToMicroseconds(start - pTask->timestamp));
+    }
+
+    // Dropped tasks still go through the graph and the main thread, so they are destroyed
+    pTask->timestamp = 0;
+    if (!pTask->token.IsCancelled())
+    {
+      pTask->Execute();
+      pTask->timestamp = ThreadpoolGetTicks();
+      metrics.execute.Record(ThreadpoolTicksToMicroseconds(pTask->timestamp - start));
+    }
+
+    if (pTask->pContinuation)
+    {
+      // Only the last task of a graph is reported to the main thread
+      ThreadpoolFinishPredecessor(pTask);
+    }
+    else if (s_Config.deterministic)
+    {
+      // Already on the main thread, see ThreadpoolStep
+      ThreadpoolTaskEnd(pTask);
+    }
+    else
+    {
+      ThreadpoolPushFinished(pTask);
+    }
+  }
+
+  /// <summary>
+  /// Queues the tasks that are due, and ends those that were cancelled while they waited.
+  /// </summary>
+  /// <returns>Milliseconds until the first slot with tasks, INFINITE if there are none</returns>
+  static DWORD ThreadpoolFireTimers()
+  {
+    uint64_t now  = detail::ThreadpoolGetTimerTime();
+    Task* pFirst  = nullptr;
+    Task** ppLast = &pFirst;
+    DWORD timeout = INFINITE;
+    {
+      ::AcquireSRWLockExclusive(&s_TimerLock);
+      MJ_DEFER(::ReleaseSRWLockExclusive(&s_TimerLock));
+
+      // Every slot passed since the last time, at most one round
+      for (uint64_t time = s_TimerTime + 1; time <= now && time <= s_TimerTime + TIMER_WHEEL_SIZE; time++)
+      {
+        for (Task** ppLink = &s_TimerSlots[time % TIMER_WHEEL_SIZE]; *ppLink;)
+        {
+          Task* pTask = *ppLink;
+          if (static_cast<uint64_t>(pTask->timestamp) <= now)
+          {
+            *ppLink = pTask->pNextPredecessor;
+            *ppLast = pTask;
+            ppLast  = &pTask->pNextPredecessor;
+          }
+          else
+          {
+            ppLink = &pTask->pNextPredecessor;
+          }
+        }
+      }
+      *ppLast     = nullptr;
+      s_TimerTime = mj::max(s_TimerTime, now);
+
+      s_TimerWakeTime = UINT64_MAX;
+      for (uint64_t time = s_TimerTime + 1; time <= s_TimerTime + TIMER_WHEEL_SIZE; time++)
+      {
+        if (s_TimerSlots[time % TIMER_WHEEL_SIZE])
+        {
+          s_TimerWakeTime = time;
+          timeout         = static_cast<DWORD>(time - now);
+          break;
+        }
+      }
+    }
+
+    // In due order
+    while (pFirst)
+    {
+      Task* pTask             = pFirst;
+      pFirst                  = pTask->pNextPredecessor;
+      pTask->pNextPredecessor = nullptr;
+      pTask->timestamp        = 0;
+      if (pTask->token.IsCancelled())
+      {
+        ThreadpoolRunTask(pTask);
+      }
+      else
+      {
+        ThreadpoolSubmitTask(pTask);
+      }
+    }
+
+    return timeout;
+  }
+
+  /// <summary>
+  /// Reads the outcome of a file transfer. Waits for it in deterministic mode, where files have no completion port.
+  /// </summary>
+  static void ThreadpoolFinishFileIo(FileIoTask* pTask, bool wait)
+  {
+    if (::GetOverlappedResult(pTask->file, &pTask->overlapped, &pTask->numTransferred, wait))
+    {
+      pTask->error = ERROR_SUCCESS;
+    }
+    else
+    {
+      pTask->error = ::GetLastError();
+    }
+  }
+
+  /// <summary>
+  /// Queues the tasks of finished file transfers, one queue operation per run of tasks of the same lane.
+  /// Not throttled: the completion thread must not execute tasks itself.
+  /// </summary>
+  static void ThreadpoolPushFileIo(Task** ppTasks, size_t numTasks)
+  {
+    size_t first = 0;
+    for (size_t i = 1; i <= numTasks; i++)
+    {
+      if (i == numTasks || ppTasks[i]->kind != ppTasks[first]->kind ||
+          ppTasks[i]->priority != ppTasks[first]->priority)
+      {
+        ETaskKind::Enum kind = ppTasks[first]->kind;
+        ThreadpoolPush(&ppTasks[first], i - first);
+        for (size_t j = 0; j < mj::min<size_t>(i - first, ThreadpoolGetPoolSize(kind)); j++)
+        {
+          ThreadpoolWakeWorker(kind);
+        }
+        first = i;
+      }
+    }
+  }
+} // namespace mj
+
+/// <summary>
+/// Sleeps until the first slot of the timer wheel with tasks, or until a task is added before it.
+/// </summary>
+static DWORD WINAPI TimerMain(LPVOID lpThreadParameter)
+{
+  static_cast<void>(lpThreadParameter);
+#ifdef TRACY_ENABLE
+  tracy::SetThreadName("Threadpool timers");
+#endif
+
+  while (::ReadAcquire(&s_Running))
+  {
+    // Read before firing, so a task added after the slots were checked changes it
+    LONG epoch    = ::ReadAcquire(&s_TimerEpoch);
+    DWORD timeout = mj::ThreadpoolFireTimers();
+    if (timeout != 0)
+    {
+      ZoneScopedNC("Sleeping", 0x21231C);
+      static_cast<void>(::WaitOnAddress(&s_TimerEpoch, &epoch, sizeof(epoch), timeout));
+    }
+  }
+
+  return 0;
+}
+
+/// <summary>
+/// Queues the tasks of completed file transfers, as many as the completion port has at once.
+/// </summary>
+static DWORD WINAPI IoMain(LPVOID lpThreadParameter)
+{
+  static_cast<void>(lpThreadParameter);
+#ifdef TRACY_ENABLE
+  tracy::SetThreadName("Threadpool IO completions");
+#endif
+
+  MJ_UNINITIALIZED OVERLAPPED_ENTRY entries[FILE_IO_BATCH_SIZE];
+  MJ_UNINITIALIZED mj::Task* tasks[FILE_IO_BATCH_SIZE];
+  while (::ReadAcquire(&s_Running))
+  {
+    ULONG numEntries = 0;
+    {
+      ZoneScopedNC("Sleeping", 0x21231C);
+      if (!::GetQueuedCompletionStatusEx(s_IoPort, entries, FILE_IO_BATCH_SIZE, &numEntries, INFINITE, FALSE))
+      {
+        continue;
+      }
+    }
+
+    size_t numTasks = 0;
+    for (ULONG i = 0; i < numEntries; i++)
+    {
+      // ThreadpoolDestroy posts a packet without a transfer
+      if (entries[i].lpOverlapped)
+      {
+        auto* pTask = CONTAINING_RECORD(entries[i].lpOverlapped, mj::FileIoTask, overlapped);
+        mj::ThreadpoolFinishFileIo(pTask, false);
+        tasks[numTasks++] = pTask;
+      }
+    }
+    mj::ThreadpoolPushFileIo(tasks, numTasks);
+  }
+
+  return 0;
+}
+
+static DWORD WINAPI ThreadMain(LPVOID lpThreadParameter)
+{
+  auto* pWorker = static_cast<mj::detail::Worker*>(lpThreadParameter);
+  MJ_ERR_ZERO(::TlsSetValue(s_WorkerTlsIndex, pWorker));
+#ifdef TRACY_ENABLE
+  tracy::SetThreadName(pWorker->io ? "Threadpool IO thread" : "Threadpool thread");
+#endif
+
+  volatile LONG* pWakeEpoch   = pWorker->io ? &s_IoWakeEpoch : &s_WakeEpoch;
+  volatile LONG* pNumSleeping = pWorker->io ? &s_NumIoSleeping : &s_NumSleeping;
+  while (::ReadAcquire(&s_Running))
+  {
+    // Read before looking for work, so a task submitted after the search changes it
+    LONG epoch = ::ReadAcquire(pWakeEpoch);
+
+    mj::Task* pTask = pWorker->io ? mj::ThreadpoolTakeIo(pWorker) : mj::ThreadpoolFindTask(pWorker);
+    if (!pTask)
+    {
+      ZoneScopedNC("Sleeping", 0x21231C);
+      static_cast<void>(::InterlockedIncrement(pNumSleeping));
+      static_cast<void>(::WaitOnAddress(pWakeEpoch, &epoch, sizeof(epoch), INFINITE));
+      static_cast<void>(::InterlockedDecrement(pNumSleeping));
+      continue;
+    }
+
+    LONG64 start = mj::ThreadpoolGetTicks();
+    mj::ThreadpoolRunTask(pTask);
+    pWorker->busyTicks += mj::ThreadpoolGetTicks() - start;
+  }
+
+  return 0;
+}
+
+void mj::ThreadpoolInit(DWORD threadId, UINT userMessage, const ThreadpoolConfig& config)
+{
+  ZoneScoped;
+
+  s_MainThreadId = threadId;
+  s_Msg          = userMessage;
+  s_Config       = config;
+
+  MJ_ERR_IF(s_WorkerTlsIndex = ::TlsAlloc(), TLS_OUT_OF_INDEXES);
+
+  if (s_Config.deterministic)
+  {
+    // Starts at one, a zero timestamp means the task was not queued
+    s_TicksPerSecond = 1000000;
+    s_VirtualTicks   = 1;
+    s_StepRng.seed(s_Config.seed, 0x9E3779B9u, 0x7F4A7C15u, 0x85EBCA6Bu);
+  }
+  else
+  {
+    MJ_UNINITIALIZED LARGE_INTEGER frequency;
+    static_cast<void>(::QueryPerformanceFrequency(&frequency));
+    s_TicksPerSecond = frequency.QuadPart;
+  }
+  s_StartTicks    = mj::ThreadpoolGetTicks();
+  s_LastPlotTicks = s_StartTicks;
+  s_TimerWakeTime = UINT64_MAX;
+
+  ThreadpoolDetectTopology();
+  if (s_Config.numThreads == 0)
+  {
+    // Leave a logical processor for the main thread
+    s_Config.numThreads = s_Topology.numLogicalProcessors - 1;
+  }
+  s_Config.numThreads = mj::min<uint32_t>(mj::max<uint32_t>(s_Config.numThreads, 1), MAX_THREADS);
+  if (s_Config.numIoThreads == 0)
+  {
+    s_Config.numIoThreads = s_Config.numThreads / 2;
+  }
+  s_Config.numIoThreads = mj::min<uint32_t>(mj::max<uint32_t>(s_Config.numIoThreads, 1), MAX_IO_THREADS);
+  ThreadpoolReportTopology();
+  if (s_Config.deterministic)
+  {
+    return;
+  }
+
+  s_Running = TRUE;
+  for (uint32_t i = 0; i < s_Config.numThreads + s_Config.numIoThreads; i++)
+  {
+    ZoneScopedN("CreateThread");
+    mj::detail::Worker* pWorker = &s_Workers[i];
+    pWorker->index              = i;
+    pWorker->node               = 0;
+    pWorker->numSearches        = 0;
+    pWorker->busyTicks          = 0;
+    pWorker->io                 = i >= s_Config.numThreads;
+    pWorker->rng.seed(0x9E3779B9u * (i + 1), ::GetTickCount(), threadId, i);
+
+    // Created suspended, so it starts on the right processor
+    MJ_ERR_IF(s_Threads[i] = ::CreateThread(nullptr,          // default security attributes
+                                            0,                // default stack size
+                                            ThreadMain,       // entry point
+                                            pWorker,          // argument
+                                            CREATE_SUSPENDED, // flags
+                                            nullptr),
+              nullptr);
+    if (!pWorker->io)
+    {
+      // IO workers mostly wait, the scheduler places them
+      ThreadpoolPlaceWorker(s_Threads[i], i);
+    }
+    static_cast<void>(::ResumeThread(s_Threads[i]));
+  }
+
+  MJ_ERR_IF(s_TimerThread = ::CreateThread(nullptr, 0, TimerMain, nullptr, 0, nullptr), nullptr);
+  MJ_ERR_IF(s_IoPort = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1), nullptr);
+  MJ_ERR_IF(s_IoThread = ::CreateThread(nullptr, 0, IoMain, nullptr, 0, nullptr), nullptr);
+}
+
+const mj::ThreadpoolTopology& mj::ThreadpoolGetTopology()
+{
+  return s_Topology;
+}
+
+uint32_t mj::ThreadpoolGetNumThreads()
+{
+  return s_Config.numThreads;
+}
+
+void mj::ThreadpoolTaskEnd(mj::Task* pTask)
+{
+  mj::ThreadpoolEndGraph(pTask, mj::ThreadpoolIsGraphCancelled(pTask));
+  mj::ThreadpoolPlotMetrics();
+}
+
+bool mj::ThreadpoolEndTasks(uint32_t budgetMicroseconds)
+{
+  ZoneScoped;
+
+  // Taken all at once, and reversed so they end in the order they finished
+  auto* pTaken = static_cast<mj::Task*>(
+      ::InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&s_FinishedTasks), nullptr));
+  if (pTaken)
+  {
+    mj::Task* pReversed = nullptr;
+    mj::Task* pLast     = pTaken;
+    while (pTaken)
+    {
+      mj::Task* pNext          = pTaken->pNextPredecessor;
+      pTaken->pNextPredecessor = pReversed;
+      pReversed                = pTaken;
+      pTaken                   = pNext;
+    }
+    *s_ppEndQueueTail = pReversed;
+    s_ppEndQueueTail  = &pLast->pNextPredecessor;
+  }
+
+  // At least one task per call, so the backlog always shrinks
+  LONG64 deadline = mj::ThreadpoolGetTicks() + static_cast<LONG64>(budgetMicroseconds) * s_TicksPerSecond / 1000000;
+  while (s_EndQueue)
+  {
+    mj::Task* pTask         = s_EndQueue;
+    s_EndQueue              = pTask->pNextPredecessor;
+    pTask->pNextPredecessor = nullptr;
+    if (!s_EndQueue)
+    {
+      s_ppEndQueueTail = &s_EndQueue;
+    }
+    static_cast<void>(::InterlockedDecrement(&s_NumFinishedTasks));
+    mj::ThreadpoolTaskEnd(pTask);
+
+    if (mj::ThreadpoolGetTicks() >= deadline)
+    {
+      break;
+    }
+  }
+
+  return s_EndQueue != nullptr;
+}
+
+void mj::ThreadpoolThen(mj::Task* pTask, mj::Task* pNext)
+{
+  pTask->pContinuation = pNext;
+  static_cast<void>(::InterlockedIncrement(&pNext->numPending)); // Running tasks can add predecessors too
+}
+
+void mj::ThreadpoolWhenAll(mj::Task** ppTasks, size_t numTasks, mj::Task* pNext)
+{
+  for (size_t i = 0; i < numTasks; i++)
+  {
+    mj::ThreadpoolThen(ppTasks[i], pNext);
+  }
+}
+
+uint16_t mj::detail::ThreadpoolRegisterTaskType(volatile LONG* pSlot, const char* pName)
+{
+  ::AcquireSRWLockExclusive(&s_TaskTypeLock);
+  MJ_DEFER(::ReleaseSRWLockExclusive(&s_TaskTypeLock));
+
+  // Another thread may have registered the type while this one was waiting
+  LONG slot = *pSlot;
+  if (slot == 0)
+  {
+    // The last slot is reserved for the types that do not fit
+    if (s_NumTaskTypes < MAX_TASK_TYPES - 1)
+    {
+      s_TaskTypes[s_NumTaskTypes].pName = pName;
+      slot                              = static_cast<LONG>(++s_NumTaskTypes);
+    }
+    else
+    {
+      s_TaskTypes[MAX_TASK_TYPES - 1].pName = nullptr;
+      s_NumTaskTypes                        = MAX_TASK_TYPES;
+      slot                                  = MAX_TASK_TYPES;
+    }
+    ::WriteRelease(pSlot, slot);
+  }
+
+  return static_cast<uint16_t>(slot - 1);
+}
+
+void mj::ThreadpoolReportMetrics()
+{
+  MJ_UNINITIALIZED wchar_t buffer[512];
+  MJ_UNINITIALIZED wchar_t name[128];
+  MJ_UNINITIALIZED Allocation allocation;
+  allocation.pAddress = buffer;
+  allocation.numBytes = sizeof(buffer);
+  mj::StaticStringBuilder sb;
+
+  LONG64 elapsed = mj::max<LONG64>(mj::ThreadpoolGetTicks() - s_StartTicks, 1);
+  sb.Init(allocation);
+  sb.Append(L"Threadpool: peak queue depth ")
+      .AppendUInt64(static_cast<uint64_t>(::ReadAcquire(&s_MaxQueuedTasks)))
+      .Append(L", peak finished tasks waiting for the main thread ")
+      .AppendUInt64(static_cast<uint64_t>(::ReadAcquire(&s_MaxFinishedTasks)))
+      .Append(s_Config.deterministic ? L"" : L", busy");
+  for (uint32_t i = 0; i < s_Config.numThreads + s_Config.numIoThreads && !s_Config.deterministic; i++)
+  {
+    if (i == s_Config.numThreads)
+    {
+      sb.Append(L", IO busy");
+    }
+    LONG64 busyTicks = ::ReadNoFence64(&s_Workers[i].busyTicks);
+    sb.Append(L" ").AppendUInt64(static_cast<uint64_t>(busyTicks * 100 / elapsed)).Append(L"%");
+  }
+  ::OutputDebugStringW(sb.Append(L"\r\n").ToStringClosed().ptr);
+
+  ::AcquireSRWLockShared(&s_TaskTypeLock);
+  MJ_DEFER(::ReleaseSRWLockShared(&s_TaskTypeLock));
+
+  for (uint32_t i = 0; i < s_NumTaskTypes; i++)
+  {
+    const mj::detail::TaskTypeMetrics& metrics = s_TaskTypes[i];
+    sb.Clear();
+    sb.Append(L"Threadpool ");
+    if (metrics.pName)
+    {
+      sb.Append(mj::ThreadpoolGetTaskTypeName(metrics.pName, name, sizeof(name) / sizeof(*name)));
+    }
+    else
+    {
+      sb.Append(L"(other types)");
+    }
+    sb.Append(L": ").AppendUInt64(metrics.execute.Count()).Append(L" executed, p50/p99/max");
+    mj::ThreadpoolAppendLatency(sb, L" wait ", metrics.wait);
+    mj::ThreadpoolAppendLatency(sb, L", execute ", metrics.execute);
+    mj::ThreadpoolAppendLatency(sb, L", done ", metrics.done);
+    ::OutputDebugStringW(sb.Append(L"\r\n").ToStringClosed().ptr);
+  }
+}
+
+void mj::ThreadpoolDestroy()
+{
+  mj::ThreadpoolReportMetrics();
+
+  // Workers finish the task they are executing, queued tasks are dropped
+  ::WriteRelease(&s_Running, FALSE);
+  static_cast<void>(::InterlockedIncrement(&s_WakeEpoch));
+  ::WakeByAddressAll(const_cast<LONG*>(&s_WakeEpoch));
+  static_cast<void>(::InterlockedIncrement(&s_IoWakeEpoch));
+  ::WakeByAddressAll(const_cast<LONG*>(&s_IoWakeEpoch));
+  static_cast<void>(::InterlockedIncrement(&s_TimerEpoch));
+  ::WakeByAddressAll(const_cast<LONG*>(&s_TimerEpoch));
+  if (s_IoPort)
+  {
+    static_cast<void>(::PostQueuedCompletionStatus(s_IoPort, 0, 0, nullptr));
+  }
+
+  // Join the threads before the port and the queues they use go away. None are started in deterministic mode.
+  MJ_UNINITIALIZED HANDLE threads[MJ_COUNTOF(s_Threads) + 2];
+  DWORD numThreads = 0;
+  for (uint32_t i = 0; i < MJ_COUNTOF(s_Threads); i++)
+  {
+    if (s_Threads[i])
+    {
+      threads[numThreads++] = s_Threads[i];
+      s_Threads[i]          = nullptr;
+    }
+  }
+  if (s_TimerThread)
+  {
+    threads[numThreads++] = s_TimerThread;
+  }
+  if (s_IoThread)
+  {
+    threads[numThreads++] = s_IoThread;
+  }
+  for (DWORD i = 0; i < numThreads; i += MAXIMUM_WAIT_OBJECTS)
+  {
+    DWORD count = mj::min<DWORD>(numThreads - i, MAXIMUM_WAIT_OBJECTS);
+    static_cast<void>(::WaitForMultipleObjects(count, threads + i, TRUE, INFINITE));
+  }
+  for (DWORD i = 0; i < numThreads; i++)
+  {
+    static_cast<void>(::CloseHandle(threads[i]));
+  }
+  s_TimerThread = nullptr;
+  s_IoThread    = nullptr;
+
+  if (s_IoPort)
+  {
+    static_cast<void>(::CloseHandle(s_IoPort));
+    s_IoPort = nullptr;
+  }
+}
+
+void mj::ThreadpoolSubmitTask(mj::Task* pTask)
+{
+  // Back-pressure: a task that submits faster than the workers keep up executes its tasks itself.
+  // IO tasks are always queued, so they never run on a compute worker.
+  if (pTask->kind != ETaskKind::IO && mj::ThreadpoolIsThrottled())
+  {
+    mj::ThreadpoolRunTask(pTask);
+    return;
+  }
+
+  mj::ThreadpoolPush(&pTask, 1);
+  mj::ThreadpoolWakeWorker(pTask->kind);
+}
+
+void mj::ThreadpoolSubmitBatch(mj::BatchTask* pBatch, size_t numItems, size_t grainSize)
+{
+  ZoneScoped;
+
+  // Back-pressure: one chunk per worker while throttled
+  size_t maxChunks = mj::ThreadpoolIsThrottled() ? s_Config.numThreads : MAX_BATCH_CHUNKS;
+  grainSize        = mj::max<size_t>(grainSize, 1);
+  size_t numChunks = (numItems + grainSize - 1) / grainSize;
+  if (numChunks > maxChunks)
+  {
+    grainSize = (numItems + maxChunks - 1) / maxChunks;
+    numChunks = (numItems + grainSize - 1) / grainSize;
+  }
+
+  pBatch->pChunks = nullptr;
+  if (numChunks == 0)
+  {
+    mj::ThreadpoolSubmitTask(pBatch);
+    return;
+  }
+
+  MJ_UNINITIALIZED mj::Task* chunks[MAX_BATCH_CHUNKS];
+  for (size_t i = 0; i < numChunks; i++)
+  {
+    auto* pChunk     = mj::ThreadpoolCreateTask<mj::detail::BatchChunkTask>();
+    pChunk->kind     = pBatch->kind;
+    pChunk->priority = pBatch->priority;
+    pChunk->token    = pBatch->token;
+    pChunk->pBatch   = pBatch;
+    pChunk->begin    = i * grainSize;
+    pChunk->end      = mj::min(pChunk->begin + grainSize, numItems);
+    chunks[i]        = pChunk;
+  }
+
+  // Linked in order, for ThreadpoolSetBatchPriority
+  for (size_t i = numChunks; i > 0; i--)
+  {
+    auto* pChunk       = static_cast<mj::detail::BatchChunkTask*>(chunks[i - 1]);
+    pChunk->pNextChunk = pBatch->pChunks;
+    pBatch->pChunks    = pChunk;
+  }
+
+  mj::ThreadpoolWhenAll(chunks, numChunks, pBatch);
+  mj::ThreadpoolPush(chunks, numChunks);
+  for (size_t i = 0; i < mj::min<size_t>(numChunks, mj::ThreadpoolGetPoolSize(pBatch->kind)); i++)
+  {
+    mj::ThreadpoolWakeWorker(pBatch->kind);
+  }
+}
+
+void mj::ThreadpoolSetBatchPriority(mj::BatchTask* pBatch, mj::ETaskPriority::Enum priority)
+{
+  pBatch->priority = priority;
+  for (mj::detail::BatchChunkTask* pChunk = pBatch->pChunks; pChunk; pChunk = pChunk->pNextChunk)
+  {
+    mj::ThreadpoolSetPriority(pChunk, priority);
+  }
+}
+
+void mj::detail::ParallelForTask::Execute()
+{
+  ZoneScoped;
+
+  // Split off the upper half until the range is small enough, idle workers steal the halves
+  while (this->end - this->begin > this->pJoin->grainSize)
+  {
+    auto* pTask = mj::ThreadpoolCreateTask<ParallelForTask>();
+    if (!pTask)
+    {
+      // Out of memory, the rest runs here
+      break;
+    }
+
+    size_t middle   = this->begin + (this->end - this->begin) / 2;
+    pTask->priority = this->priority;
+    pTask->pJoin    = this->pJoin;
+    pTask->begin    = middle;
+    pTask->end      = this->end;
+    this->end       = middle;
+
+    // This task is not done yet, so the join cannot start in between
+    mj::ThreadpoolThen(pTask, this->pJoin);
+    mj::ThreadpoolSubmitTask(pTask);
+  }
+
+  this->pJoin->pRange(this->pJoin->pFn, this->begin, this->end);
+
+  LONG64 numItems = static_cast<LONG64>(this->end - this->begin);
+  if (::InterlockedExchangeAdd64(&this->pJoin->numDone, numItems) + numItems ==
+      static_cast<LONG64>(this->pJoin->numItems))
+  {
+    ::WriteRelease(&this->pJoin->finished, TRUE);
+    ::WakeByAddressAll(const_cast<LONG*>(&this->pJoin->finished));
+  }
+}
+
+void mj::detail::ParallelFor(size_t begin, size_t end, size_t grainSize, const void* pFn, size_t fnSize,
+                             ParallelForRange pRange, mj::Task* pNext)
+{
+  ZoneScoped;
+
+  if (begin >= end)
+  {
+    if (pNext)
+    {
+      mj::ThreadpoolSubmitTask(pNext);
+    }
+    return;
+  }
+
+  // The join and the first range own each other's lifetime through the graph, so both are task contexts
+  auto* pJoin  = mj::ThreadpoolCreateTask<ParallelForJoin>();
+  auto* pFirst = mj::ThreadpoolCreateTask<ParallelForTask>();
+  MJ_EXIT_NULL(pJoin);
+  MJ_EXIT_NULL(pFirst);
+
+  pJoin->pRange   = pRange;
+  pJoin->pFn      = pFn;
+  pJoin->numItems = end - begin;
+  if (grainSize == 0)
+  {
+    // Enough ranges that all workers get some, even if some take longer than others
+    grainSize = pJoin->numItems / (8 * (s_Config.numThreads + 1));
+  }
+  pJoin->grainSize = mj::max<size_t>(grainSize, 1);
+
+  pFirst->pJoin = pJoin;
+  pFirst->begin = begin;
+  pFirst->end   = end;
+  mj::ThreadpoolThen(pFirst, pJoin);
+
+  if (pNext)
+  {
+    static_cast<void>(::memcpy(pJoin->fn, pFn, fnSize));
+    pJoin->pFn = pJoin->fn;
+    mj::ThreadpoolThen(pJoin, pNext);
+    mj::ThreadpoolSubmitTask(pFirst);
+    return;
+  }
+
+  // Blocking: the calling thread holds the join like a predecessor, so the join is not submitted, and cannot be
+  // ended by the main thread, while this thread still reads it
+  static_cast<void>(::InterlockedIncrement(&pJoin->numPending));
+
+  // The calling thread takes the first range. Ranges split off by the main thread go to the shared queue.
+  mj::ThreadpoolRunTask(pFirst);
+
+  auto* pWorker = static_cast<mj::detail::Worker*>(::TlsGetValue(s_WorkerTlsIndex));
+  for (;;)
+  {
+    LONG finished = ::ReadAcquire(&pJoin->finished);
+    if (finished)
+    {
+      break;
+    }
+
+    // Most likely ranges of this loop that no one stole yet
+    mj::Task* pTask = pWorker ? mj::ThreadpoolPopOwnTask(pWorker) : nullptr;
+    if (pTask)
+    {
+      mj::ThreadpoolRunTask(pTask);
+    }
+    else if (mj::ThreadpoolStep())
+    {
+      // Deterministic mode: there is no one else to run the ranges
+    }
+    else
+    {
+      ZoneScopedNC("ParallelFor wait", 0x21231C);
+      static_cast<void>(::WaitOnAddress(&pJoin->finished, &finished, sizeof(finished), INFINITE));
+    }
+  }
+
+  // Whoever lets go of the join last submits it, this thread or the last range to finish
+  if (::InterlockedDecrement(&pJoin->numPending) == 0)
+  {
+    mj::ThreadpoolSubmitTask(pJoin);
+  }
+}
+
+void mj::ThreadpoolSetPriority(mj::Task* pTask, mj::ETaskPriority::Enum priority)
+{
+  if (pTask->priority == priority)
+  {
+    return;
+  }
+
+  // Not in the lane while it moves, so a worker cannot take it twice
+  mj::detail::TaskQueue* pLanes = pTask->kind == ETaskKind::IO ? s_IoQueues : s_InjectQueues;
+  if (pLanes[pTask->priority].Remove(pTask))
+  {
+    pTask->priority = priority;
+    pLanes[priority].Push(&pTask, 1);
+    ThreadpoolWakeWorker(pTask->kind);
+  }
+  else
+  {
+    pTask->priority = priority;
+  }
+}
+
+namespace mj
+{
+  /// <summary>
+  /// Same lanes in the same order as ThreadpoolFindTask, the compute lane of a priority before its IO lane.
+  /// The task within a lane is picked at random.
+  /// </summary>
+  static Task* ThreadpoolTakeStepTask()
+  {
+    Task* pTask = nullptr;
+    if ((s_NumSteps + 1) % BACKGROUND_INTERVAL == 0)
+    {
+      pTask = s_InjectQueues[ETaskPriority::Background].PopRandom(s_StepRng);
+      if (!pTask)
+      {
+        pTask = s_IoQueues[ETaskPriority::Background].PopRandom(s_StepRng);
+      }
+    }
+    for (uint32_t priority = 0; !pTask && priority < NUM_PRIORITIES; priority++)
+    {
+      pTask = s_InjectQueues[priority].PopRandom(s_StepRng);
+      if (!pTask)
+      {
+        pTask = s_IoQueues[priority].PopRandom(s_StepRng);
+      }
+    }
+    return pTask;
+  }
+} // namespace mj
+
+bool mj::ThreadpoolStep()
+{
+  if (!s_Config.deterministic)
+  {
+    return false;
+  }
+
+  DWORD timeout   = mj::ThreadpoolFireTimers();
+  mj::Task* pTask = mj::ThreadpoolTakeStepTask();
+  while (!pTask && timeout != INFINITE)
+  {
+    // Nothing else to do until the next slot with tasks, which can be due in a later round
+    s_VirtualTicks += static_cast<LONG64>(timeout) * 1000;
+    timeout = mj::ThreadpoolFireTimers();
+    pTask   = mj::ThreadpoolTakeStepTask();
+  }
+
+  if (!pTask)
+  {
+    return false;
+  }
+
+  s_NumSteps++;
+  s_VirtualTicks++;
+  mj::ThreadpoolRunTask(pTask);
+  return true;
+}
+
+size_t mj::ThreadpoolRunUntilIdle()
+{
+  // Steps taken by blocking loops count too
+  uint32_t firstStep = s_NumSteps;
+  while (mj::ThreadpoolStep())
+  {
+  }
+  return s_NumSteps - firstStep;
+}
+
+void mj::ThreadpoolAdvanceTime(uint64_t microseconds)
+{
+  s_VirtualTicks += static_cast<LONG64>(microseconds);
+}
+
+bool mj::ThreadpoolIsDeterministic()
+{
+  return s_Config.deterministic;
+}
+
+uint64_t mj::detail::ThreadpoolGetTimerTime()
+{
+  uint64_t ticks = static_cast<uint64_t>(mj::ThreadpoolGetTicks() - s_StartTicks);
+  return ticks * 1000 / static_cast<uint64_t>(s_TicksPerSecond);
+}
+
+void mj::detail::ThreadpoolSubmitAt(mj::Task* pTask, uint64_t due)
+{
+  bool wake = false;
+  {
+    ::AcquireSRWLockExclusive(&s_TimerLock);
+    MJ_DEFER(::ReleaseSRWLockExclusive(&s_TimerLock));
+
+    // A task that is already due goes to the next slot the wheel checks
+    uint64_t time           = mj::max(due, s_TimerTime + 1);
+    mj::Task** ppSlot       = &s_TimerSlots[time % TIMER_WHEEL_SIZE];
+    pTask->timestamp        = static_cast<LONG64>(due);
+    pTask->pNextPredecessor = *ppSlot;
+    *ppSlot                 = pTask;
+
+    if (time < s_TimerWakeTime)
+    {
+      s_TimerWakeTime = time;
+      wake            = true;
+    }
+  }
+
+  if (wake)
+  {
+    static_cast<void>(::InterlockedIncrement(&s_TimerEpoch));
+    ::WakeByAddressSingle(const_cast<LONG*>(&s_TimerEpoch));
+  }
+}
+
+void mj::ThreadpoolSubmitAfter(mj::Task* pTask, uint32_t delayMs)
+{
+  if (delayMs == 0)
+  {
+    mj::ThreadpoolSubmitTask(pTask);
+    return;
+  }
+
+  // The timer time is rounded down, so one more tick keeps the task from running early
+  mj::detail::ThreadpoolSubmitAt(pTask, mj::detail::ThreadpoolGetTimerTime() + delayMs + 1);
+}
+
+HANDLE mj::ThreadpoolOpenFile(const wchar_t* pPath, DWORD access, DWORD creationDisposition)
+{
+  ZoneScoped;
+
+  HANDLE file = ::CreateFileW(pPath, access, FILE_SHARE_READ, nullptr, creationDisposition,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+  if (file == INVALID_HANDLE_VALUE || s_Config.deterministic)
+  {
+    return file;
+  }
+
+  // Transfers that complete right away are queued by ThreadpoolSubmitFileIo, without a completion packet
+  MJ_ERR_IF(::CreateIoCompletionPort(file, s_IoPort, 0, 0), nullptr);
+  MJ_ERR_ZERO(::SetFileCompletionNotificationModes(file, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS |
+                                                             FILE_SKIP_SET_EVENT_ON_HANDLE));
+  return file;
+}
+
+void mj::ThreadpoolSubmitFileIo(mj::FileIoTask** ppTasks, size_t numTasks)
+{
+  ZoneScoped;
+
+  MJ_UNINITIALIZED mj::Task* completed[FILE_IO_BATCH_SIZE];
+  size_t numCompleted = 0;
+  for (size_t i = 0; i < numTasks; i++)
+  {
+    mj::FileIoTask* pTask        = ppTasks[i];
+    pTask->numTransferred        = 0;
+    pTask->error                 = ERROR_OPERATION_ABORTED;
+    pTask->overlapped            = {};
+    pTask->overlapped.Offset     = static_cast<DWORD>(pTask->offset);
+    pTask->overlapped.OffsetHigh = static_cast<DWORD>(pTask->offset >> 32);
+
+    // A cancelled task is queued as it is, and ended without executing
+    if (!pTask->token.IsCancelled())
+    {
+      MJ_UNINITIALIZED BOOL done;
+      if (pTask->write)
+      {
+        done = ::WriteFile(pTask->file, pTask->pBuffer, pTask->numBytes, nullptr, &pTask->overlapped);
+      }
+      else
+      {
+        done = ::ReadFile(pTask->file, pTask->pBuffer, pTask->numBytes, nullptr, &pTask->overlapped);
+      }
+
+      DWORD error = done ? ERROR_SUCCESS : ::GetLastError();
+      if (error == ERROR_IO_PENDING && !s_Config.deterministic)
+      {
+        // The completion thread queues it, and it can end before this returns
+        continue;
+      }
+
+      if (error == ERROR_SUCCESS || error == ERROR_IO_PENDING)
+      {
+        mj::ThreadpoolFinishFileIo(pTask, error == ERROR_IO_PENDING);
+      }
+      else
+      {
+        pTask->error = error;
+      }
+    }
+
+    completed[numCompleted++] = pTask;
+    if (numCompleted == FILE_IO_BATCH_SIZE)
+    {
+      mj::ThreadpoolPushFileIo(completed, numCompleted);
+      numCompleted = 0;
+    }
+  }
+
+  mj::ThreadpoolPushFileIo(completed, numCompleted);
 }
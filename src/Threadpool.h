@@ -1,5 +1,6 @@
 #pragma once
 #include "ErrorExit.h"
+#include "mj_common.h"
 
 namespace mj
 {
@@ -9,14 +10,83 @@ namespace mj
   struct alignas(256) TaskContext
   {
     /// <summary>
-    /// (Internal) Pointer to next available TaskContext node
+    /// (Internal) Index of the next available TaskContext
     /// </summary>
-    TaskContext* pNextFreeNode;
+    uint32_t nextFree;
   };
 #pragma warning(pop)
 
   struct Task;
 
+  /// <summary>
+  /// Picks the pool that runs a task. A task type can declare its kind as a trait, see ThreadpoolCreateTask.
+  /// </summary>
+  struct ETaskKind
+  {
+    enum Enum : uint8_t
+    {
+      Compute,
+      IO, // Mostly waits on the file system. Runs on IO workers, so a slow disk never holds up compute tasks.
+    };
+  };
+
+  /// <summary>
+  /// Workers take tasks from the highest priority lane that has any. Each pool has lanes of its own.
+  /// </summary>
+  struct ETaskPriority
+  {
+    enum Enum : uint8_t
+    {
+      Interactive, // The user is waiting for it, e.g. rows in view
+      VisibleSoon, // Likely needed next, e.g. rows just outside the view
+      Background,  // Only gets a small share of the workers while there is other work
+      Count,
+    };
+  };
+
+  class CancellationSource;
+
+  /// <summary>
+  /// Cheap to poll from Execute. A default token is never cancelled.
+  /// </summary>
+  struct CancellationToken
+  {
+    const CancellationSource* pSource = nullptr;
+    LONG generation                   = 0;
+
+    bool IsCancelled() const;
+  };
+
+  /// <summary>
+  /// Cancels a group of tasks at once, e.g. everything started for one navigation.
+  /// Must outlive the tasks that hold its tokens.
+  /// </summary>
+  class CancellationSource
+  {
+  private:
+    friend struct CancellationToken;
+    volatile LONG generation = 0;
+
+  public:
+    CancellationToken GetToken() const
+    {
+      return CancellationToken{ this, ::ReadAcquire(&this->generation) };
+    }
+
+    /// <summary>
+    /// Cancels every token handed out so far. Tokens handed out later are not cancelled.
+    /// </summary>
+    void Cancel()
+    {
+      static_cast<void>(::InterlockedIncrement(&this->generation));
+    }
+  };
+
+  inline bool CancellationToken::IsCancelled() const
+  {
+    return this->pSource && ::ReadAcquire(&this->pSource->generation) != this->generation;
+  }
+
   class ITaskCompletionHandler
   {
   public:
@@ -29,7 +99,8 @@ namespace mj
   struct Task
   {
     /// <summary>
-    /// Called from a threadpool thread.
+    /// Called from a threadpool thread. Long loops should poll token.IsCancelled().
+    /// Not called if the token was cancelled before the task started, so Destroy must handle that.
     /// </summary>
     virtual void Execute() = 0;
 
@@ -37,6 +108,8 @@ namespace mj
     /// Called in the main thread when the task is done.
     /// Do not use this method to clean up resources, as it doesn't get called when
     /// this task is cancelled. Use Destroy instead.
+    /// A task with a continuation is done when the last task of its graph is done.
+    /// Its OnDone is called before the OnDone of its continuation.
     /// </summary>
     virtual void OnDone()
     {
@@ -52,42 +125,580 @@ namespace mj
       // Optional
     }
 
+    // Ordered so the task fields leave most of a TaskContext to the derived task
+
     ITaskCompletionHandler* pHandler;
-    bool cancelled;
+    CancellationToken token; // Queued tasks with a cancelled token are ended without executing them
+
+    // Task graph, see ThreadpoolThen
+    Task* pContinuation;          // Submitted by the last predecessor to finish
+    Task* volatile pPredecessors; // Finished predecessors, kept alive until this task ends
+    Task* pNextPredecessor;       // Next in the pPredecessors list of pContinuation, or in a timer slot
+    volatile LONG numPending;     // Predecessors that have not finished yet
+
+    ETaskKind::Enum kind;         // Compute unless set before submitting
+    ETaskPriority::Enum priority; // Interactive unless set before submitting, see ThreadpoolSetPriority
+    bool cancelled;               // Cancelling any task of a graph cancels the whole graph
+    uint8_t sizeClass;            // (Internal) Storage the task was allocated from
+    uint16_t type;                // (Internal) Metrics slot of the task type, see ThreadpoolReportMetrics
+    LONG64 timestamp;             // (Internal) When it was queued, then when it finished executing. Zero if neither.
+  };
+
+  /// <summary>
+  /// Largest task ThreadpoolCreateTask accepts. Tasks that fit a TaskContext are the cheapest to create.
+  /// </summary>
+  static constexpr const size_t MAX_TASK_SIZE = 4096;
+
+  /// <summary>
+  /// Zero means: derive from the hardware.
+  /// </summary>
+  struct ThreadpoolConfig
+  {
+    uint32_t numThreads   = 0;     // Compute workers. Default: one per logical processor, minus the main thread
+    uint32_t numIoThreads = 0;     // IO workers, in addition. Default: half the compute workers
+    bool pinThreads       = false; // One logical processor per compute worker, physical cores before SMT siblings
+    bool numaAware        = false; // Spread workers over NUMA nodes, steal from the same node first
+    bool deterministic    = false; // No workers: tasks run in ThreadpoolStep, in an order picked with the seed
+    uint32_t seed         = 0;     // Deterministic mode only
+  };
+
+  struct ThreadpoolTopology
+  {
+    uint32_t numLogicalProcessors;
+    uint32_t numCores;
+    uint32_t numPackages;
+    uint32_t numNumaNodes;
   };
 
   namespace detail
   {
+    /// <summary>
+    /// Task storage: a TaskContext, or a pooled block for larger tasks.
+    /// </summary>
+    static constexpr const size_t TASK_SIZE_CLASSES[] = { sizeof(TaskContext), 1024, MAX_TASK_SIZE };
+    static constexpr const uint8_t NUM_TASK_SIZE_CLASSES = 3;
+
+    constexpr uint8_t GetTaskSizeClass(size_t size)
+    {
+      uint8_t sizeClass = 0;
+      while (size > TASK_SIZE_CLASSES[sizeClass])
+      {
+        sizeClass++;
+      }
+      return sizeClass;
+    }
+
     TaskContext* ThreadpoolAllocTaskContext();
-  }
+
+    /// <summary>
+    /// Tasks that do not fit a TaskContext. Returns nullptr only when out of memory.
+    /// </summary>
+    void* ThreadpoolAllocLargeTask(uint8_t sizeClass);
+
+    /// <summary>
+    /// Untyped storage from the task size classes, e.g. for coroutine frames.
+    /// Sizes above MAX_TASK_SIZE come from the heap. Returns nullptr only when out of memory.
+    /// </summary>
+    void* ThreadpoolAllocStorage(size_t size);
+    void ThreadpoolFreeStorage(void* pStorage, size_t size);
+
+    template <class T>
+    void* ThreadpoolAllocTask()
+    {
+      static_assert(sizeof(T) <= MAX_TASK_SIZE);
+      static_assert(std::is_base_of<Task, T>::value);
+
+      constexpr uint8_t sizeClass = GetTaskSizeClass(sizeof(T));
+      if constexpr (sizeClass == 0)
+      {
+        return ThreadpoolAllocTaskContext();
+      }
+      else
+      {
+        return ThreadpoolAllocLargeTask(sizeClass);
+      }
+    }
+
+    /// <summary>
+    /// Task types get a metrics slot the first time a task of the type is created, without RTTI.
+    /// </summary>
+    template <class T>
+    struct TaskType
+    {
+      static inline volatile LONG slot = 0; // Slot + 1, zero until registered
+
+      static const char* GetName()
+      {
+#ifdef _MSC_VER
+        return __FUNCSIG__;
+#else
+        return __PRETTY_FUNCTION__;
+#endif
+      }
+    };
+
+    /// <summary>
+    /// The last slot is shared by the types beyond the number of slots, and reported as "(other types)".
+    /// </summary>
+    uint16_t ThreadpoolRegisterTaskType(volatile LONG* pSlot, const char* pName);
+
+    template <class T>
+    uint16_t GetTaskType()
+    {
+      LONG slot = ::ReadAcquire(&TaskType<T>::slot);
+      if (slot != 0)
+      {
+        return static_cast<uint16_t>(slot - 1);
+      }
+      return ThreadpoolRegisterTaskType(&TaskType<T>::slot, TaskType<T>::GetName());
+    }
+
+    /// <summary>
+    /// The TASK_KIND of a task type, Compute if it does not declare one.
+    /// </summary>
+    template <class T>
+    constexpr ETaskKind::Enum GetTaskKind()
+    {
+      if constexpr (requires { T::TASK_KIND; })
+      {
+        return T::TASK_KIND;
+      }
+      else
+      {
+        return ETaskKind::Compute;
+      }
+    }
+
+    inline void ThreadpoolInitTask(Task* pTask, ITaskCompletionHandler* pHandler, uint8_t sizeClass, uint16_t type)
+    {
+      pTask->pHandler         = pHandler;
+      pTask->kind             = ETaskKind::Compute;
+      pTask->priority         = ETaskPriority::Interactive;
+      pTask->cancelled        = false;
+      pTask->sizeClass        = sizeClass;
+      pTask->token            = CancellationToken();
+      pTask->pContinuation    = nullptr;
+      pTask->pPredecessors    = nullptr;
+      pTask->pNextPredecessor = nullptr;
+      pTask->numPending       = 0;
+      pTask->type             = type;
+      pTask->timestamp        = 0;
+    }
+
+    /// <summary>
+    /// A lambda and its captures, stored in the task itself.
+    /// </summary>
+    template <typename Fn>
+    struct LambdaTask : public Task
+    {
+      Fn fn;
+
+      LambdaTask(const Fn& fn) : fn(fn)
+      {
+      }
+
+      virtual void Execute() override
+      {
+        this->fn();
+      }
+
+      virtual void Destroy() override
+      {
+        this->fn.~Fn();
+      }
+    };
+
+    struct BatchChunkTask;
+
+    /// <summary>
+    /// Calls the function of a parallel loop for a range of indices.
+    /// </summary>
+    using ParallelForRange = void (*)(const void* pFn, size_t begin, size_t end);
+
+    /// <summary>
+    /// Functions of asynchronous parallel loops are copied into a task context.
+    /// </summary>
+    static constexpr const size_t PARALLEL_FOR_MAX_FN_SIZE = 128;
+
+    /// <param name="fnSize">Only used by asynchronous loops</param>
+    /// <param name="pNext">nullptr for a blocking loop</param>
+    void ParallelFor(size_t begin, size_t end, size_t grainSize, const void* pFn, size_t fnSize,
+                     ParallelForRange pRange, Task* pNext);
+  } // namespace detail
+
+  /// <summary>
+  /// Many small work items, executed in chunks by any number of workers.
+  /// OnDone is called once, after all items have executed, so the main thread gets one message per batch.
+  /// </summary>
+  struct BatchTask : public Task
+  {
+    /// <summary>
+    /// Called from threadpool threads, concurrently for different ranges of items.
+    /// </summary>
+    virtual void ExecuteRange(size_t begin, size_t end) = 0;
+
+    /// <summary>
+    /// Called after all items have executed.
+    /// </summary>
+    virtual void Execute() override
+    {
+      // Optional
+    }
+
+    detail::BatchChunkTask* pChunks; // Set by ThreadpoolSubmitBatch
+  };
 
   /// <summary>
   /// Initializes the threadpool system.
   /// </summary>
   /// <param name="threadId">Thread ID of the window message queue</param>
-  /// <param name="userMessage">The message to send. Should be WM_USER + some number.</param>
-  void ThreadpoolInit(DWORD threadId, UINT userMessage);
+  /// <param name="userMessage">
+  /// Posted when tasks finish while none were waiting, call ThreadpoolEndTasks. Should be WM_USER + some number.
+  /// </param>
+  void ThreadpoolInit(DWORD threadId, UINT userMessage, const ThreadpoolConfig& config = ThreadpoolConfig());
 
+  /// <summary>
+  /// Processors as detected by ThreadpoolInit.
+  /// </summary>
+  const ThreadpoolTopology& ThreadpoolGetTopology();
+  uint32_t ThreadpoolGetNumThreads();
+
+  /// <summary>
+  /// Tasks up to sizeof(TaskContext) come from the task context slab, larger ones up to MAX_TASK_SIZE from pools.
+  /// The kind is taken from the task type, e.g. static constexpr const ETaskKind::Enum TASK_KIND = ETaskKind::IO.
+  /// </summary>
   template <class T>
   T* ThreadpoolCreateTask(ITaskCompletionHandler* pHandler = nullptr)
   {
-    static_assert(sizeof(T) <= sizeof(TaskContext));
-    static_assert(std::is_base_of<Task, T>::value);
-
-    TaskContext* pContext = detail::ThreadpoolAllocTaskContext();
-    T* pTask              = nullptr;
+    void* pStorage = detail::ThreadpoolAllocTask<T>();
+    T* pTask       = nullptr;
 
-    if (pContext)
+    if (pStorage)
     {
-      pTask            = new (pContext) T;
-      pTask->pHandler  = pHandler;
-      pTask->cancelled = false;
+      pTask = new (pStorage) T;
+      detail::ThreadpoolInitTask(pTask, pHandler, detail::GetTaskSizeClass(sizeof(T)), detail::GetTaskType<T>());
+      pTask->kind = detail::GetTaskKind<T>();
     }
 
     return pTask;
   }
 
+  /// <summary>
+  /// Called by the main thread for the last task of a graph. Ends its predecessors first.
+  /// </summary>
   void ThreadpoolTaskEnd(Task* pTask);
+
+  /// <summary>
+  /// Called by the main thread for the user message: ends finished tasks in the order they finished, OnDone
+  /// included, until the budget is spent. At least one task is ended per call.
+  /// </summary>
+  /// <returns>True if finished tasks are left, e.g. to end them after pending input and paint messages</returns>
+  bool ThreadpoolEndTasks(uint32_t budgetMicroseconds);
+
+  /// <summary>
+  /// Runs pNext on a worker after pTask has executed, without a round trip through the main thread.
+  /// pNext can read the results of pTask: predecessors are not ended until pNext ends.
+  /// pNext runs on the pool of its own kind, so this also hands the results of an IO task to a compute task.
+  /// A task has at most one continuation. Call before submitting pTask, and do not submit pNext.
+  /// </summary>
+  void ThreadpoolThen(Task* pTask, Task* pNext);
+
+  /// <summary>
+  /// Runs pNext on a worker after all tasks have executed. Same rules as ThreadpoolThen.
+  /// </summary>
+  void ThreadpoolWhenAll(Task** ppTasks, size_t numTasks, Task* pNext);
+
+  /// <summary>
+  /// Queues a task. Tasks submitted from the main thread go to a shared queue.
+  /// Tasks submitted from Execute stay with the worker that submitted them, idle workers steal them.
+  /// </summary>
   void ThreadpoolSubmitTask(Task* pTask);
+
+  /// <summary>
+  /// Runs fn() on a worker. The captures are stored in the task, so they must fit MAX_TASK_SIZE.
+  /// There is no OnDone, submit a task for that.
+  /// </summary>
+  /// <returns>False if out of memory</returns>
+  template <typename Fn>
+  bool ThreadpoolSubmit(const Fn& fn, ETaskPriority::Enum priority = ETaskPriority::Interactive)
+  {
+    using T        = detail::LambdaTask<Fn>;
+    void* pStorage = detail::ThreadpoolAllocTask<T>();
+    if (!pStorage)
+    {
+      return false;
+    }
+
+    T* pTask = new (pStorage) T(fn);
+    detail::ThreadpoolInitTask(pTask, nullptr, detail::GetTaskSizeClass(sizeof(T)), detail::GetTaskType<T>());
+    pTask->priority = priority;
+    ThreadpoolSubmitTask(pTask);
+    return true;
+  }
+
+  namespace detail
+  {
+    /// <summary>
+    /// Milliseconds since ThreadpoolInit, the clock of the timer wheel. Virtual in deterministic mode.
+    /// </summary>
+    uint64_t ThreadpoolGetTimerTime();
+
+    /// <summary>
+    /// Queues a task when the timer time reaches due.
+    /// </summary>
+    void ThreadpoolSubmitAt(Task* pTask, uint64_t due);
+
+    template <typename Fn>
+    struct PeriodicTask : public LambdaTask<Fn>
+    {
+      MJ_UNINITIALIZED uint64_t due;    // Timer time of this run
+      MJ_UNINITIALIZED uint32_t period; // Milliseconds
+
+      PeriodicTask(const Fn& fn) : LambdaTask<Fn>(fn)
+      {
+      }
+
+      virtual void Execute() override;
+    };
+
+    template <typename Fn>
+    bool ThreadpoolSubmitPeriodicAt(const Fn& fn, uint32_t periodMs, uint64_t due, const CancellationToken& token,
+                                    ETaskPriority::Enum priority)
+    {
+      using T        = PeriodicTask<Fn>;
+      void* pStorage = ThreadpoolAllocTask<T>();
+      if (!pStorage)
+      {
+        return false;
+      }
+
+      T* pTask = new (pStorage) T(fn);
+      ThreadpoolInitTask(pTask, nullptr, GetTaskSizeClass(sizeof(T)), GetTaskType<T>());
+      pTask->priority = priority;
+      pTask->token    = token;
+      pTask->due      = due;
+      pTask->period   = periodMs;
+      ThreadpoolSubmitAt(pTask, due);
+      return true;
+    }
+
+    template <typename Fn>
+    void PeriodicTask<Fn>::Execute()
+    {
+      this->fn();
+
+      // The next run is a task of its own, this one ends as usual. Periods that were missed entirely are skipped.
+      uint64_t due = this->due + this->period;
+      uint64_t now = ThreadpoolGetTimerTime();
+      if (due <= now)
+      {
+        due = now + this->period;
+      }
+      if (!this->token.IsCancelled())
+      {
+        bool submitted = ThreadpoolSubmitPeriodicAt(this->fn, this->period, due, this->token, this->priority);
+        MJ_EXIT_NULL(submitted);
+      }
+    }
+  } // namespace detail
+
+  /// <summary>
+  /// Queues a task after at least delayMs milliseconds. The timer thread wakes at the resolution of the system timer.
+  /// Thousands of waiting tasks are cheap: they wait in a timer wheel, without a kernel timer each.
+  /// A task whose token is cancelled while it waits is ended without being queued.
+  /// </summary>
+  void ThreadpoolSubmitAfter(Task* pTask, uint32_t delayMs);
+
+  /// <summary>
+  /// Runs fn() on a worker every periodMs milliseconds, until the token is cancelled.
+  /// Every run is a task of its own, submitted when the previous run returns, so runs never overlap.
+  /// </summary>
+  /// <returns>False if out of memory</returns>
+  template <typename Fn>
+  bool ThreadpoolSubmitPeriodic(const Fn& fn, uint32_t periodMs, const CancellationToken& token,
+                                ETaskPriority::Enum priority = ETaskPriority::Interactive)
+  {
+    uint32_t period = mj::max<uint32_t>(periodMs, 1);
+    return detail::ThreadpoolSubmitPeriodicAt(fn, period, detail::ThreadpoolGetTimerTime() + period, token, priority);
+  }
+
+  /// <summary>
+  /// Coalesces bursts of events, e.g. typing or resizing: every Submit cancels the task submitted before it, so only
+  /// the last task of a burst executes, delayMs after the last event. A replaced task that is still waiting is ended
+  /// without being queued, one that is executing sees its token cancelled.
+  /// Sets the tokens of the tasks, and must outlive them.
+  /// </summary>
+  class Debouncer
+  {
+  private:
+    CancellationSource source;
+
+  public:
+    void Submit(Task* pTask, uint32_t delayMs)
+    {
+      this->source.Cancel();
+      pTask->token = this->source.GetToken();
+      ThreadpoolSubmitAfter(pTask, delayMs);
+    }
+
+    /// <summary>
+    /// Cancels the last task, e.g. when the panel it would update goes away.
+    /// </summary>
+    void Cancel()
+    {
+      this->source.Cancel();
+    }
+  };
+
+  /// <summary>
+  /// Splits the items of a batch into chunks of at least grainSize items, and queues them with one queue operation.
+  /// The chunks get the kind, priority and token of the batch. Do not submit the batch itself.
+  /// </summary>
+  void ThreadpoolSubmitBatch(BatchTask* pBatch, size_t numItems, size_t grainSize);
+
+  /// <summary>
+  /// Changes the priority of a task submitted from the main thread, e.g. when the user scrolls.
+  /// A task that is still queued moves to the new lane, behind the tasks already in it.
+  /// A task that a worker already took keeps its place.
+  /// </summary>
+  void ThreadpoolSetPriority(Task* pTask, ETaskPriority::Enum priority);
+
+  /// <summary>
+  /// ThreadpoolSetPriority for a batch submitted from the main thread, and all of its chunks.
+  /// </summary>
+  void ThreadpoolSetBatchPriority(BatchTask* pBatch, ETaskPriority::Enum priority);
+
+  /// <summary>
+  /// A read or write of a file opened with ThreadpoolOpenFile. The transfer runs in the kernel, no worker waits for
+  /// it: the task is queued like any other once it has completed, and Execute continues with the data.
+  /// Submit it with ThreadpoolSubmitFileIo. A task whose token is already cancelled is ended without a transfer.
+  /// </summary>
+  struct FileIoTask : public Task
+  {
+    HANDLE file;
+    uint64_t offset;
+    void* pBuffer; // Must stay valid until the task executes
+    DWORD numBytes;
+    bool write;
+
+    DWORD numTransferred; // Set before Execute
+    DWORD error;          // Set before Execute: ERROR_SUCCESS, or e.g. ERROR_HANDLE_EOF for a read past the end
+
+    OVERLAPPED overlapped; // (Internal)
+  };
+
+  /// <summary>
+  /// Opens a file for ThreadpoolSubmitFileIo, and associates it with the completion port of the threadpool.
+  /// Close it with CloseHandle once none of its transfers is in flight.
+  /// </summary>
+  /// <param name="access">GENERIC_READ and/or GENERIC_WRITE</param>
+  /// <param name="creationDisposition">As for CreateFileW, e.g. OPEN_EXISTING</param>
+  /// <returns>INVALID_HANDLE_VALUE on failure, see GetLastError</returns>
+  HANDLE ThreadpoolOpenFile(const wchar_t* pPath, DWORD access, DWORD creationDisposition);
+
+  /// <summary>
+  /// Starts the transfers of a batch of tasks, e.g. all the blocks of a file. A single completion thread collects
+  /// finished transfers in batches and queues their tasks with one queue operation per lane.
+  /// Transfers that complete right away are queued from here, without a round trip through the completion port.
+  /// In deterministic mode every transfer completes before this returns, so the steps keep their order.
+  /// </summary>
+  void ThreadpoolSubmitFileIo(FileIoTask** ppTasks, size_t numTasks);
+
+  inline void ThreadpoolSubmitFileIo(FileIoTask* pTask)
+  {
+    ThreadpoolSubmitFileIo(&pTask, 1);
+  }
+
+  /// <summary>
+  /// Writes the metrics collected since ThreadpoolInit to the debug output: per worker the share of time spent
+  /// executing tasks, the peak queue depth, and per task type the percentiles of the time from submit to start
+  /// (wait), start to end (execute) and end to OnDone (done). Also called by ThreadpoolDestroy.
+  /// </summary>
+  void ThreadpoolReportMetrics();
   void ThreadpoolDestroy();
+
+  /// <summary>
+  /// Deterministic mode: runs one queued task on the calling thread, which should be the main thread.
+  /// If no task is queued, the virtual time jumps to the first waiting timer.
+  /// Lanes are checked in the order workers check them, and the task within a lane is picked with the seed,
+  /// so the same seed and the same submissions give the same order. numThreads is still used to size batches
+  /// and loops, set it to get the same order on every machine. A task without a continuation ends right after
+  /// it executes, OnDone included, instead of going through the message loop.
+  /// Every step moves the virtual time forward by a microsecond.
+  /// </summary>
+  /// <returns>False if no task is queued or waiting, or if the threadpool is not deterministic</returns>
+  bool ThreadpoolStep();
+
+  /// <summary>
+  /// Deterministic mode: steps until no task is queued or waiting, including the tasks submitted by the steps.
+  /// A periodic task keeps it stepping until its token is cancelled.
+  /// </summary>
+  /// <returns>Number of steps</returns>
+  size_t ThreadpoolRunUntilIdle();
+
+  /// <summary>
+  /// Deterministic mode: the metrics use a virtual clock in microseconds, which only moves with the steps and this.
+  /// </summary>
+  void ThreadpoolAdvanceTime(uint64_t microseconds);
+  bool ThreadpoolIsDeterministic();
+
+  /// <summary>
+  /// Calls fn(i) for every i in [begin, end), on the threadpool and the calling thread.
+  /// Ranges of more than grainSize indices are split in half, and idle workers steal the halves.
+  /// A grainSize of 0 picks one from the number of workers.
+  /// Returns when all calls have returned. Called from a task, the worker runs its own queued tasks while it waits.
+  /// </summary>
+  template <typename Fn>
+  void ParallelFor(size_t begin, size_t end, size_t grainSize, const Fn& fn)
+  {
+    detail::ParallelFor(begin, end, grainSize, &fn, sizeof(Fn), //
+                        [](const void* pFn, size_t rangeBegin, size_t rangeEnd) {
+                          for (size_t i = rangeBegin; i < rangeEnd; i++)
+                          {
+                            (*static_cast<const Fn*>(pFn))(i);
+                          }
+                        },
+                        nullptr);
+  }
+
+  /// <summary>
+  /// Asynchronous ParallelFor: returns right away, and submits pNext after all calls have returned.
+  /// pNext can be the first task of a graph, its OnDone is called on the main thread. Do not submit pNext.
+  /// fn is copied, so it must not capture anything by reference that goes out of scope.
+  /// </summary>
+  template <typename Fn>
+  void ParallelFor(size_t begin, size_t end, size_t grainSize, const Fn& fn, Task* pNext)
+  {
+    static_assert(sizeof(Fn) <= detail::PARALLEL_FOR_MAX_FN_SIZE);
+    static_assert(std::is_trivially_copyable<Fn>::value);
+
+    detail::ParallelFor(begin, end, grainSize, &fn, sizeof(Fn), //
+                        [](const void* pFn, size_t rangeBegin, size_t rangeEnd) {
+                          for (size_t i = rangeBegin; i < rangeEnd; i++)
+                          {
+                            (*static_cast<const Fn*>(pFn))(i);
+                          }
+                        },
+                        pNext);
+  }
+
+  /// <summary>
+  /// Calls fn(element) for every element of a view, see ParallelFor.
+  /// </summary>
+  template <typename T, typename Fn>
+  void ParallelForEach(ArrayListView<T> view, const Fn& fn)
+  {
+    T* pData = view.Get();
+    ParallelFor(0, view.Size(), 0, [pData, &fn](size_t i) { fn(pData[i]); });
+  }
+
+  /// <summary>
+  /// Asynchronous ParallelForEach, see ParallelFor. The elements must stay valid until pNext executes.
+  /// </summary>
+  template <typename T, typename Fn>
+  void ParallelForEach(ArrayListView<T> view, const Fn& fn, Task* pNext)
+  {
+    T* pData = view.Get();
+    ParallelFor(0, view.Size(), 0, [pData, fn](size_t i) { fn(pData[i]); }, pNext);
+  }
 } // namespace mj
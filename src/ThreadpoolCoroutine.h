@@ -0,0 +1,173 @@
+#pragma once
+#include <coroutine>
+#include "Threadpool.h"
+
+namespace mj
+{
+  namespace detail
+  {
+    /// <summary>
+    /// Resumes a coroutine on a worker, or on the main thread from OnDone.
+    /// If the task is cancelled instead, the coroutine is destroyed on the main thread.
+    /// </summary>
+    struct ResumeTask : public Task
+    {
+      std::coroutine_handle<> handle;
+      bool onMainThread = false;
+      bool resumed      = false; // Set before resuming: the task must not touch the coroutine afterwards
+
+      virtual void Execute() override
+      {
+        if (!this->onMainThread)
+        {
+          this->resumed = true;
+          this->handle.resume();
+        }
+      }
+
+      virtual void OnDone() override
+      {
+        if (this->onMainThread)
+        {
+          this->resumed = true;
+          this->handle.resume();
+        }
+      }
+
+      virtual void Destroy() override
+      {
+        if (!this->resumed)
+        {
+          this->handle.destroy();
+        }
+      }
+    };
+  } // namespace detail
+
+  /// <summary>
+  /// Return type of a coroutine that moves between the threadpool and the main thread with co_await ToPool()
+  /// and co_await ToMainThread(). Starts on the calling thread, and frees itself when it returns.
+  /// If one of its parameters is a CancellationToken, cancelling it destroys the coroutine at the next co_await,
+  /// on the main thread, instead of resuming it. Locals are destroyed either way, so MJ_DEFER can clean up.
+  /// </summary>
+  struct Async
+  {
+    struct promise_type
+    {
+      CancellationToken token; // Passed on to every hop
+
+      template <typename... Args>
+      promise_type(const Args&... args)
+      {
+        (this->SetToken(args), ...);
+      }
+
+      /// <summary>
+      /// Frames come from the task size classes.
+      /// </summary>
+      static void* operator new(size_t size) noexcept
+      {
+        return detail::ThreadpoolAllocStorage(size);
+      }
+
+      static void operator delete(void* pFrame, size_t size)
+      {
+        detail::ThreadpoolFreeStorage(pFrame, size);
+      }
+
+      /// <summary>
+      /// Out of memory: the coroutine does not run.
+      /// </summary>
+      static Async get_return_object_on_allocation_failure()
+      {
+        return Async();
+      }
+
+      Async get_return_object()
+      {
+        return Async();
+      }
+
+      std::suspend_never initial_suspend() noexcept
+      {
+        return {};
+      }
+
+      std::suspend_never final_suspend() noexcept
+      {
+        return {};
+      }
+
+      void return_void()
+      {
+      }
+
+      void unhandled_exception()
+      {
+        // Exceptions are disabled
+      }
+
+    private:
+      void SetToken(const CancellationToken& token)
+      {
+        this->token = token;
+      }
+
+      template <typename T>
+      void SetToken(const T&)
+      {
+        // Not a token
+      }
+    };
+  };
+
+  namespace detail
+  {
+    /// <summary>
+    /// Always suspends, so awaiting it also yields to other tasks.
+    /// </summary>
+    struct ThreadHop
+    {
+      ETaskPriority::Enum priority;
+      bool onMainThread;
+
+      bool await_ready() const noexcept
+      {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<Async::promise_type> handle)
+      {
+        auto* pTask = ThreadpoolCreateTask<ResumeTask>();
+        MJ_EXIT_NULL(pTask);
+        pTask->handle       = handle;
+        pTask->onMainThread = this->onMainThread;
+        pTask->priority     = this->priority;
+        pTask->token        = handle.promise().token;
+
+        // Can resume the coroutine right away on another thread, so this is the last use of the frame
+        ThreadpoolSubmitTask(pTask);
+      }
+
+      void await_resume() const noexcept
+      {
+      }
+    };
+  } // namespace detail
+
+  /// <summary>
+  /// Continues the coroutine on a worker.
+  /// </summary>
+  inline detail::ThreadHop ToPool(ETaskPriority::Enum priority = ETaskPriority::Interactive)
+  {
+    return detail::ThreadHop{ priority, false };
+  }
+
+  /// <summary>
+  /// Continues the coroutine on the main thread, like OnDone.
+  /// </summary>
+  inline detail::ThreadHop ToMainThread()
+  {
+    return detail::ThreadHop{ ETaskPriority::Interactive, true };
+  }
+} // namespace mj
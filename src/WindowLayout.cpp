@@ -266,8 +266,12 @@ static bool GetNextToken(LexerContext* pContext, Token* pToken)
   switch (pToken->tokenType)
   {
   case ETokenType::Number:
-    // This should always succeed
-    static_cast<void>(pToken->sv.ParseNumber(&pToken->number));
+    // The lexer only accepts digits here, so this can only fail on overflow
+    if (!pToken->sv.ParseNumber(&pToken->number))
+    {
+      ::OutputDebugStringW(L"== Number out of range ==\r\n");
+      return false;
+    }
     break;
   default:
     break;
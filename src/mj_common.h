@@ -84,6 +84,80 @@ namespace mj
     b   = c;
   }
 
+  /// <summary>
+  /// In-place unstable sort. Quicksort with median-of-three pivots,
+  /// insertion sort for small ranges. Recurses into the smaller half only.
+  /// </summary>
+  /// <param name="less">Strict weak ordering, called as less(a, b)</param>
+  template <typename T, typename Less>
+  void Sort(T* pBegin, T* pEnd, Less less)
+  {
+    while (pEnd - pBegin > 16)
+    {
+      // Median of three, moved to the front as the pivot
+      T* pMid  = pBegin + (pEnd - pBegin) / 2;
+      T* pLast = pEnd - 1;
+      if (less(*pMid, *pBegin))
+      {
+        swap(*pMid, *pBegin);
+      }
+      if (less(*pLast, *pBegin))
+      {
+        swap(*pLast, *pBegin);
+      }
+      if (less(*pLast, *pMid))
+      {
+        swap(*pLast, *pMid);
+      }
+      swap(*pBegin, *pMid);
+
+      T* pLeft  = pBegin + 1;
+      T* pRight = pLast;
+      while (true)
+      {
+        while (less(*pLeft, *pBegin))
+        {
+          pLeft++;
+        }
+        while (less(*pBegin, *pRight))
+        {
+          pRight--;
+        }
+        if (pLeft >= pRight)
+        {
+          break;
+        }
+        swap(*pLeft, *pRight);
+        pLeft++;
+        pRight--;
+      }
+      swap(*pBegin, *pRight);
+
+      if (pRight - pBegin < pEnd - (pRight + 1))
+      {
+        Sort(pBegin, pRight, less);
+        pBegin = pRight + 1;
+      }
+      else
+      {
+        Sort(pRight + 1, pEnd, less);
+        pEnd = pRight;
+      }
+    }
+
+    for (T* pIt = pBegin + 1; pIt < pEnd; pIt++)
+    {
+      T value  = *pIt;
+      T* pHole = pIt;
+      while (pHole > pBegin && less(value, *(pHole - 1)))
+      {
+        *pHole = *(pHole - 1);
+        pHole--;
+      }
+      *pHole = value;
+    }
+  }
+
   template <typename T>
   class ArrayListView;
 
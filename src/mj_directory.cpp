@@ -0,0 +1,154 @@
+#include "pch.h"
+#include "mj_directory.h"
+
+bool mj::DirectoryReader::Init(const wchar_t* pPath, AllocatorBase* pAllocator)
+{
+  ZoneScoped;
+
+  this->pAllocator = pAllocator;
+  this->pRecord    = nullptr;
+  this->pBuffer    = nullptr;
+
+  // Backup semantics is needed to open a folder, FILE_LIST_DIRECTORY is the only access it needs
+  this->hDirectory = ::CreateFileW(pPath,                                                  //
+                                   FILE_LIST_DIRECTORY,                                    //
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, //
+                                   nullptr,                                                //
+                                   OPEN_EXISTING,                                          //
+                                   FILE_FLAG_BACKUP_SEMANTICS,                             //
+                                   nullptr);
+  if (this->hDirectory == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  this->pBuffer = static_cast<BYTE*>(pAllocator->Allocate(BUFFER_SIZE));
+  if (!this->pBuffer)
+  {
+    ::SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return false;
+  }
+
+  return true;
+}
+
+void mj::DirectoryReader::Destroy()
+{
+  if (this->hDirectory != INVALID_HANDLE_VALUE)
+  {
+    static_cast<void>(::CloseHandle(this->hDirectory));
+    this->hDirectory = INVALID_HANDLE_VALUE;
+  }
+
+  if (this->pBuffer)
+  {
+    this->pAllocator->Free(this->pBuffer);
+    this->pBuffer = nullptr;
+  }
+  this->pRecord = nullptr;
+}
+
+bool mj::DirectoryReader::Next(DirectoryEntry* pEntry)
+{
+  for (;;)
+  {
+    if (!this->pRecord)
+    {
+      ZoneScopedN("GetFileInformationByHandleEx");
+
+      // Fails with ERROR_NO_MORE_FILES after the last batch
+      if (!::GetFileInformationByHandleEx(this->hDirectory, FileFullDirectoryInfo, this->pBuffer, BUFFER_SIZE))
+      {
+        return false;
+      }
+      this->pRecord = this->pBuffer;
+    }
+
+    const auto* pInfo = reinterpret_cast<const FILE_FULL_DIR_INFO*>(this->pRecord);
+    this->pRecord     = pInfo->NextEntryOffset != 0 ? this->pRecord + pInfo->NextEntryOffset : nullptr;
+
+    pEntry->name.Init(pInfo->FileName, pInfo->FileNameLength / sizeof(wchar_t));
+    if (pEntry->name.Equals(L".") || pEntry->name.Equals(L".."))
+    {
+      continue;
+    }
+
+    // The EA size field holds the tag of reparse points
+    pEntry->attributes    = pInfo->FileAttributes;
+    pEntry->reparseTag    = (pInfo->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) ? pInfo->EaSize : 0;
+    pEntry->size          = static_cast<uint64_t>(pInfo->EndOfFile.QuadPart);
+    pEntry->lastWriteTime = static_cast<uint64_t>(pInfo->LastWriteTime.QuadPart);
+    return true;
+  }
+}
+
+void mj::DirectoryColumns::Init(AllocatorBase* pAllocator)
+{
+  this->sizes.Init(pAllocator);
+  this->lastWriteTimes.Init(pAllocator);
+  this->attributes.Init(pAllocator);
+  this->flags.Init(pAllocator);
+}
+
+void mj::DirectoryColumns::Destroy()
+{
+  this->sizes.Destroy();
+  this->lastWriteTimes.Destroy();
+  this->attributes.Destroy();
+  this->flags.Destroy();
+}
+
+void mj::DirectoryColumns::Clear()
+{
+  this->sizes.Clear();
+  this->lastWriteTimes.Clear();
+  this->attributes.Clear();
+  this->flags.Clear();
+}
+
+bool mj::DirectoryColumns::Add(const DirectoryEntry& entry)
+{
+  uint8_t entryFlags = EEntryFlags::None;
+  if (entry.attributes & FILE_ATTRIBUTE_HIDDEN)
+  {
+    entryFlags |= EEntryFlags::Hidden;
+  }
+  if ((entry.attributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+      (entry.reparseTag == IO_REPARSE_TAG_SYMLINK || entry.reparseTag == IO_REPARSE_TAG_MOUNT_POINT))
+  {
+    entryFlags |= EEntryFlags::Symlink;
+  }
+
+  size_t row = this->Size();
+  if (this->sizes.Add(entry.size) &&                   //
+      this->lastWriteTimes.Add(entry.lastWriteTime) && //
+      this->attributes.Add(entry.attributes) &&        //
+      this->flags.Add(entryFlags))
+  {
+    return true;
+  }
+
+  // Remove the partial row, so the columns stay aligned
+  static_cast<void>(this->sizes.Erase(row, this->sizes.Size() - row));
+  static_cast<void>(this->lastWriteTimes.Erase(row, this->lastWriteTimes.Size() - row));
+  static_cast<void>(this->attributes.Erase(row, this->attributes.Size() - row));
+  return false;
+}
+
+bool mj::DirectoryColumns::Copy(const DirectoryColumns& other)
+{
+  return this->sizes.Copy(other.sizes) &&                   //
+         this->lastWriteTimes.Copy(other.lastWriteTimes) && //
+         this->attributes.Copy(other.attributes) &&         //
+         this->flags.Copy(other.flags);
+}
+
+size_t mj::DirectoryColumns::Size() const
+{
+  return this->sizes.Size();
+}
+
+size_t mj::DirectoryColumns::ByteWidth() const
+{
+  return this->Size() * BYTES_PER_ROW;
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "mj_string.h"
+
+namespace mj
+{
+  struct EEntryFlags
+  {
+    enum Enum : uint8_t
+    {
+      None    = 0,
+      Hidden  = 1 << 0,
+      Symlink = 1 << 1, // Symbolic link or junction
+    };
+  };
+
+  /// <summary>
+  /// One entry of a folder. The name points into the reader's buffer and is valid until the next call to Next.
+  /// </summary>
+  struct DirectoryEntry
+  {
+    MJ_UNINITIALIZED StringView name;        // Not null-terminated
+    MJ_UNINITIALIZED DWORD attributes;       // FILE_ATTRIBUTE_*
+    MJ_UNINITIALIZED DWORD reparseTag;       // IO_REPARSE_TAG_*, only set with FILE_ATTRIBUTE_REPARSE_POINT
+    MJ_UNINITIALIZED uint64_t size;          // In bytes
+    MJ_UNINITIALIZED uint64_t lastWriteTime; // FILETIME, 100 ns intervals since 1601 (UTC)
+  };
+
+  /// <summary>
+  /// Lists a folder in batches: each call to GetFileInformationByHandleEx fills a buffer with as many records
+  /// as fit, instead of one record per FindNextFile call. Records carry the length of their name,
+  /// so names are used in place and never measured. "." and ".." are skipped.
+  /// </summary>
+  class DirectoryReader
+  {
+  public:
+    static constexpr const size_t BUFFER_SIZE = 64 * 1024;
+
+  private:
+    HANDLE hDirectory         = INVALID_HANDLE_VALUE;
+    AllocatorBase* pAllocator = nullptr;
+    BYTE* pBuffer             = nullptr;
+    const BYTE* pRecord       = nullptr; // Next record in the buffer, nullptr to read the next batch
+
+  public:
+    /// <summary>
+    /// Opens the folder and allocates the batch buffer.
+    /// </summary>
+    /// <param name="pPath">Null-terminated path of the folder, e.g. "C:\\" or "C:\\Windows"</param>
+    /// <returns>False on failure, see GetLastError. Destroy is safe to call either way.</returns>
+    [[nodiscard]] bool Init(const wchar_t* pPath, AllocatorBase* pAllocator);
+    void Destroy();
+
+    /// <summary>
+    /// Returns false after the last entry, or when the folder cannot be read any further.
+    /// </summary>
+    [[nodiscard]] bool Next(DirectoryEntry* pEntry);
+  };
+
+  /// <summary>
+  /// Metadata of a listing, filled from the same records as the names, so it costs no extra system calls.
+  /// One array per field: sorting or filtering by a field only reads that field.
+  /// Row i describes name i of the listing.
+  /// </summary>
+  class DirectoryColumns
+  {
+  public:
+    static constexpr const size_t BYTES_PER_ROW = 2 * sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t);
+
+    ArrayList<uint64_t> sizes;          // In bytes
+    ArrayList<uint64_t> lastWriteTimes; // FILETIME
+    ArrayList<uint32_t> attributes;     // FILE_ATTRIBUTE_*
+    ArrayList<uint8_t> flags;           // EEntryFlags
+
+    /// <summary>
+    /// Does no allocation on construction.
+    /// </summary>
+    void Init(AllocatorBase* pAllocator);
+
+    /// <summary>
+    /// Data is freed using the assigned allocator.
+    /// </summary>
+    void Destroy();
+
+    void Clear();
+
+    /// <summary>
+    /// Appends a row.
+    /// </summary>
+    /// <returns>False if allocation failed, the columns are unchanged</returns>
+    [[nodiscard]] bool Add(const DirectoryEntry& entry);
+
+    [[nodiscard]] bool Copy(const DirectoryColumns& other);
+
+    size_t Size() const;
+
+    /// <summary>
+    /// Bytes used by the rows (not counting spare capacity).
+    /// </summary>
+    size_t ByteWidth() const;
+  };
+} // namespace mj
@@ -0,0 +1,144 @@
+#include "pch.h"
+#include "mj_filter.h"
+#include <emmintrin.h>
+#include <intrin.h>
+
+namespace mj
+{
+  static wchar_t UnfoldCase(wchar_t c)
+  {
+    if ((c >= L'a' && c <= L'z') || (c >= 0xE0 && c <= 0xFE && c != 0xF7))
+    {
+      return c - 0x20;
+    }
+    return c;
+  }
+
+  /// <summary>
+  /// Compares the query (minus its first character) with the name at the given position.
+  /// </summary>
+  static bool MatchesAt(const wchar_t* pFolded, size_t length, const wchar_t* pName)
+  {
+    for (size_t i = 1; i < length; i++)
+    {
+      if (FoldCase(pName[i]) != pFolded[i])
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+} // namespace mj
+
+void mj::FilterQuery::Init(const StringView& string)
+{
+  this->length = mj::min(string.len, MAX_LENGTH);
+  for (size_t i = 0; i < this->length; i++)
+  {
+    this->folded[i] = FoldCase(string.ptr[i]);
+  }
+
+  if (this->length > 0)
+  {
+    this->firstLower = this->folded[0];
+    this->firstUpper = UnfoldCase(this->folded[0]);
+  }
+}
+
+size_t mj::FilterQuery::Length() const
+{
+  return this->length;
+}
+
+bool mj::FilterQuery::IsEmpty() const
+{
+  return this->length == 0;
+}
+
+bool mj::FilterQuery::Refines(const FilterQuery& previous) const
+{
+  if (previous.length > this->length)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < previous.length; i++)
+  {
+    if (previous.folded[i] != this->folded[i])
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool mj::FilterQuery::Matches(const StringView& name) const
+{
+  if (this->length == 0)
+  {
+    return true;
+  }
+  if (name.len < this->length)
+  {
+    return false;
+  }
+
+  // Last position where the query still fits
+  const size_t numPositions = name.len - this->length + 1;
+
+  // Prefilter: find candidate positions by comparing 8 characters at a time with the first character.
+  // Unaligned loads never read past the end of the name.
+  const __m128i lower = _mm_set1_epi16(static_cast<short>(this->firstLower));
+  const __m128i upper = _mm_set1_epi16(static_cast<short>(this->firstUpper));
+
+  size_t i = 0;
+  for (; i + 8 <= numPositions; i += 8)
+  {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(name.ptr + i));
+    __m128i equal = _mm_or_si128(_mm_cmpeq_epi16(chars, lower), _mm_cmpeq_epi16(chars, upper));
+
+    // Two bits per character
+    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(equal));
+    while (mask != 0)
+    {
+      MJ_UNINITIALIZED unsigned long bit;
+      static_cast<void>(_BitScanForward(&bit, mask));
+      if (MatchesAt(this->folded, this->length, name.ptr + i + bit / 2))
+      {
+        return true;
+      }
+      mask &= ~(3u << bit);
+    }
+  }
+
+  for (; i < numPositions; i++)
+  {
+    wchar_t c = name.ptr[i];
+    if ((c == this->firstLower || c == this->firstUpper) && MatchesAt(this->folded, this->length, name.ptr + i))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+size_t mj::FilterNames(const FilterQuery& query, const CompactStringCache& names, const uint32_t* pIndices,
+                       size_t numIndices, uint32_t* pOut)
+{
+  ZoneScoped;
+
+  size_t numMatches = 0;
+  for (size_t i = 0; i < numIndices; i++)
+  {
+    // Read before writing, pOut may alias pIndices
+    uint32_t index = pIndices[i];
+    if (query.Matches(names.Get(index)))
+    {
+      pOut[numMatches++] = index;
+    }
+  }
+
+  return numMatches;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "mj_string.h"
+
+namespace mj
+{
+  /// <summary>
+  /// Lowercases ASCII and Latin-1 letters. Other characters are returned as-is.
+  /// </summary>
+  inline wchar_t FoldCase(wchar_t c)
+  {
+    if ((c >= L'A' && c <= L'Z') || (c >= 0xC0 && c <= 0xDE && c != 0xD7))
+    {
+      return c + 0x20;
+    }
+    return c;
+  }
+
+  /// <summary>
+  /// Case-insensitive substring query for file names.
+  /// Only ASCII and Latin-1 letters are folded, so matching never calls into the OS.
+  /// </summary>
+  class FilterQuery
+  {
+  public:
+    static constexpr const size_t MAX_LENGTH = 255;
+
+  private:
+    MJ_UNINITIALIZED wchar_t folded[MAX_LENGTH];
+    size_t length = 0;
+
+    // Both cases of the first character, compared 8 characters at a time
+    MJ_UNINITIALIZED wchar_t firstLower;
+    MJ_UNINITIALIZED wchar_t firstUpper;
+
+  public:
+    /// <summary>
+    /// Strings longer than MAX_LENGTH are truncated.
+    /// </summary>
+    void Init(const StringView& string);
+
+    size_t Length() const;
+
+    bool IsEmpty() const;
+
+    /// <summary>
+    /// True if every name matching this query also matches the previous query,
+    /// i.e. the previous query is a prefix of this one. Results of the previous query
+    /// can then be filtered again instead of scanning all names.
+    /// </summary>
+    bool Refines(const FilterQuery& previous) const;
+
+    /// <summary>
+    /// An empty query matches everything.
+    /// </summary>
+    bool Matches(const StringView& name) const;
+  };
+
+  /// <summary>
+  /// Writes the indices of the names that match the query, in input order.
+  /// pOut may be equal to pIndices to filter in place.
+  /// </summary>
+  /// <param name="pIndices">Indices into names</param>
+  /// <param name="pOut">At least numIndices elements</param>
+  /// <returns>Number of indices written</returns>
+  size_t FilterNames(const FilterQuery& query, const CompactStringCache& names, const uint32_t* pIndices,
+                     size_t numIndices, uint32_t* pOut);
+} // namespace mj
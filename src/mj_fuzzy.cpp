@@ -0,0 +1,338 @@
+#include "pch.h"
+#include "mj_fuzzy.h"
+#include "mj_filter.h"
+
+namespace mj
+{
+  // Scoring constants from fzf
+  static constexpr const int32_t SCORE_MATCH                 = 16;
+  static constexpr const int32_t SCORE_GAP_START             = -3;
+  static constexpr const int32_t SCORE_GAP_EXTENSION         = -1;
+  static constexpr const int32_t BONUS_BOUNDARY              = SCORE_MATCH / 2;
+  static constexpr const int32_t BONUS_NON_WORD              = SCORE_MATCH / 2;
+  static constexpr const int32_t BONUS_CAMEL_123             = BONUS_BOUNDARY + SCORE_GAP_EXTENSION;
+  static constexpr const int32_t BONUS_CONSECUTIVE           = -(SCORE_GAP_START + SCORE_GAP_EXTENSION);
+  static constexpr const int32_t BONUS_FIRST_CHAR_MULTIPLIER = 2;
+  static constexpr const int32_t BONUS_BOUNDARY_WHITE        = BONUS_BOUNDARY + 2;
+  static constexpr const int32_t BONUS_BOUNDARY_DELIMITER    = BONUS_BOUNDARY + 1;
+
+  /// <summary>
+  /// Order matters: everything after NonWord is part of a word.
+  /// </summary>
+  struct ECharClass
+  {
+    enum Enum
+    {
+      White,
+      NonWord,
+      Delimiter,
+      Lower,
+      Upper,
+      Letter,
+      Number,
+    };
+  };
+
+  static ECharClass::Enum GetCharClass(wchar_t c)
+  {
+    if (c >= L'a' && c <= L'z')
+    {
+      return ECharClass::Lower;
+    }
+    if (c >= L'A' && c <= L'Z')
+    {
+      return ECharClass::Upper;
+    }
+    if (c >= L'0' && c <= L'9')
+    {
+      return ECharClass::Number;
+    }
+    if (c == L' ' || c == L'\t')
+    {
+      return ECharClass::White;
+    }
+    if (c == L'\\' || c == L'/' || c == L',' || c == L':' || c == L';' || c == L'|')
+    {
+      return ECharClass::Delimiter;
+    }
+    if (c >= 0x80)
+    {
+      return ECharClass::Letter;
+    }
+    return ECharClass::NonWord;
+  }
+
+  static int32_t GetBonus(ECharClass::Enum prevClass, ECharClass::Enum charClass)
+  {
+    if (charClass > ECharClass::NonWord)
+    {
+      switch (prevClass)
+      {
+      case ECharClass::White:
+        return BONUS_BOUNDARY_WHITE;
+      case ECharClass::Delimiter:
+        return BONUS_BOUNDARY_DELIMITER;
+      case ECharClass::NonWord:
+        return BONUS_BOUNDARY;
+      default:
+        break;
+      }
+    }
+
+    if ((prevClass == ECharClass::Lower && charClass == ECharClass::Upper) ||
+        (prevClass != ECharClass::Number && charClass == ECharClass::Number))
+    {
+      return BONUS_CAMEL_123;
+    }
+
+    switch (charClass)
+    {
+    case ECharClass::NonWord:
+    case ECharClass::Delimiter:
+      return BONUS_NON_WORD;
+    case ECharClass::White:
+      return BONUS_BOUNDARY_WHITE;
+    default:
+      return 0;
+    }
+  }
+
+  static uint64_t GetCharBit(wchar_t folded)
+  {
+    if (folded >= L'a' && folded <= L'z')
+    {
+      return 1ull << (folded - L'a');
+    }
+    if (folded >= L'0' && folded <= L'9')
+    {
+      return 1ull << (26 + folded - L'0');
+    }
+    // Everything else shares the upper 28 bits
+    return 1ull << (36 + folded % 28);
+  }
+
+  /// <summary>
+  /// Heap order: the worst match is at the root.
+  /// </summary>
+  static void SiftDown(FuzzyMatch* pHeap, size_t size, size_t index)
+  {
+    while (true)
+    {
+      size_t worst = index;
+      size_t left  = 2 * index + 1;
+      size_t right = left + 1;
+      if (left < size && FuzzyBetter(pHeap[worst], pHeap[left]))
+      {
+        worst = left;
+      }
+      if (right < size && FuzzyBetter(pHeap[worst], pHeap[right]))
+      {
+        worst = right;
+      }
+      if (worst == index)
+      {
+        return;
+      }
+      mj::swap(pHeap[index], pHeap[worst]);
+      index = worst;
+    }
+  }
+} // namespace mj
+
+uint64_t mj::FuzzyCharMask(const StringView& string)
+{
+  uint64_t mask = 0;
+  for (size_t i = 0; i < string.len; i++)
+  {
+    mask |= GetCharBit(FoldCase(string.ptr[i]));
+  }
+  return mask;
+}
+
+void mj::FuzzyQuery::Init(const StringView& string)
+{
+  this->length = mj::min(string.len, MAX_LENGTH);
+  this->mask   = 0;
+  for (size_t i = 0; i < this->length; i++)
+  {
+    this->folded[i] = FoldCase(string.ptr[i]);
+    this->mask |= GetCharBit(this->folded[i]);
+  }
+}
+
+size_t mj::FuzzyQuery::Length() const
+{
+  return this->length;
+}
+
+bool mj::FuzzyQuery::IsEmpty() const
+{
+  return this->length == 0;
+}
+
+bool mj::FuzzyQuery::Score(const StringView& name, int32_t* pScore) const
+{
+  if (this->length == 0)
+  {
+    *pScore = 0;
+    return true;
+  }
+
+  // Forward scan: find the end of the first occurrence of the query as a subsequence
+  size_t queryIndex = 0;
+  size_t end        = 0;
+  for (size_t i = 0; i < name.len; i++)
+  {
+    if (FoldCase(name.ptr[i]) == this->folded[queryIndex])
+    {
+      if (++queryIndex == this->length)
+      {
+        end = i + 1;
+        break;
+      }
+    }
+  }
+  if (queryIndex < this->length)
+  {
+    return false;
+  }
+
+  // Backward scan: find the shortest window that ends there
+  size_t begin = end;
+  queryIndex   = this->length;
+  while (queryIndex > 0)
+  {
+    begin--;
+    if (FoldCase(name.ptr[begin]) == this->folded[queryIndex - 1])
+    {
+      queryIndex--;
+    }
+  }
+
+  // Score the window
+  int32_t score         = 0;
+  int32_t firstBonus    = 0;
+  size_t consecutive    = 0;
+  bool inGap            = false;
+  ECharClass::Enum prev = begin > 0 ? GetCharClass(name.ptr[begin - 1]) : ECharClass::White;
+  queryIndex            = 0;
+  for (size_t i = begin; i < end; i++)
+  {
+    wchar_t c                  = name.ptr[i];
+    ECharClass::Enum charClass = GetCharClass(c);
+    if (queryIndex < this->length && FoldCase(c) == this->folded[queryIndex])
+    {
+      score += SCORE_MATCH;
+      int32_t bonus = GetBonus(prev, charClass);
+      if (consecutive == 0)
+      {
+        firstBonus = bonus;
+      }
+      else
+      {
+        // Break consecutive chunk at a stronger boundary
+        if (bonus >= BONUS_BOUNDARY && bonus > firstBonus)
+        {
+          firstBonus = bonus;
+        }
+        bonus = mj::max(mj::max(bonus, firstBonus), BONUS_CONSECUTIVE);
+      }
+
+      score += queryIndex == 0 ? bonus * BONUS_FIRST_CHAR_MULTIPLIER : bonus;
+      inGap = false;
+      consecutive++;
+      queryIndex++;
+    }
+    else
+    {
+      score += inGap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+      inGap       = true;
+      consecutive = 0;
+      firstBonus  = 0;
+    }
+    prev = charClass;
+  }
+
+  *pScore = score;
+  return true;
+}
+
+bool mj::FuzzyBetter(const FuzzyMatch& a, const FuzzyMatch& b)
+{
+  if (a.score != b.score)
+  {
+    return a.score > b.score;
+  }
+  if (a.length != b.length)
+  {
+    return a.length < b.length;
+  }
+  return a.index < b.index;
+}
+
+void mj::FuzzyTopK::Init(FuzzyMatch* pStorage, size_t capacity)
+{
+  this->pHeap    = pStorage;
+  this->capacity = capacity;
+  this->size     = 0;
+}
+
+void mj::FuzzyTopK::Push(const FuzzyMatch& match)
+{
+  if (this->size < this->capacity)
+  {
+    // Sift up
+    size_t index = this->size++;
+    while (index > 0)
+    {
+      size_t parent = (index - 1) / 2;
+      if (!FuzzyBetter(this->pHeap[parent], match))
+      {
+        break;
+      }
+      this->pHeap[index] = this->pHeap[parent];
+      index              = parent;
+    }
+    this->pHeap[index] = match;
+  }
+  else if (this->capacity > 0 && FuzzyBetter(match, this->pHeap[0]))
+  {
+    // Replace the worst match
+    this->pHeap[0] = match;
+    SiftDown(this->pHeap, this->size, 0);
+  }
+}
+
+size_t mj::FuzzyTopK::Size() const
+{
+  return this->size;
+}
+
+mj::FuzzyMatch* mj::FuzzyTopK::Sort()
+{
+  mj::Sort(this->pHeap, this->pHeap + this->size, FuzzyBetter);
+  return this->pHeap;
+}
+
+void mj::FuzzySearch(const FuzzyQuery& query, const CompactStringCache& names, const uint64_t* pCharMasks,
+                     size_t begin, size_t end, FuzzyTopK& topK)
+{
+  ZoneScoped;
+
+  for (size_t i = begin; i < end; i++)
+  {
+    if (pCharMasks && !query.MayMatch(pCharMasks[i]))
+    {
+      continue;
+    }
+
+    StringView name = names.Get(i);
+    MJ_UNINITIALIZED FuzzyMatch match;
+    if (query.Score(name, &match.score))
+    {
+      match.index  = static_cast<uint32_t>(i);
+      match.length = static_cast<uint32_t>(name.len);
+      topK.Push(match);
+    }
+  }
+}
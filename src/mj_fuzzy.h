@@ -0,0 +1,97 @@
+#pragma once
+#include "mj_string.h"
+
+namespace mj
+{
+  /// <summary>
+  /// Bitmask of the (case-folded) characters in a string: one bit per letter and digit,
+  /// other characters share the remaining bits. A name can only contain a query as a subsequence
+  /// if its mask contains all bits of the query mask.
+  /// </summary>
+  uint64_t FuzzyCharMask(const StringView& string);
+
+  struct FuzzyMatch
+  {
+    MJ_UNINITIALIZED uint32_t index;
+    MJ_UNINITIALIZED int32_t score;
+    MJ_UNINITIALIZED uint32_t length; // Tie breaker: shorter names rank higher
+  };
+
+  /// <summary>
+  /// Fuzzy subsequence query, scored like fzf (v1): the query characters must appear in order,
+  /// matches after separators, at camelCase humps and in consecutive runs score higher,
+  /// gaps score lower. Path separators count as word boundaries, so the same query works
+  /// on names and on full paths.
+  /// </summary>
+  class FuzzyQuery
+  {
+  public:
+    static constexpr const size_t MAX_LENGTH = 255;
+
+  private:
+    MJ_UNINITIALIZED wchar_t folded[MAX_LENGTH];
+    size_t length = 0;
+    uint64_t mask = 0;
+
+  public:
+    /// <summary>
+    /// Strings longer than MAX_LENGTH are truncated.
+    /// </summary>
+    void Init(const StringView& string);
+
+    size_t Length() const;
+
+    bool IsEmpty() const;
+
+    /// <summary>
+    /// Cheap rejection test using the result of FuzzyCharMask.
+    /// </summary>
+    bool MayMatch(uint64_t charMask) const
+    {
+      return (charMask & this->mask) == this->mask;
+    }
+
+    /// <summary>
+    /// Scores a name. An empty query matches everything with a score of zero.
+    /// </summary>
+    /// <returns>False if the query is not a subsequence of the name. The score is only written on success.</returns>
+    bool Score(const StringView& name, int32_t* pScore) const;
+  };
+
+  /// <summary>
+  /// Keeps the best K matches seen so far in a min-heap, so the worst kept match can be replaced in O(log K).
+  /// Does not own its storage.
+  /// </summary>
+  class FuzzyTopK
+  {
+  private:
+    FuzzyMatch* pHeap = nullptr;
+    size_t capacity   = 0;
+    size_t size       = 0;
+
+  public:
+    /// <param name="pStorage">At least capacity elements</param>
+    void Init(FuzzyMatch* pStorage, size_t capacity);
+
+    void Push(const FuzzyMatch& match);
+
+    size_t Size() const;
+
+    /// <summary>
+    /// Sorts the kept matches from best to worst. Afterwards the heap can only be read.
+    /// </summary>
+    FuzzyMatch* Sort();
+  };
+
+  /// <summary>
+  /// True if a ranks before b: higher score, then shorter name, then lower index.
+  /// </summary>
+  bool FuzzyBetter(const FuzzyMatch& a, const FuzzyMatch& b);
+
+  /// <summary>
+  /// Scores the names in [begin, end) and pushes every match into the heap.
+  /// </summary>
+  /// <param name="pCharMasks">FuzzyCharMask of every name, or nullptr to skip the prefilter</param>
+  void FuzzySearch(const FuzzyQuery& query, const CompactStringCache& names, const uint64_t* pCharMasks, size_t begin,
+                   size_t end, FuzzyTopK& topK);
+} // namespace mj
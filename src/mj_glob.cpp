@@ -0,0 +1,552 @@
+#include "pch.h"
+#include "mj_glob.h"
+#include "mj_filter.h"
+
+namespace mj
+{
+  static bool IsWildcard(wchar_t c)
+  {
+    return c == L'*' || c == L'?';
+  }
+
+  static uint32_t HashFolded(const StringView& string)
+  {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < string.len; i++)
+    {
+      hash ^= FoldCase(string.ptr[i]);
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+
+  static StringView Trim(const StringView& string)
+  {
+    size_t begin = 0;
+    size_t end   = string.len;
+    while (begin < end && string.ptr[begin] == L' ')
+    {
+      begin++;
+    }
+    while (end > begin && string.ptr[end - 1] == L' ')
+    {
+      end--;
+    }
+
+    MJ_UNINITIALIZED StringView trimmed;
+    trimmed.Init(string.ptr + begin, end - begin);
+    return trimmed;
+  }
+
+  static bool RunNfa(const detail::GlobNfa& nfa, const StringView& name)
+  {
+    // Start state, and skip leading stars
+    uint64_t state = 1;
+    state |= (state & nfa.starMask) << 1;
+
+    for (size_t i = 0; i < name.len; i++)
+    {
+      wchar_t c        = FoldCase(name.ptr[i]);
+      uint64_t consume = nfa.anyMask;
+      if (c < MJ_COUNTOF(nfa.asciiMasks))
+      {
+        consume |= nfa.asciiMasks[c];
+      }
+      else
+      {
+        for (uint32_t j = 0; j < nfa.numTokens; j++)
+        {
+          if (nfa.tokens[j] == c)
+          {
+            consume |= 1ull << j;
+          }
+        }
+      }
+
+      state = ((state & consume) << 1) | (state & nfa.loopMask);
+      // Stars are never adjacent, so one step of epsilon closure is enough
+      state |= (state & nfa.starMask) << 1;
+      if (state == 0)
+      {
+        return false;
+      }
+    }
+
+    return (state & nfa.acceptMask) != 0;
+  }
+} // namespace mj
+
+void mj::detail::GlobSet::Init(AllocatorBase* pAllocator)
+{
+  this->pAllocator = pAllocator;
+  this->extensionSlots.Init(pAllocator);
+  this->extensionChars.Init(pAllocator);
+  this->trie.Init(pAllocator);
+  this->nfas.Init(pAllocator);
+  this->numExtensions = 0;
+  this->matchAll      = false;
+}
+
+void mj::detail::GlobSet::Destroy()
+{
+  this->extensionSlots.Destroy();
+  this->extensionChars.Destroy();
+  this->trie.Destroy();
+  this->nfas.Destroy();
+}
+
+void mj::detail::GlobSet::Clear()
+{
+  this->extensionSlots.Clear();
+  this->extensionChars.Clear();
+  this->trie.Clear();
+  this->nfas.Clear();
+  this->numExtensions = 0;
+  this->matchAll      = false;
+}
+
+bool mj::detail::GlobSet::IsEmpty() const
+{
+  return !this->matchAll && this->numExtensions == 0 && this->trie.Size() == 0 && this->nfas.Size() == 0;
+}
+
+bool mj::detail::GlobSet::Add(const StringView& pattern)
+{
+  size_t numStars     = 0;
+  size_t numWildcards = 0;
+  for (size_t i = 0; i < pattern.len; i++)
+  {
+    if (pattern.ptr[i] == L'*')
+    {
+      numStars++;
+    }
+    if (IsWildcard(pattern.ptr[i]))
+    {
+      numWildcards++;
+    }
+  }
+
+  if (numStars == pattern.len)
+  {
+    this->matchAll = true;
+    return true;
+  }
+
+  // "*.ext"
+  if (numWildcards == 1 && pattern.len > 2 && pattern.ptr[0] == L'*' && pattern.ptr[1] == L'.')
+  {
+    MJ_UNINITIALIZED StringView extension;
+    extension.Init(pattern.ptr + 2, pattern.len - 2);
+    if (extension.FindLastOf(L".") < 0)
+    {
+      return this->AddExtension(extension);
+    }
+  }
+
+  // "*literal*"
+  if (numWildcards == 2 && pattern.len > 2 && pattern.ptr[0] == L'*' && pattern.ptr[pattern.len - 1] == L'*')
+  {
+    MJ_UNINITIALIZED StringView literal;
+    literal.Init(pattern.ptr + 1, pattern.len - 2);
+    return this->AddLiteral(literal);
+  }
+
+  return this->AddNfa(pattern);
+}
+
+bool mj::detail::GlobSet::AddExtension(const StringView& extension)
+{
+  wchar_t* pChars = this->extensionChars.Emplace(extension.len + 1);
+  if (!pChars)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < extension.len; i++)
+  {
+    pChars[i] = FoldCase(extension.ptr[i]);
+  }
+  pChars[extension.len] = L'\0';
+  this->numExtensions++;
+
+  return true;
+}
+
+bool mj::detail::GlobSet::AddLiteral(const StringView& literal)
+{
+  if (this->trie.Size() == 0)
+  {
+    GlobTrieNode* pRoot = this->trie.Add({});
+    if (!pRoot)
+    {
+      return false;
+    }
+  }
+
+  uint32_t node = 0;
+  for (size_t i = 0; i < literal.len; i++)
+  {
+    wchar_t c      = FoldCase(literal.ptr[i]);
+    uint32_t child = this->FindChild(node, c);
+    if (child == 0)
+    {
+      MJ_UNINITIALIZED GlobTrieNode newNode;
+      newNode.firstChild  = 0;
+      newNode.nextSibling = this->trie[node].firstChild;
+      newNode.fail        = 0;
+      newNode.c           = c;
+      newNode.output      = false;
+      if (!this->trie.Add(newNode))
+      {
+        return false;
+      }
+
+      child                       = static_cast<uint32_t>(this->trie.Size() - 1);
+      this->trie[node].firstChild = child;
+    }
+    node = child;
+  }
+
+  this->trie[node].output = true;
+  return true;
+}
+
+bool mj::detail::GlobSet::AddNfa(const StringView& pattern)
+{
+  GlobNfa* pNfa = this->nfas.Emplace(1);
+  if (!pNfa)
+  {
+    return false;
+  }
+
+  static_cast<void>(::memset(pNfa, 0, sizeof(GlobNfa)));
+
+  uint32_t numTokens = 0;
+  for (size_t i = 0; i < pattern.len; i++)
+  {
+    wchar_t c = pattern.ptr[i];
+
+    // Collapse "**"
+    if (c == L'*' && numTokens > 0 && (pNfa->starMask & (1ull << (numTokens - 1))))
+    {
+      continue;
+    }
+
+    if (numTokens == GlobNfa::MAX_TOKENS)
+    {
+      this->nfas.Erase(this->nfas.Size() - 1, 1);
+      return false;
+    }
+
+    uint64_t bit = 1ull << numTokens;
+    if (c == L'*')
+    {
+      pNfa->starMask |= bit;
+      pNfa->loopMask |= bit << 1;
+      pNfa->tokens[numTokens] = L'\0';
+    }
+    else if (c == L'?')
+    {
+      pNfa->anyMask |= bit;
+      pNfa->tokens[numTokens] = L'\0';
+    }
+    else
+    {
+      wchar_t folded = FoldCase(c);
+      if (folded < MJ_COUNTOF(pNfa->asciiMasks))
+      {
+        pNfa->asciiMasks[folded] |= bit;
+      }
+      pNfa->tokens[numTokens] = folded;
+    }
+    numTokens++;
+  }
+
+  pNfa->numTokens  = numTokens;
+  pNfa->acceptMask = 1ull << numTokens;
+  return true;
+}
+
+bool mj::detail::GlobSet::Build()
+{
+  if (this->numExtensions > 0)
+  {
+    // Power of two, at most half full
+    size_t numSlots = 8;
+    while (numSlots < 2 * this->numExtensions)
+    {
+      numSlots *= 2;
+    }
+
+    uint32_t* pSlots = this->extensionSlots.Emplace(numSlots);
+    if (!pSlots)
+    {
+      return false;
+    }
+    static_cast<void>(::memset(pSlots, 0, numSlots * sizeof(uint32_t)));
+
+    size_t offset = 0;
+    while (offset < this->extensionChars.Size())
+    {
+      MJ_UNINITIALIZED StringView extension;
+      extension.Init(this->extensionChars.Get() + offset);
+
+      if (!this->FindExtension(extension))
+      {
+        size_t slot = HashFolded(extension) & (numSlots - 1);
+        while (pSlots[slot] != 0)
+        {
+          slot = (slot + 1) & (numSlots - 1);
+        }
+        pSlots[slot] = static_cast<uint32_t>(offset + 1);
+      }
+
+      offset += extension.len + 1;
+    }
+  }
+
+  if (this->trie.Size() > 0)
+  {
+    // Breadth-first, so fail links always point to nodes that are already done
+    ArrayList<uint32_t> queue;
+    queue.Init(this->pAllocator);
+    MJ_DEFER(queue.Destroy());
+    if (!queue.Reserve(this->trie.Size()))
+    {
+      return false;
+    }
+
+    for (uint32_t child = this->trie[0].firstChild; child != 0; child = this->trie[child].nextSibling)
+    {
+      this->trie[child].fail = 0;
+      static_cast<void>(queue.Add(child));
+    }
+
+    for (size_t i = 0; i < queue.Size(); i++)
+    {
+      uint32_t node = queue[i];
+      for (uint32_t child = this->trie[node].firstChild; child != 0; child = this->trie[child].nextSibling)
+      {
+        wchar_t c     = this->trie[child].c;
+        uint32_t fail = this->trie[node].fail;
+        while (fail != 0 && this->FindChild(fail, c) == 0)
+        {
+          fail = this->trie[fail].fail;
+        }
+
+        this->trie[child].fail = this->FindChild(fail, c);
+        this->trie[child].output |= this->trie[this->trie[child].fail].output;
+        static_cast<void>(queue.Add(child));
+      }
+    }
+  }
+
+  return true;
+}
+
+uint32_t mj::detail::GlobSet::FindChild(uint32_t node, wchar_t c) const
+{
+  const GlobTrieNode* pNodes = this->trie.Get();
+  for (uint32_t child = pNodes[node].firstChild; child != 0; child = pNodes[child].nextSibling)
+  {
+    if (pNodes[child].c == c)
+    {
+      return child;
+    }
+  }
+  return 0;
+}
+
+bool mj::detail::GlobSet::FindExtension(const StringView& extension) const
+{
+  const size_t numSlots = this->extensionSlots.Size();
+  if (numSlots == 0)
+  {
+    return false;
+  }
+
+  const uint32_t* pSlots = this->extensionSlots.Get();
+  const wchar_t* pChars  = this->extensionChars.Get();
+
+  size_t slot = HashFolded(extension) & (numSlots - 1);
+  while (pSlots[slot] != 0)
+  {
+    // Stored extensions are folded and null-terminated
+    const wchar_t* pStored = pChars + pSlots[slot] - 1;
+    size_t i               = 0;
+    while (i < extension.len && pStored[i] == FoldCase(extension.ptr[i]))
+    {
+      i++;
+    }
+    if (i == extension.len && pStored[i] == L'\0')
+    {
+      return true;
+    }
+
+    slot = (slot + 1) & (numSlots - 1);
+  }
+
+  return false;
+}
+
+bool mj::detail::GlobSet::FindLiteral(const StringView& name) const
+{
+  const GlobTrieNode* pNodes = this->trie.Get();
+
+  uint32_t node = 0;
+  for (size_t i = 0; i < name.len; i++)
+  {
+    wchar_t c = FoldCase(name.ptr[i]);
+    while (true)
+    {
+      uint32_t child = this->FindChild(node, c);
+      if (child != 0)
+      {
+        node = child;
+        break;
+      }
+      if (node == 0)
+      {
+        break;
+      }
+      node = pNodes[node].fail;
+    }
+
+    if (pNodes[node].output)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool mj::detail::GlobSet::Matches(const StringView& name) const
+{
+  if (this->matchAll)
+  {
+    return true;
+  }
+
+  if (this->numExtensions > 0)
+  {
+    ptrdiff_t dot = name.FindLastOf(L".");
+    if (dot >= 0)
+    {
+      MJ_UNINITIALIZED StringView extension;
+      extension.Init(name.ptr + dot + 1, name.len - dot - 1);
+      if (this->FindExtension(extension))
+      {
+        return true;
+      }
+    }
+  }
+
+  if (this->trie.Size() > 0 && this->FindLiteral(name))
+  {
+    return true;
+  }
+
+  for (const GlobNfa& nfa : this->nfas)
+  {
+    if (RunNfa(nfa, name))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void mj::GlobMatcher::Init(AllocatorBase* pAllocator)
+{
+  this->include.Init(pAllocator);
+  this->exclude.Init(pAllocator);
+}
+
+void mj::GlobMatcher::Destroy()
+{
+  this->include.Destroy();
+  this->exclude.Destroy();
+}
+
+bool mj::GlobMatcher::Compile(const StringView& patterns)
+{
+  ZoneScoped;
+
+  this->include.Clear();
+  this->exclude.Clear();
+
+  bool success = true;
+  size_t begin = 0;
+  while (success && begin < patterns.len)
+  {
+    size_t end = begin;
+    while (end < patterns.len && patterns.ptr[end] != L';')
+    {
+      end++;
+    }
+
+    MJ_UNINITIALIZED StringView pattern;
+    pattern.Init(patterns.ptr + begin, end - begin);
+    pattern = Trim(pattern);
+
+    detail::GlobSet* pSet = &this->include;
+    if (pattern.len > 0 && pattern.ptr[0] == L'!')
+    {
+      pSet = &this->exclude;
+      pattern.Init(pattern.ptr + 1, pattern.len - 1);
+      pattern = Trim(pattern);
+    }
+
+    if (pattern.len > 0)
+    {
+      success = pSet->Add(pattern);
+    }
+
+    begin = end + 1;
+  }
+
+  success = success && this->include.Build() && this->exclude.Build();
+  if (!success)
+  {
+    this->include.Clear();
+    this->exclude.Clear();
+  }
+
+  return success;
+}
+
+bool mj::GlobMatcher::IsEmpty() const
+{
+  return this->include.IsEmpty() && this->exclude.IsEmpty();
+}
+
+bool mj::GlobMatcher::Matches(const StringView& name) const
+{
+  if (!this->include.IsEmpty() && !this->include.Matches(name))
+  {
+    return false;
+  }
+
+  return !this->exclude.Matches(name);
+}
+
+bool mj::GlobMatcher::IsPattern(const StringView& string)
+{
+  if (string.len > 0 && string.ptr[0] == L'!')
+  {
+    return true;
+  }
+
+  for (size_t i = 0; i < string.len; i++)
+  {
+    if (IsWildcard(string.ptr[i]) || string.ptr[i] == L';')
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include "mj_string.h"
+
+namespace mj
+{
+  namespace detail
+  {
+    /// <summary>
+    /// Bit-parallel NFA for one wildcard pattern. Bit i of the state is set
+    /// once the first i tokens of the pattern have been consumed.
+    /// </summary>
+    struct GlobNfa
+    {
+      static constexpr const size_t MAX_TOKENS = 63;
+
+      MJ_UNINITIALIZED uint64_t asciiMasks[128]; // Tokens that consume the (folded) character
+      MJ_UNINITIALIZED uint64_t anyMask;         // Tokens that consume any character ('?')
+      MJ_UNINITIALIZED uint64_t starMask;        // Tokens that may be skipped ('*')
+      MJ_UNINITIALIZED uint64_t loopMask;        // States that consume any character and stay ('*')
+      MJ_UNINITIALIZED uint64_t acceptMask;
+      MJ_UNINITIALIZED wchar_t tokens[MAX_TOKENS]; // Folded literals, to build masks for characters >= 128
+      MJ_UNINITIALIZED uint32_t numTokens;
+    };
+
+    /// <summary>
+    /// Aho-Corasick trie node. Children are kept in a linked list, pattern sets are small.
+    /// </summary>
+    struct GlobTrieNode
+    {
+      MJ_UNINITIALIZED uint32_t firstChild;  // 0 if none: the root is never a child
+      MJ_UNINITIALIZED uint32_t nextSibling; // 0 if none
+      MJ_UNINITIALIZED uint32_t fail;
+      MJ_UNINITIALIZED wchar_t c;
+      MJ_UNINITIALIZED bool output; // A literal ends here or at a node on the fail chain
+    };
+
+    /// <summary>
+    /// Any-of matcher for a group of patterns, each routed to the cheapest strategy that can handle it.
+    /// </summary>
+    class GlobSet
+    {
+    private:
+      AllocatorBase* pAllocator = nullptr;
+
+      // "*.ext": open addressing hash set of folded extensions, keyed by the text after the last dot
+      ArrayList<uint32_t> extensionSlots; // Offset + 1 into extensionChars, 0 if the slot is empty
+      ArrayList<wchar_t> extensionChars;  // Null-terminated
+      size_t numExtensions = 0;
+
+      // "*literal*": Aho-Corasick automaton, so all literals are found in one pass over the name
+      ArrayList<GlobTrieNode> trie;
+
+      // Everything else
+      ArrayList<GlobNfa> nfas;
+
+      bool matchAll = false;
+
+    public:
+      void Init(AllocatorBase* pAllocator);
+      void Destroy();
+      bool IsEmpty() const;
+
+      /// <summary>
+      /// Removes all patterns, keeps the allocations.
+      /// </summary>
+      void Clear();
+
+      /// <returns>False if the pattern has too many tokens or allocation failed</returns>
+      bool Add(const StringView& pattern);
+
+      /// <summary>
+      /// Computes hash table and fail links. Call once after adding all patterns.
+      /// </summary>
+      bool Build();
+
+      bool Matches(const StringView& name) const;
+
+    private:
+      bool AddExtension(const StringView& extension);
+      bool AddLiteral(const StringView& literal);
+      bool AddNfa(const StringView& pattern);
+      uint32_t FindChild(uint32_t node, wchar_t c) const;
+      bool FindExtension(const StringView& extension) const;
+      bool FindLiteral(const StringView& name) const;
+    };
+  } // namespace detail
+
+  /// <summary>
+  /// One or more case-insensitive wildcard patterns compiled into a single matcher.
+  /// Patterns are separated by ';'. '*' matches any run of characters, '?' matches one character.
+  /// A pattern starting with '!' hides the names it matches, e.g. "*.cpp;*.h" or "!*.obj".
+  /// </summary>
+  class GlobMatcher
+  {
+  private:
+    detail::GlobSet include;
+    detail::GlobSet exclude;
+
+  public:
+    void Init(AllocatorBase* pAllocator);
+    void Destroy();
+
+    /// <summary>
+    /// Replaces any previously compiled patterns.
+    /// </summary>
+    /// <returns>False if a pattern is longer than the matcher supports or allocation failed.
+    /// The matcher then matches everything.</returns>
+    bool Compile(const StringView& patterns);
+
+    /// <summary>
+    /// True if the matcher has no patterns and matches everything.
+    /// </summary>
+    bool IsEmpty() const;
+
+    /// <summary>
+    /// True if the name matches any include pattern (or there are none) and no exclude pattern.
+    /// </summary>
+    bool Matches(const StringView& name) const;
+
+    /// <summary>
+    /// True if the string contains wildcard syntax and should be compiled rather than used as a substring filter.
+    /// </summary>
+    static bool IsPattern(const StringView& string);
+  };
+} // namespace mj
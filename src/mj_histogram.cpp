@@ -0,0 +1,102 @@
+#include "pch.h"
+#include "mj_histogram.h"
+#include <intrin.h>
+
+namespace mj
+{
+  static uint32_t GetBucket(uint64_t value)
+  {
+    if (value < 2 * Histogram::SUB_BUCKETS)
+    {
+      return static_cast<uint32_t>(value);
+    }
+
+    // The top five bits of the value pick the bucket within its power of two
+    MJ_UNINITIALIZED unsigned long msb;
+    static_cast<void>(_BitScanReverse64(&msb, value));
+    uint32_t shift = msb - 4;
+    if (shift > Histogram::MAX_SHIFT)
+    {
+      return Histogram::NUM_BUCKETS - 1;
+    }
+    return shift * Histogram::SUB_BUCKETS + static_cast<uint32_t>(value >> shift);
+  }
+
+  /// <summary>
+  /// Largest value counted in a bucket.
+  /// </summary>
+  static uint64_t GetBucketEnd(uint32_t bucket)
+  {
+    if (bucket < 2 * Histogram::SUB_BUCKETS)
+    {
+      return bucket;
+    }
+
+    uint32_t shift = bucket / Histogram::SUB_BUCKETS - 1;
+    uint64_t first = static_cast<uint64_t>(bucket % Histogram::SUB_BUCKETS + Histogram::SUB_BUCKETS) << shift;
+    return first + (1ull << shift) - 1;
+  }
+} // namespace mj
+
+void mj::Histogram::Record(uint64_t value)
+{
+  static_cast<void>(::InterlockedIncrement(&this->counts[GetBucket(value)]));
+  static_cast<void>(::InterlockedIncrement64(&this->count));
+
+  LONG64 max = ::ReadAcquire64(&this->max);
+  while (static_cast<uint64_t>(max) < value)
+  {
+    LONG64 previous = ::InterlockedCompareExchange64(&this->max, static_cast<LONG64>(value), max);
+    if (previous == max)
+    {
+      break;
+    }
+    max = previous;
+  }
+}
+
+void mj::Histogram::Clear()
+{
+  for (uint32_t i = 0; i < NUM_BUCKETS; i++)
+  {
+    ::WriteRelease(&this->counts[i], 0);
+  }
+  ::WriteRelease64(&this->count, 0);
+  ::WriteRelease64(&this->max, 0);
+}
+
+uint64_t mj::Histogram::Count() const
+{
+  return static_cast<uint64_t>(::ReadAcquire64(&this->count));
+}
+
+uint64_t mj::Histogram::Max() const
+{
+  return static_cast<uint64_t>(::ReadAcquire64(&this->max));
+}
+
+uint64_t mj::Histogram::ValueAtPermille(uint32_t permille) const
+{
+  // Buckets are read one at a time while other threads record, so the total is recounted
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < NUM_BUCKETS; i++)
+  {
+    total += static_cast<uint64_t>(::ReadAcquire(&this->counts[i]));
+  }
+  if (total == 0)
+  {
+    return 0;
+  }
+
+  uint64_t rank = mj::max<uint64_t>((total * mj::min<uint32_t>(permille, 1000) + 999) / 1000, 1);
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < NUM_BUCKETS; i++)
+  {
+    seen += static_cast<uint64_t>(::ReadAcquire(&this->counts[i]));
+    if (seen >= rank)
+    {
+      return mj::min(GetBucketEnd(i), this->Max());
+    }
+  }
+  return this->Max();
+}
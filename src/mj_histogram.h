@@ -0,0 +1,37 @@
+#pragma once
+#include "mj_common.h"
+
+namespace mj
+{
+  /// <summary>
+  /// HDR histogram of non-negative integers, e.g. latencies in microseconds.
+  /// Buckets are log-linear: values below 32 are exact, larger values are counted within 1/16 of their magnitude,
+  /// so the histogram has a fixed size no matter the range. Record can be called from any thread.
+  /// Starts out empty when zero-initialized, e.g. as a static.
+  /// </summary>
+  class Histogram
+  {
+  public:
+    static constexpr const uint32_t SUB_BUCKETS = 16;                              // Per power of two
+    static constexpr const uint32_t MAX_SHIFT   = 32;                              // Values from 2^37 up share the last bucket
+    static constexpr const uint32_t NUM_BUCKETS = (MAX_SHIFT + 2) * SUB_BUCKETS;
+
+  private:
+    volatile LONG counts[NUM_BUCKETS];
+    volatile LONG64 count;
+    volatile LONG64 max;
+
+  public:
+    void Record(uint64_t value);
+    void Clear();
+
+    uint64_t Count() const;
+    uint64_t Max() const;
+
+    /// <summary>
+    /// Smallest value that permille thousandths of the recorded values are at or below, e.g. 500 for the median.
+    /// Rounded up to the end of its bucket, but never above the maximum. Zero if the histogram is empty.
+    /// </summary>
+    uint64_t ValueAtPermille(uint32_t permille) const;
+  };
+} // namespace mj
@@ -0,0 +1,640 @@
+#include "pch.h"
+#include "mj_number.h"
+#include "mj_string.h"
+
+// Two characters per entry: "00", "01", ..., "99"
+static const wchar_t s_DigitPairs[] = //
+    L"0001020304050607080910111213141516171819"
+    L"2021222324252627282930313233343536373839"
+    L"4041424344454647484950515253545556575859"
+    L"6061626364656667686970717273747576777879"
+    L"8081828384858687888990919293949596979899";
+
+static uint32_t CountDigits(uint64_t value)
+{
+  uint32_t numDigits = 1;
+  while (true)
+  {
+    // Four digits per iteration keeps the loop short for typical file sizes
+    if (value < 10)
+    {
+      return numDigits;
+    }
+    if (value < 100)
+    {
+      return numDigits + 1;
+    }
+    if (value < 1000)
+    {
+      return numDigits + 2;
+    }
+    if (value < 10000)
+    {
+      return numDigits + 3;
+    }
+    value /= 10000;
+    numDigits += 4;
+  }
+}
+
+/// <summary>
+/// Writes exactly numDigits digits, filling backwards from pBuffer + numDigits.
+/// </summary>
+static void WriteDigits(wchar_t* pBuffer, uint64_t value, uint32_t numDigits)
+{
+  wchar_t* pHead = pBuffer + numDigits;
+  while (value >= 100)
+  {
+    uint64_t div = value / 100;
+    uint32_t pair = static_cast<uint32_t>(value - div * 100) * 2;
+    value         = div;
+    *--pHead      = s_DigitPairs[pair + 1];
+    *--pHead      = s_DigitPairs[pair];
+  }
+
+  if (value >= 10)
+  {
+    uint32_t pair = static_cast<uint32_t>(value) * 2;
+    *--pHead      = s_DigitPairs[pair + 1];
+    *--pHead      = s_DigitPairs[pair];
+  }
+  else
+  {
+    *--pHead = static_cast<wchar_t>(L'0' + value);
+  }
+}
+
+size_t mj::FormatUInt64(wchar_t* pBuffer, uint64_t value)
+{
+  uint32_t numDigits = CountDigits(value);
+  WriteDigits(pBuffer, value, numDigits);
+  return numDigits;
+}
+
+size_t mj::FormatInt64(wchar_t* pBuffer, int64_t value)
+{
+  if (value < 0)
+  {
+    *pBuffer = L'-';
+    // Negate as unsigned, so INT64_MIN does not overflow
+    return 1 + FormatUInt64(pBuffer + 1, 0 - static_cast<uint64_t>(value));
+  }
+
+  return FormatUInt64(pBuffer, static_cast<uint64_t>(value));
+}
+
+// Grisu2, as described in "Printing Floating-Point Numbers Quickly and Accurately with Integers"
+// by Florian Loitsch (2010). The output always round-trips, and is the shortest representation
+// for the vast majority of inputs.
+namespace grisu2
+{
+  struct DiyFp
+  {
+    uint64_t f;
+    int32_t e;
+  };
+
+  struct CachedPower
+  {
+    uint64_t f;
+    int32_t e;
+    int32_t k;
+  };
+
+  // Target range for the binary exponent of the scaled value, [ALPHA, -32]
+  static constexpr const int32_t ALPHA = -60;
+
+  // Normalized 64-bit approximations of 10^k for k = -300, -292, ..., 324
+  static const CachedPower s_CachedPowers[] = {
+    { 0xAB70FE17C79AC6CA, -1060, -300 }, { 0xFF77B1FCBEBCDC4F, -1034, -292 }, { 0xBE5691EF416BD60C, -1007, -284 },
+    { 0x8DD01FAD907FFC3C, -980, -276 },  { 0xD3515C2831559A83, -954, -268 },  { 0x9D71AC8FADA6C9B5, -927, -260 },
+    { 0xEA9C227723EE8BCB, -901, -252 },  { 0xAECC49914078536D, -874, -244 },  { 0x823C12795DB6CE57, -847, -236 },
+    { 0xC21094364DFB5637, -821, -228 },  { 0x9096EA6F3848984F, -794, -220 },  { 0xD77485CB25823AC7, -768, -212 },
+    { 0xA086CFCD97BF97F4, -741, -204 },  { 0xEF340A98172AACE5, -715, -196 },  { 0xB23867FB2A35B28E, -688, -188 },
+    { 0x84C8D4DFD2C63F3B, -661, -180 },  { 0xC5DD44271AD3CDBA, -635, -172 },  { 0x936B9FCEBB25C996, -608, -164 },
+    { 0xDBAC6C247D62A584, -582, -156 },  { 0xA3AB66580D5FDAF6, -555, -148 },  { 0xF3E2F893DEC3F126, -529, -140 },
+    { 0xB5B5ADA8AAFF80B8, -502, -132 },  { 0x87625F056C7C4A8B, -475, -124 },  { 0xC9BCFF6034C13053, -449, -116 },
+    { 0x964E858C91BA2655, -422, -108 },  { 0xDFF9772470297EBD, -396, -100 },  { 0xA6DFBD9FB8E5B88F, -369, -92 },
+    { 0xF8A95FCF88747D94, -343, -84 },   { 0xB94470938FA89BCF, -316, -76 },   { 0x8A08F0F8BF0F156B, -289, -68 },
+    { 0xCDB02555653131B6, -263, -60 },   { 0x993FE2C6D07B7FAC, -236, -52 },   { 0xE45C10C42A2B3B06, -210, -44 },
+    { 0xAA242499697392D3, -183, -36 },   { 0xFD87B5F28300CA0E, -157, -28 },   { 0xBCE5086492111AEB, -130, -20 },
+    { 0x8CBCCC096F5088CC, -103, -12 },   { 0xD1B71758E219652C, -77, -4 },     { 0x9C40000000000000, -50, 4 },
+    { 0xE8D4A51000000000, -24, 12 },     { 0xAD78EBC5AC620000, 3, 20 },       { 0x813F3978F8940984, 30, 28 },
+    { 0xC097CE7BC90715B3, 56, 36 },      { 0x8F7E32CE7BEA5C70, 83, 44 },      { 0xD5D238A4ABE98068, 109, 52 },
+    { 0x9F4F2726179A2245, 136, 60 },     { 0xED63A231D4C4FB27, 162, 68 },     { 0xB0DE65388CC8ADA8, 189, 76 },
+    { 0x83C7088E1AAB65DB, 216, 84 },     { 0xC45D1DF942711D9A, 242, 92 },     { 0x924D692CA61BE758, 269, 100 },
+    { 0xDA01EE641A708DEA, 295, 108 },    { 0xA26DA3999AEF774A, 322, 116 },    { 0xF209787BB47D6B85, 348, 124 },
+    { 0xB454E4A179DD1877, 375, 132 },    { 0x865B86925B9BC5C2, 402, 140 },    { 0xC83553C5C8965D3D, 428, 148 },
+    { 0x952AB45CFA97A0B3, 455, 156 },    { 0xDE469FBD99A05FE3, 481, 164 },    { 0xA59BC234DB398C25, 508, 172 },
+    { 0xF6C69A72A3989F5C, 534, 180 },    { 0xB7DCBF5354E9BECE, 561, 188 },    { 0x88FCF317F22241E2, 588, 196 },
+    { 0xCC20CE9BD35C78A5, 614, 204 },    { 0x98165AF37B2153DF, 641, 212 },    { 0xE2A0B5DC971F303A, 667, 220 },
+    { 0xA8D9D1535CE3B396, 694, 228 },    { 0xFB9B7CD9A4A7443C, 720, 236 },    { 0xBB764C4CA7A44410, 747, 244 },
+    { 0x8BAB8EEFB6409C1A, 774, 252 },    { 0xD01FEF10A657842C, 800, 260 },    { 0x9B10A4E5E9913129, 827, 268 },
+    { 0xE7109BFBA19C0C9D, 853, 276 },    { 0xAC2820D9623BF429, 880, 284 },    { 0x80444B5E7AA7CF85, 907, 292 },
+    { 0xBF21E44003ACDD2D, 933, 300 },    { 0x8E679C2F5E44FF8F, 960, 308 },    { 0xD433179D9C8CB841, 986, 316 },
+    { 0x9E19DB92B4E31BA9, 1013, 324 },
+  };
+
+  static DiyFp Sub(const DiyFp& x, const DiyFp& y)
+  {
+    return DiyFp{ x.f - y.f, x.e };
+  }
+
+  /// <summary>
+  /// Returns the upper 64 bits of the 128-bit product, rounded.
+  /// </summary>
+  static DiyFp Mul(const DiyFp& x, const DiyFp& y)
+  {
+    const uint64_t u_lo = x.f & 0xFFFFFFFFu;
+    const uint64_t u_hi = x.f >> 32;
+    const uint64_t v_lo = y.f & 0xFFFFFFFFu;
+    const uint64_t v_hi = y.f >> 32;
+
+    const uint64_t p0 = u_lo * v_lo;
+    const uint64_t p1 = u_lo * v_hi;
+    const uint64_t p2 = u_hi * v_lo;
+    const uint64_t p3 = u_hi * v_hi;
+
+    uint64_t q = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+    q += uint64_t{ 1 } << 31; // Round
+
+    return DiyFp{ p3 + (p1 >> 32) + (p2 >> 32) + (q >> 32), x.e + y.e + 64 };
+  }
+
+  static DiyFp Normalize(DiyFp x)
+  {
+    while ((x.f >> 63) == 0)
+    {
+      x.f <<= 1;
+      x.e--;
+    }
+    return x;
+  }
+
+  static DiyFp NormalizeTo(const DiyFp& x, int32_t targetExponent)
+  {
+    return DiyFp{ x.f << (x.e - targetExponent), targetExponent };
+  }
+
+  /// <summary>
+  /// Computes the boundaries m- and m+ of the rounding interval of v.
+  /// All three values share the same exponent.
+  /// </summary>
+  static void ComputeBoundaries(double value, DiyFp* pMinus, DiyFp* pValue, DiyFp* pPlus)
+  {
+    static constexpr const int32_t BIAS       = 1023 + 52;
+    static constexpr const int32_t MIN_EXP    = 1 - BIAS;
+    static constexpr const uint64_t HIDDEN_BIT = uint64_t{ 1 } << 52;
+
+    MJ_UNINITIALIZED uint64_t bits;
+    static_cast<void>(::memcpy(&bits, &value, sizeof(bits)));
+    const uint64_t E = bits >> 52;
+    const uint64_t F = bits & (HIDDEN_BIT - 1);
+
+    const DiyFp v = (E == 0) ? DiyFp{ F, MIN_EXP } : DiyFp{ F + HIDDEN_BIT, static_cast<int32_t>(E) - BIAS };
+
+    // The lower boundary is closer if v is a power of two (and not the smallest normal number)
+    const bool lowerBoundaryIsCloser = (F == 0 && E > 1);
+    const DiyFp plus                 = DiyFp{ 2 * v.f + 1, v.e - 1 };
+    const DiyFp minus = lowerBoundaryIsCloser ? DiyFp{ 4 * v.f - 1, v.e - 2 } : DiyFp{ 2 * v.f - 1, v.e - 1 };
+
+    *pPlus  = Normalize(plus);
+    *pMinus = NormalizeTo(minus, pPlus->e);
+    *pValue = Normalize(v);
+  }
+
+  /// <summary>
+  /// Finds a cached power c = 10^k such that ALPHA <= e + c.e + 64 <= -32.
+  /// </summary>
+  static CachedPower GetCachedPower(int32_t e)
+  {
+    static constexpr const int32_t MIN_DECIMAL_EXPONENT = -300;
+    static constexpr const int32_t DECIMAL_STEP         = 8;
+
+    // k = ceil((ALPHA - e - 1) * log10(2)), 78913 / 2^18 approximates log10(2)
+    const int32_t f = ALPHA - e - 1;
+    const int32_t k = (f * 78913) / (1 << 18) + (f > 0 ? 1 : 0);
+
+    const int32_t index = (-MIN_DECIMAL_EXPONENT + k + (DECIMAL_STEP - 1)) / DECIMAL_STEP;
+    return s_CachedPowers[index];
+  }
+
+  /// <summary>
+  /// Returns the number of digits of n (n < 10^10), and the largest power of ten that is less or equal.
+  /// </summary>
+  static int32_t FindLargestPow10(uint32_t n, uint32_t* pPow10)
+  {
+    static const uint32_t s_Pow10[] = { 1,      10,      100,      1000,      10000,
+                                        100000, 1000000, 10000000, 100000000, 1000000000 };
+    int32_t numDigits = 10;
+    while (numDigits > 1 && n < s_Pow10[numDigits - 1])
+    {
+      numDigits--;
+    }
+    *pPow10 = s_Pow10[numDigits - 1];
+    return numDigits;
+  }
+
+  static void Round(wchar_t* pBuffer, int32_t length, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t tenK)
+  {
+    // Move the last digit down while it brings us closer to v, and stays inside the rounding interval
+    while (rest < dist && delta - rest >= tenK && (rest + tenK < dist || dist - rest > rest + tenK - dist))
+    {
+      pBuffer[length - 1]--;
+      rest += tenK;
+    }
+  }
+
+  /// <summary>
+  /// Generates the shortest digit string in [M-, M+], starting from the most significant digit.
+  /// </summary>
+  static void GenerateDigits(wchar_t* pBuffer, int32_t* pLength, int32_t* pDecimalExponent, DiyFp M_minus, DiyFp w,
+                             DiyFp M_plus)
+  {
+    uint64_t delta = Sub(M_plus, M_minus).f;
+    uint64_t dist  = Sub(M_plus, w).f;
+
+    const DiyFp one = DiyFp{ uint64_t{ 1 } << -M_plus.e, M_plus.e };
+
+    uint32_t p1 = static_cast<uint32_t>(M_plus.f >> -one.e); // Integral part
+    uint64_t p2 = M_plus.f & (one.f - 1);                    // Fractional part
+
+    MJ_UNINITIALIZED uint32_t pow10;
+    int32_t n = FindLargestPow10(p1, &pow10);
+
+    int32_t length = 0;
+    while (n > 0)
+    {
+      const uint32_t d = p1 / pow10;
+      const uint32_t r = p1 % pow10;
+      pBuffer[length++] = static_cast<wchar_t>(L'0' + d);
+      p1                = r;
+      n--;
+
+      const uint64_t rest = (uint64_t{ p1 } << -one.e) + p2;
+      if (rest <= delta)
+      {
+        *pDecimalExponent += n;
+        *pLength = length;
+        Round(pBuffer, length, dist, delta, rest, uint64_t{ pow10 } << -one.e);
+        return;
+      }
+
+      pow10 /= 10;
+    }
+
+    int32_t m = 0;
+    while (true)
+    {
+      p2 *= 10;
+      const uint64_t d = p2 >> -one.e;
+      const uint64_t r = p2 & (one.f - 1);
+      pBuffer[length++] = static_cast<wchar_t>(L'0' + d);
+      p2                = r;
+      m++;
+
+      delta *= 10;
+      dist *= 10;
+      if (p2 <= delta)
+      {
+        break;
+      }
+    }
+
+    *pDecimalExponent -= m;
+    *pLength = length;
+    Round(pBuffer, length, dist, delta, p2, one.f);
+  }
+
+  /// <summary>
+  /// Writes the digits of a finite, positive value.
+  /// The value equals digits * 10^decimalExponent.
+  /// </summary>
+  static void Generate(wchar_t* pBuffer, int32_t* pLength, int32_t* pDecimalExponent, double value)
+  {
+    MJ_UNINITIALIZED DiyFp m_minus;
+    MJ_UNINITIALIZED DiyFp v;
+    MJ_UNINITIALIZED DiyFp m_plus;
+    ComputeBoundaries(value, &m_minus, &v, &m_plus);
+
+    const CachedPower cached = GetCachedPower(m_plus.e);
+    const DiyFp c_minus_k    = DiyFp{ cached.f, cached.e };
+
+    const DiyFp w       = Mul(v, c_minus_k);
+    const DiyFp w_minus = Mul(m_minus, c_minus_k);
+    const DiyFp w_plus  = Mul(m_plus, c_minus_k);
+
+    // Shrink the interval by one ulp on both sides to account for the rounding errors of Mul
+    const DiyFp M_minus = DiyFp{ w_minus.f + 1, w_minus.e };
+    const DiyFp M_plus  = DiyFp{ w_plus.f - 1, w_plus.e };
+
+    *pDecimalExponent = -cached.k;
+    GenerateDigits(pBuffer, pLength, pDecimalExponent, M_minus, w, M_plus);
+  }
+} // namespace grisu2
+
+static size_t WriteLiteral(wchar_t* pBuffer, const wchar_t* pLiteral)
+{
+  size_t numChars = 0;
+  while (pLiteral[numChars])
+  {
+    pBuffer[numChars] = pLiteral[numChars];
+    numChars++;
+  }
+  return numChars;
+}
+
+size_t mj::FormatDouble(wchar_t* pBuffer, double value)
+{
+  static constexpr const int32_t MIN_EXP = -4;
+  static constexpr const int32_t MAX_EXP = 16;
+
+  MJ_UNINITIALIZED uint64_t bits;
+  static_cast<void>(::memcpy(&bits, &value, sizeof(bits)));
+
+  wchar_t* pHead = pBuffer;
+  if (bits >> 63)
+  {
+    *pHead++ = L'-';
+    bits &= ~(uint64_t{ 1 } << 63);
+    static_cast<void>(::memcpy(&value, &bits, sizeof(bits)));
+  }
+
+  if ((bits >> 52) == 0x7FF)
+  {
+    if (bits & ((uint64_t{ 1 } << 52) - 1))
+    {
+      // NaN has no sign worth printing
+      return WriteLiteral(pBuffer, L"nan");
+    }
+    return (pHead - pBuffer) + WriteLiteral(pHead, L"inf");
+  }
+
+  if (bits == 0)
+  {
+    *pHead++ = L'0';
+    return pHead - pBuffer;
+  }
+
+  // Digits are generated in place, then moved around to insert the decimal point
+  MJ_UNINITIALIZED int32_t k;
+  MJ_UNINITIALIZED int32_t decimalExponent;
+  grisu2::Generate(pHead, &k, &decimalExponent, value);
+
+  // The decimal point goes after n digits
+  const int32_t n = k + decimalExponent;
+
+  if (k <= n && n <= MAX_EXP)
+  {
+    // Integer: digits followed by zeros, e.g. 1234500
+    for (int32_t i = k; i < n; i++)
+    {
+      pHead[i] = L'0';
+    }
+    pHead += n;
+  }
+  else if (0 < n && n <= MAX_EXP)
+  {
+    // Decimal point inside the digits, e.g. 1234.5
+    static_cast<void>(::memmove(pHead + n + 1, pHead + n, (k - n) * sizeof(wchar_t)));
+    pHead[n] = L'.';
+    pHead += k + 1;
+  }
+  else if (MIN_EXP < n && n <= 0)
+  {
+    // Leading zeros, e.g. 0.0012345
+    const int32_t numZeros = -n;
+    static_cast<void>(::memmove(pHead + 2 + numZeros, pHead, k * sizeof(wchar_t)));
+    pHead[0] = L'0';
+    pHead[1] = L'.';
+    for (int32_t i = 0; i < numZeros; i++)
+    {
+      pHead[2 + i] = L'0';
+    }
+    pHead += 2 + numZeros + k;
+  }
+  else
+  {
+    // Scientific notation, e.g. 1.2345e+20
+    if (k > 1)
+    {
+      static_cast<void>(::memmove(pHead + 2, pHead + 1, (k - 1) * sizeof(wchar_t)));
+      pHead[1] = L'.';
+      pHead += k + 1;
+    }
+    else
+    {
+      pHead += 1;
+    }
+
+    int32_t exponent = n - 1;
+    *pHead++         = L'e';
+    if (exponent < 0)
+    {
+      *pHead++ = L'-';
+      exponent = -exponent;
+    }
+    else
+    {
+      *pHead++ = L'+';
+    }
+
+    // At least two exponent digits, like printf
+    uint32_t numDigits = CountDigits(static_cast<uint64_t>(exponent));
+    if (numDigits < 2)
+    {
+      numDigits = 2;
+    }
+    WriteDigits(pHead, static_cast<uint64_t>(exponent), numDigits);
+    if (exponent < 10)
+    {
+      pHead[0] = L'0';
+    }
+    pHead += numDigits;
+  }
+
+  return pHead - pBuffer;
+}
+
+size_t mj::FormatByteSize(wchar_t* pBuffer, uint64_t numBytes)
+{
+  static const wchar_t* s_Units[] = { L" B", L" KiB", L" MiB", L" GiB", L" TiB", L" PiB", L" EiB" };
+
+  if (numBytes < 1024)
+  {
+    size_t numChars = FormatUInt64(pBuffer, numBytes);
+    return numChars + WriteLiteral(pBuffer + numChars, s_Units[0]);
+  }
+
+  uint32_t unit = 1;
+  while (unit < MJ_COUNTOF(s_Units) - 1 && (numBytes >> (10 * (unit + 1))) != 0)
+  {
+    unit++;
+  }
+
+  // Integer and fractional part in tenths, rounded to nearest.
+  // The remainder is less than 2^60, so multiplying by ten cannot overflow.
+  const uint32_t shift     = 10 * unit;
+  const uint64_t remainder = numBytes & ((uint64_t{ 1 } << shift) - 1);
+  uint64_t whole           = numBytes >> shift;
+  uint64_t tenths          = (remainder * 10 + (uint64_t{ 1 } << (shift - 1))) >> shift;
+  if (tenths == 10)
+  {
+    whole++;
+    tenths = 0;
+    if (whole == 1024 && unit < MJ_COUNTOF(s_Units) - 1)
+    {
+      whole = 1;
+      unit++;
+    }
+  }
+
+  size_t numChars     = FormatUInt64(pBuffer, whole);
+  pBuffer[numChars++] = L'.';
+  pBuffer[numChars++] = static_cast<wchar_t>(L'0' + tenths);
+  return numChars + WriteLiteral(pBuffer + numChars, s_Units[unit]);
+}
+
+size_t mj::FormatFileTime(wchar_t* pBuffer, uint64_t fileTime, int32_t biasMinutes)
+{
+  // Days between 1601-01-01 and 1970-01-01
+  static constexpr const int64_t EPOCH_DIFFERENCE_DAYS = 134774;
+
+  int64_t minutes = static_cast<int64_t>(fileTime / (10000000ull * 60)) + biasMinutes;
+  int64_t days    = minutes / (60 * 24);
+  int64_t minute  = minutes - days * (60 * 24);
+  if (minute < 0)
+  {
+    minute += 60 * 24;
+    days--;
+  }
+
+  // Civil date from days since 1970-01-01 (Howard Hinnant, "chrono-Compatible Low-Level Date Algorithms")
+  const int64_t z   = days - EPOCH_DIFFERENCE_DAYS + 719468;
+  const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const int64_t doe = z - era * 146097;                                 // [0, 146096]
+  const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; // [0, 399]
+  const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);          // [0, 365]
+  const int64_t mp  = (5 * doy + 2) / 153;                              // [0, 11]
+  const int64_t day = doy - (153 * mp + 2) / 5 + 1;                     // [1, 31]
+  const int64_t mon = mp < 10 ? mp + 3 : mp - 9;                        // [1, 12]
+  const int64_t yr  = yoe + era * 400 + (mon <= 2 ? 1 : 0);
+
+  // Any 64-bit value falls in the years 1600 (with a negative bias) to 60056, so the year has four or five digits
+  wchar_t* pHead = pBuffer;
+  uint32_t numYearDigits = CountDigits(static_cast<uint64_t>(yr));
+  WriteDigits(pHead, static_cast<uint64_t>(yr), numYearDigits);
+  pHead += numYearDigits;
+  *pHead++ = L'-';
+  WriteDigits(pHead, static_cast<uint64_t>(mon), 2);
+  if (mon < 10)
+  {
+    pHead[0] = L'0';
+  }
+  pHead += 2;
+  *pHead++ = L'-';
+  WriteDigits(pHead, static_cast<uint64_t>(day), 2);
+  if (day < 10)
+  {
+    pHead[0] = L'0';
+  }
+  pHead += 2;
+  *pHead++ = L' ';
+
+  const uint32_t hh = static_cast<uint32_t>(minute / 60) * 2;
+  const uint32_t mm = static_cast<uint32_t>(minute % 60) * 2;
+  *pHead++          = s_DigitPairs[hh];
+  *pHead++          = s_DigitPairs[hh + 1];
+  *pHead++          = L':';
+  *pHead++          = s_DigitPairs[mm];
+  *pHead++          = s_DigitPairs[mm + 1];
+
+  return pHead - pBuffer;
+}
+
+bool mj::ParseUInt64(const StringView& string, uint64_t* pNumber)
+{
+  if (string.len == 0)
+  {
+    return false;
+  }
+
+  uint64_t value = 0;
+  for (size_t i = 0; i < string.len; i++)
+  {
+    // Unsigned wrap-around turns every non-digit into a value >= 10
+    const uint32_t digit = static_cast<uint32_t>(string.ptr[i]) - L'0';
+    if (digit >= 10)
+    {
+      return false;
+    }
+
+    // value * 10 + digit > UINT64_MAX
+    if (value > (UINT64_MAX - digit) / 10)
+    {
+      return false;
+    }
+
+    value = value * 10 + digit;
+  }
+
+  *pNumber = value;
+  return true;
+}
+
+bool mj::ParseUInt32(const StringView& string, uint32_t* pNumber)
+{
+  MJ_UNINITIALIZED uint64_t value;
+  if (ParseUInt64(string, &value) && value <= UINT32_MAX)
+  {
+    *pNumber = static_cast<uint32_t>(value);
+    return true;
+  }
+
+  return false;
+}
+
+bool mj::ParseInt64(const StringView& string, int64_t* pNumber)
+{
+  if (string.len == 0)
+  {
+    return false;
+  }
+
+  bool isNegative = string.ptr[0] == L'-';
+  MJ_UNINITIALIZED StringView digits;
+  if (isNegative || string.ptr[0] == L'+')
+  {
+    digits.Init(string.ptr + 1, string.len - 1);
+  }
+  else
+  {
+    digits = string;
+  }
+
+  MJ_UNINITIALIZED uint64_t magnitude;
+  if (!ParseUInt64(digits, &magnitude))
+  {
+    return false;
+  }
+
+  if (isNegative)
+  {
+    // The magnitude of INT64_MIN is one larger than INT64_MAX
+    if (magnitude > static_cast<uint64_t>(INT64_MAX) + 1)
+    {
+      return false;
+    }
+    *pNumber = static_cast<int64_t>(0 - magnitude);
+  }
+  else
+  {
+    if (magnitude > static_cast<uint64_t>(INT64_MAX))
+    {
+      return false;
+    }
+    *pNumber = static_cast<int64_t>(magnitude);
+  }
+
+  return true;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "mj_macro.h"
+
+namespace mj
+{
+  struct StringView;
+
+  // Buffer sizes (in characters) that fit any output of the matching Format function.
+  // None of the Format functions write a null terminator.
+  static constexpr const size_t UINT64_MAX_CHARS    = 20; // 18446744073709551615
+  static constexpr const size_t INT64_MAX_CHARS     = 20; // -9223372036854775808
+  static constexpr const size_t DOUBLE_MAX_CHARS    = 25; // -2.2250738585072014e-308
+  static constexpr const size_t BYTE_SIZE_MAX_CHARS = 10; // 1023.9 KiB
+  static constexpr const size_t FILE_TIME_MAX_CHARS = 17; // 60056-05-28 05:36
+
+  /// <summary>
+  /// Writes the decimal representation of an unsigned integer.
+  /// Uses a digit pair table, so it only divides once per two digits.
+  /// </summary>
+  /// <param name="pBuffer">Output buffer of at least UINT64_MAX_CHARS characters</param>
+  /// <returns>Number of characters written</returns>
+  size_t FormatUInt64(wchar_t* pBuffer, uint64_t value);
+
+  /// <summary>
+  /// Writes the decimal representation of a signed integer.
+  /// </summary>
+  /// <param name="pBuffer">Output buffer of at least INT64_MAX_CHARS characters</param>
+  /// <returns>Number of characters written</returns>
+  size_t FormatInt64(wchar_t* pBuffer, int64_t value);
+
+  /// <summary>
+  /// Writes the shortest decimal representation that parses back to the same double (Grisu2).
+  /// Uses fixed notation for decimal exponents in [-4, 15], scientific notation otherwise.
+  /// NaN and infinity are written as "nan", "inf" and "-inf".
+  /// </summary>
+  /// <param name="pBuffer">Output buffer of at least DOUBLE_MAX_CHARS characters</param>
+  /// <returns>Number of characters written</returns>
+  size_t FormatDouble(wchar_t* pBuffer, double value);
+
+  /// <summary>
+  /// Writes a human-readable size using binary units, e.g. "512 B", "1.2 GiB".
+  /// Uses integer arithmetic only. Rounds to one decimal.
+  /// </summary>
+  /// <param name="pBuffer">Output buffer of at least BYTE_SIZE_MAX_CHARS characters</param>
+  /// <returns>Number of characters written</returns>
+  size_t FormatByteSize(wchar_t* pBuffer, uint64_t numBytes);
+
+  /// <summary>
+  /// Writes a FILETIME value (100-nanosecond intervals since 1601-01-01 UTC) as "YYYY-MM-DD HH:MM".
+  /// Does not call into the OS, so it is cheap enough to run for every row of a listing.
+  /// </summary>
+  /// <param name="pBuffer">Output buffer of at least FILE_TIME_MAX_CHARS characters</param>
+  /// <param name="fileTime">FILETIME as a 64-bit integer</param>
+  /// <param name="biasMinutes">Offset that is added to UTC, e.g. 120 for UTC+2</param>
+  /// <returns>Number of characters written</returns>
+  size_t FormatFileTime(wchar_t* pBuffer, uint64_t fileTime, int32_t biasMinutes = 0);
+
+  /// <summary>
+  /// Parses a string of decimal digits. No sign, no whitespace.
+  /// </summary>
+  /// <returns>False if the string is empty, contains a non-digit or does not fit.
+  /// The output is only written on success.</returns>
+  bool ParseUInt32(const StringView& string, uint32_t* pNumber);
+
+  /// <summary>
+  /// Parses a string of decimal digits. No sign, no whitespace.
+  /// </summary>
+  /// <returns>False if the string is empty, contains a non-digit or does not fit.
+  /// The output is only written on success.</returns>
+  bool ParseUInt64(const StringView& string, uint64_t* pNumber);
+
+  /// <summary>
+  /// Parses a string of decimal digits with an optional leading '+' or '-'.
+  /// </summary>
+  /// <returns>False if the string is empty, contains a non-digit or does not fit.
+  /// The output is only written on success.</returns>
+  bool ParseInt64(const StringView& string, int64_t* pNumber);
+} // namespace mj
@@ -0,0 +1,290 @@
+#include "pch.h"
+#include "mj_pathtree.h"
+
+namespace mj
+{
+  static constexpr const size_t MIN_SLOTS = 16;
+
+  static uint32_t HashName(const StringView& name)
+  {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < name.len; i++)
+    {
+      hash ^= name.ptr[i];
+      hash *= 16777619u;
+    }
+    return hash;
+  }
+
+  static uint32_t HashNode(uint32_t parent, uint32_t name)
+  {
+    uint32_t hash = parent * 0x9E3779B1u ^ name * 0x85EBCA77u;
+    return hash ^ (hash >> 15);
+  }
+
+  static bool NamesEqual(const StringView& a, const StringView& b)
+  {
+    return a.len == b.len && ::memcmp(a.ptr, b.ptr, a.len * sizeof(wchar_t)) == 0;
+  }
+
+  /// <summary>
+  /// Keeps hash tables at most half full.
+  /// </summary>
+  static bool IsFull(const ArrayList<uint32_t>& slots, size_t numEntries)
+  {
+    return 2 * (numEntries + 1) > slots.Size();
+  }
+
+  /// <summary>
+  /// Doubles the number of slots and empties them.
+  /// </summary>
+  static uint32_t* ResetSlots(ArrayList<uint32_t>& slots)
+  {
+    size_t numSlots = mj::max(MIN_SLOTS, 2 * slots.Size());
+    slots.Clear();
+    uint32_t* pSlots = slots.Emplace(numSlots);
+    if (pSlots)
+    {
+      static_cast<void>(::memset(pSlots, 0, numSlots * sizeof(uint32_t)));
+    }
+    return pSlots;
+  }
+
+  static void InsertSlot(uint32_t* pSlots, size_t numSlots, uint32_t hash, size_t entry)
+  {
+    size_t slot = hash & (numSlots - 1);
+    while (pSlots[slot] != 0)
+    {
+      slot = (slot + 1) & (numSlots - 1);
+    }
+    pSlots[slot] = static_cast<uint32_t>(entry + 1);
+  }
+} // namespace mj
+
+void mj::PathTree::Init(AllocatorBase* pAllocator)
+{
+  this->names.Init(pAllocator);
+  this->nameSlots.Init(pAllocator);
+  this->nodes.Init(pAllocator);
+  this->nodeSlots.Init(pAllocator);
+}
+
+void mj::PathTree::Destroy()
+{
+  this->names.Destroy();
+  this->nameSlots.Destroy();
+  this->nodes.Destroy();
+  this->nodeSlots.Destroy();
+}
+
+bool mj::PathTree::GrowNameSlots()
+{
+  if (!IsFull(this->nameSlots, this->names.Size()))
+  {
+    return true;
+  }
+
+  uint32_t* pSlots = ResetSlots(this->nameSlots);
+  if (!pSlots)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < this->names.Size(); i++)
+  {
+    InsertSlot(pSlots, this->nameSlots.Size(), HashName(this->names.Get(i)), i);
+  }
+  return true;
+}
+
+bool mj::PathTree::GrowNodeSlots()
+{
+  if (!IsFull(this->nodeSlots, this->nodes.Size()))
+  {
+    return true;
+  }
+
+  uint32_t* pSlots = ResetSlots(this->nodeSlots);
+  if (!pSlots)
+  {
+    return false;
+  }
+
+  const Node* pNodes = this->nodes.Get();
+  for (size_t i = 0; i < this->nodes.Size(); i++)
+  {
+    InsertSlot(pSlots, this->nodeSlots.Size(), HashNode(pNodes[i].parent, pNodes[i].name), i);
+  }
+  return true;
+}
+
+uint32_t mj::PathTree::InternName(const StringView& name)
+{
+  if (!this->GrowNameSlots())
+  {
+    return NO_NODE;
+  }
+
+  uint32_t* pSlots  = this->nameSlots.begin();
+  const size_t mask = this->nameSlots.Size() - 1;
+  size_t slot       = HashName(name) & mask;
+  while (pSlots[slot] != 0)
+  {
+    uint32_t id = pSlots[slot] - 1;
+    if (NamesEqual(this->names.Get(id), name))
+    {
+      return id;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  if (!this->names.Add(name))
+  {
+    return NO_NODE;
+  }
+
+  uint32_t id  = static_cast<uint32_t>(this->names.Size() - 1);
+  pSlots[slot] = id + 1;
+  return id;
+}
+
+uint32_t mj::PathTree::Add(uint32_t parent, const StringView& name)
+{
+  uint32_t nameId = this->InternName(name);
+  if (nameId == NO_NODE || !this->GrowNodeSlots())
+  {
+    return NO_NODE;
+  }
+
+  uint32_t* pSlots  = this->nodeSlots.begin();
+  const size_t mask = this->nodeSlots.Size() - 1;
+  size_t slot       = HashNode(parent, nameId) & mask;
+  while (pSlots[slot] != 0)
+  {
+    uint32_t node     = pSlots[slot] - 1;
+    const Node& entry = this->nodes.Get()[node];
+    if (entry.parent == parent && entry.name == nameId)
+    {
+      return node;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  MJ_UNINITIALIZED Node node;
+  node.parent = parent;
+  node.name   = nameId;
+  if (!this->nodes.Add(node))
+  {
+    return NO_NODE;
+  }
+
+  uint32_t index = static_cast<uint32_t>(this->nodes.Size() - 1);
+  pSlots[slot]   = index + 1;
+  return index;
+}
+
+uint32_t mj::PathTree::AddPath(uint32_t parent, const StringView& path)
+{
+  uint32_t node = parent;
+  size_t begin  = 0;
+  while (begin < path.len)
+  {
+    size_t end = begin;
+    while (end < path.len && path.ptr[end] != L'\\')
+    {
+      end++;
+    }
+
+    // Skip empty components, e.g. from a trailing backslash
+    if (end > begin)
+    {
+      MJ_UNINITIALIZED StringView name;
+      name.Init(path.ptr + begin, end - begin);
+      node = this->Add(node, name);
+      if (node == NO_NODE)
+      {
+        return NO_NODE;
+      }
+    }
+
+    begin = end + 1;
+  }
+
+  return node;
+}
+
+uint32_t mj::PathTree::GetParent(uint32_t node) const
+{
+  return this->nodes.Get()[node].parent;
+}
+
+mj::StringView mj::PathTree::GetName(uint32_t node) const
+{
+  return this->names.Get(this->nodes.Get()[node].name);
+}
+
+size_t mj::PathTree::NumNodes() const
+{
+  return this->nodes.Size();
+}
+
+size_t mj::PathTree::ByteWidth() const
+{
+  return this->names.ByteWidth() + this->nameSlots.ByteWidth() + this->nodes.ByteWidth() +
+         this->nodeSlots.ByteWidth();
+}
+
+mj::StringView mj::PathTree::GetPath(uint32_t node, ArrayList<wchar_t>& buffer) const
+{
+  MJ_UNINITIALIZED StringView child;
+  child.Init(L"", 0);
+  return this->GetPath(node, child, buffer);
+}
+
+mj::StringView mj::PathTree::GetPath(uint32_t node, const StringView& child, ArrayList<wchar_t>& buffer) const
+{
+  // One separator after each component, the last one becomes the null terminator
+  size_t length = child.len > 0 ? child.len + 1 : 0;
+  for (uint32_t i = node; i != NO_NODE; i = this->GetParent(i))
+  {
+    length += this->GetName(i).len + 1;
+  }
+
+  MJ_UNINITIALIZED StringView path;
+  path.Init(L"", 0);
+
+  buffer.Clear();
+  wchar_t* pPath = buffer.Emplace(length);
+  if (!pPath)
+  {
+    return path;
+  }
+
+  // Fill from the end, walking up to the root
+  size_t end  = length - 1;
+  pPath[end]  = L'\0';
+  wchar_t sep = L'\0';
+  if (child.len > 0)
+  {
+    end -= child.len;
+    static_cast<void>(::memcpy(pPath + end, child.ptr, child.len * sizeof(wchar_t)));
+    sep = L'\\';
+  }
+
+  for (uint32_t i = node; i != NO_NODE; i = this->GetParent(i))
+  {
+    if (sep != L'\0')
+    {
+      pPath[--end] = sep;
+    }
+
+    StringView name = this->GetName(i);
+    end -= name.len;
+    static_cast<void>(::memcpy(pPath + end, name.ptr, name.len * sizeof(wchar_t)));
+    sep = L'\\';
+  }
+
+  path.Init(pPath, length - 1);
+  return path;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "mj_string.h"
+
+namespace mj
+{
+  /// <summary>
+  /// Folder hierarchy stored as nodes that hold a parent index and a name ID.
+  /// Names are interned, so memory grows with the number of distinct path components
+  /// instead of the sum of path lengths. Full paths are materialized on demand.
+  /// Adding is idempotent: the same (parent, name) pair always yields the same node.
+  /// Not thread-safe; workers get materialized paths or a tree of their own.
+  /// </summary>
+  class PathTree
+  {
+  public:
+    static constexpr const uint32_t NO_NODE = 0xFFFFFFFFu;
+
+  private:
+    struct Node
+    {
+      MJ_UNINITIALIZED uint32_t parent;
+      MJ_UNINITIALIZED uint32_t name;
+    };
+
+    CompactStringCache names;
+    ArrayList<uint32_t> nameSlots; // Open addressing: name ID + 1, 0 if the slot is empty
+    ArrayList<Node> nodes;
+    ArrayList<uint32_t> nodeSlots; // Open addressing on (parent, name): node + 1, 0 if the slot is empty
+
+  public:
+    /// <summary>
+    /// Does no allocation on construction.
+    /// </summary>
+    void Init(AllocatorBase* pAllocator);
+    void Destroy();
+
+    /// <summary>
+    /// Returns the node for a name in a folder, adding it if it does not exist yet.
+    /// </summary>
+    /// <param name="parent">NO_NODE for a root, such as a drive</param>
+    /// <returns>NO_NODE if allocation failed</returns>
+    uint32_t Add(uint32_t parent, const StringView& name);
+
+    /// <summary>
+    /// Adds every component of a backslash-separated path.
+    /// </summary>
+    /// <returns>The node of the last component, or NO_NODE if allocation failed</returns>
+    uint32_t AddPath(uint32_t parent, const StringView& path);
+
+    uint32_t GetParent(uint32_t node) const;
+    StringView GetName(uint32_t node) const;
+    size_t NumNodes() const;
+    size_t ByteWidth() const;
+
+    /// <summary>
+    /// Writes the full path of a node into a reusable buffer, separated by backslashes and null-terminated.
+    /// The view is valid until the buffer changes.
+    /// </summary>
+    StringView GetPath(uint32_t node, ArrayList<wchar_t>& buffer) const;
+
+    /// <summary>
+    /// Same as GetPath, with a child name appended that does not have to be in the tree (e.g. "*" or a file).
+    /// </summary>
+    StringView GetPath(uint32_t node, const StringView& child, ArrayList<wchar_t>& buffer) const;
+
+  private:
+    uint32_t InternName(const StringView& name);
+    bool GrowNameSlots();
+    bool GrowNodeSlots();
+  };
+} // namespace mj
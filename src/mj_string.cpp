@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "mj_string.h"
+#include "mj_number.h"
 #include "ErrorExit.h"
 
 // The StringBuilder only adds a null terminator in the ToStringClosed() function.
@@ -47,26 +48,7 @@ bool mj::StringView::IsEmpty() const
 
 bool mj::StringView::ParseNumber(uint32_t* pNumber) const
 {
-  const wchar_t* pC = this->ptr;
-  *pNumber          = 0;
-  for (size_t i = 0; i < this->len; i++)
-  {
-    *pNumber *= 10;
-    if (*pC >= 0x30)
-    {
-      wchar_t digit = *pC - 0x30;
-      if (digit < 10)
-      {
-        *pNumber += digit;
-      }
-      else
-      {
-        return false;
-      }
-    }
-    pC++;
-  }
-  return false;
+  return mj::ParseUInt32(*this, pNumber);
 }
 
 /// <summary>
@@ -183,35 +165,46 @@ void mj::StringBuilder::Clear()
 
 mj::StringBuilder& mj::StringBuilder::Append(int32_t integer)
 {
-  // TODO: Do we actually ever print a null terminator?
-  wchar_t buf[12]; // E.g. ['-', '2', '1', '4', '7', '4', '8', '3', '6', '4', '8', '\0']
-  wchar_t* pEnd   = buf + MJ_COUNTOF(buf);
-  wchar_t* pHead  = pEnd;
-  bool isNegative = integer < 0;
+  return this->AppendInt64(integer);
+}
 
-  if (isNegative)
-  {
-    integer = -integer;
-  }
+mj::StringBuilder& mj::StringBuilder::AppendUInt64(uint64_t number)
+{
+  wchar_t buf[mj::UINT64_MAX_CHARS];
+  MJ_UNINITIALIZED StringView string;
+  string.Init(buf, mj::FormatUInt64(buf, number));
+  return this->Append(string);
+}
 
-  do
-  {
-    int32_t div = integer / 10;                      // Calculate next value
-    --pHead;                                         // fill it backwards
-    *pHead  = s_IntToWideChar[integer - (div * 10)]; // Calculate rest value
-    integer = div;                                   // Decimal 10 conversion
-  } while (integer);
+mj::StringBuilder& mj::StringBuilder::AppendInt64(int64_t number)
+{
+  wchar_t buf[mj::INT64_MAX_CHARS];
+  MJ_UNINITIALIZED StringView string;
+  string.Init(buf, mj::FormatInt64(buf, number));
+  return this->Append(string);
+}
 
-  // Add sign
-  if (isNegative)
-  {
-    --pHead;
-    *pHead = '-';
-  }
+mj::StringBuilder& mj::StringBuilder::AppendDouble(double number)
+{
+  wchar_t buf[mj::DOUBLE_MAX_CHARS];
+  MJ_UNINITIALIZED StringView string;
+  string.Init(buf, mj::FormatDouble(buf, number));
+  return this->Append(string);
+}
 
-  ptrdiff_t numChars = pEnd - pHead;
+mj::StringBuilder& mj::StringBuilder::AppendByteSize(uint64_t numBytes)
+{
+  wchar_t buf[mj::BYTE_SIZE_MAX_CHARS];
   MJ_UNINITIALIZED StringView string;
-  string.Init(pHead, numChars);
+  string.Init(buf, mj::FormatByteSize(buf, numBytes));
+  return this->Append(string);
+}
+
+mj::StringBuilder& mj::StringBuilder::AppendFileTime(uint64_t fileTime, int32_t biasMinutes)
+{
+  wchar_t buf[mj::FILE_TIME_MAX_CHARS];
+  MJ_UNINITIALIZED StringView string;
+  string.Init(buf, mj::FormatFileTime(buf, fileTime, biasMinutes));
   return this->Append(string);
 }
 
@@ -456,3 +449,462 @@ mj::StringCache::operator mj::ArrayListView<const mj::StringView>()
 {
   return mj::ArrayListView(this->strings.Get(), this->strings.Size());
 }
+
+void mj::CompactStringCache::Init(AllocatorBase* pAllocator)
+{
+  this->Destroy();
+  // Use the same allocator for both
+  this->offsets.Init(pAllocator);
+  this->buffer.Init(pAllocator);
+}
+
+void mj::CompactStringCache::Destroy()
+{
+  this->offsets.Destroy();
+  this->buffer.Destroy();
+}
+
+bool mj::CompactStringCache::Add(const wchar_t* pStringLiteral)
+{
+  MJ_UNINITIALIZED StringView string;
+  string.Init(pStringLiteral);
+  return this->Add(string);
+}
+
+bool mj::CompactStringCache::Add(const StringView& string)
+{
+  size_t destSize = string.len + 1; // Include null terminator
+  if (this->buffer.Size() + destSize > UINT32_MAX)
+  {
+    return false;
+  }
+
+  // Grow geometrically, Reserve only allocates what is asked for
+  size_t numOffsets = this->offsets.Size() == this->offsets.Capacity() ? mj::max<size_t>(this->offsets.Size(), 16) : 1;
+  size_t numChars   = this->buffer.Size() + destSize > this->buffer.Capacity() //
+                          ? mj::max(this->buffer.Size(), destSize)
+                          : destSize;
+
+  if (this->offsets.Reserve(numOffsets) && this->buffer.Reserve(numChars))
+  {
+    // These pointers should always be valid after calling Reserve
+    uint32_t* pOffset = this->offsets.Emplace(1);
+    wchar_t* pDest    = this->buffer.Emplace(destSize);
+
+    ::memcpy(pDest, string.ptr, string.len * sizeof(wchar_t));
+    pDest[string.len] = L'\0';
+
+    *pOffset = static_cast<uint32_t>(this->buffer.Size());
+    return true;
+  }
+
+  return false;
+}
+
+bool mj::CompactStringCache::Reserve(size_t numStrings, size_t numChars)
+{
+  if (numStrings == 0)
+  {
+    return true;
+  }
+
+  return this->offsets.Reserve(numStrings) && this->buffer.Reserve(numChars + numStrings);
+}
+
+void mj::CompactStringCache::Pop()
+{
+  auto size = this->offsets.Size();
+  if (size > 0)
+  {
+    size_t begin = size > 1 ? this->offsets[size - 2] : 0;
+    this->offsets.Erase(size - 1, 1);
+    this->buffer.Erase(begin, this->buffer.Size() - begin);
+  }
+}
+
+bool mj::CompactStringCache::Copy(const CompactStringCache& other)
+{
+  return this->offsets.Copy(other.offsets) && this->buffer.Copy(other.buffer);
+}
+
+void mj::CompactStringCache::Clear()
+{
+  this->offsets.Clear();
+  this->buffer.Clear();
+}
+
+size_t mj::CompactStringCache::Size() const
+{
+  return this->offsets.Size();
+}
+
+mj::StringView mj::CompactStringCache::Get(size_t index) const
+{
+  const uint32_t* pOffsets = this->offsets.Get();
+  uint32_t begin           = index > 0 ? pOffsets[index - 1] : 0;
+
+  MJ_UNINITIALIZED StringView string;
+  string.Init(this->buffer.Get() + begin, pOffsets[index] - begin - 1);
+  return string;
+}
+
+size_t mj::CompactStringCache::ByteWidth() const
+{
+  return this->offsets.ByteWidth() + this->buffer.ByteWidth();
+}
+
+void mj::FrontCodedStringCache::Init(AllocatorBase* pAllocator)
+{
+  this->Destroy();
+  this->restarts.Init(pAllocator);
+  this->data.Init(pAllocator);
+}
+
+void mj::FrontCodedStringCache::Destroy()
+{
+  this->restarts.Destroy();
+  this->data.Destroy();
+  this->numStrings = 0;
+  this->maxLength  = 0;
+}
+
+bool mj::FrontCodedStringCache::Build(ArrayListView<const StringView> sorted)
+{
+  static constexpr const size_t MAX_LENGTH = 0x7FFF;
+
+  this->restarts.Clear();
+  this->data.Clear();
+  this->numStrings = 0;
+  this->maxLength  = 0;
+
+  // Restart points share nothing with the previous string
+  auto GetSharedLength = [&sorted](size_t i) {
+    size_t shared = 0;
+    if (i % BLOCK_SIZE != 0)
+    {
+      const StringView& previous = sorted[i - 1];
+      const StringView& string   = sorted[i];
+      size_t maxShared           = mj::min(previous.len, string.len);
+      while (shared < maxShared && previous.ptr[shared] == string.ptr[shared])
+      {
+        shared++;
+      }
+    }
+    return shared;
+  };
+
+  // Both arrays are sized up front: Emplace only grows to the size asked for, so growing per string is quadratic
+  size_t numChars = 0;
+  for (size_t i = 0; i < sorted.Size(); i++)
+  {
+    if (sorted[i].len > MAX_LENGTH)
+    {
+      return false;
+    }
+    numChars += ((i % BLOCK_SIZE == 0) ? 1 : 2) + sorted[i].len - GetSharedLength(i);
+  }
+  size_t numRestarts = (sorted.Size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  if ((numRestarts > 0 && !this->restarts.Reserve(numRestarts)) || (numChars > 0 && !this->data.Reserve(numChars)))
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < sorted.Size(); i++)
+  {
+    const StringView& string = sorted[i];
+
+    // Restart point: [length][characters]
+    // Other strings: [shared prefix length][suffix length][suffix characters]
+    if (i % BLOCK_SIZE == 0)
+    {
+      // Reserved above, cannot fail
+      *this->restarts.Emplace(1) = static_cast<uint32_t>(this->data.Size());
+    }
+
+    size_t shared       = GetSharedLength(i);
+    size_t suffixLength = string.len - shared;
+    size_t headerLength = (i % BLOCK_SIZE == 0) ? 1 : 2;
+    wchar_t* pDest      = this->data.Emplace(headerLength + suffixLength);
+
+    if (headerLength == 2)
+    {
+      *pDest++ = static_cast<wchar_t>(shared);
+    }
+    *pDest++ = static_cast<wchar_t>(suffixLength);
+    static_cast<void>(::memcpy(pDest, string.ptr + shared, suffixLength * sizeof(wchar_t)));
+
+    this->maxLength = mj::max(this->maxLength, string.len);
+  }
+
+  this->numStrings = sorted.Size();
+  return true;
+}
+
+size_t mj::FrontCodedStringCache::Size() const
+{
+  return this->numStrings;
+}
+
+size_t mj::FrontCodedStringCache::MaxLength() const
+{
+  return this->maxLength;
+}
+
+mj::StringView mj::FrontCodedStringCache::Get(size_t index, wchar_t* pBuffer) const
+{
+  const wchar_t* pData = this->data.Get() + this->restarts.Get()[index / BLOCK_SIZE];
+
+  // Restart point
+  size_t length = *pData++;
+  static_cast<void>(::memcpy(pBuffer, pData, length * sizeof(wchar_t)));
+  pData += length;
+
+  // Apply suffixes up to the requested string
+  for (size_t i = 0; i < index % BLOCK_SIZE; i++)
+  {
+    size_t shared       = *pData++;
+    size_t suffixLength = *pData++;
+    static_cast<void>(::memcpy(pBuffer + shared, pData, suffixLength * sizeof(wchar_t)));
+    pData += suffixLength;
+    length = shared + suffixLength;
+  }
+
+  MJ_UNINITIALIZED StringView string;
+  string.Init(pBuffer, length);
+  return string;
+}
+
+bool mj::FrontCodedStringCache::Find(const StringView& string, size_t* pIndex) const
+{
+  size_t numBlocks = this->restarts.Size();
+  if (numBlocks == 0)
+  {
+    return false;
+  }
+
+  // Find the last block whose restart point is less or equal to the string
+  const wchar_t* pData   = this->data.Get();
+  const uint32_t* pStart = this->restarts.Get();
+  size_t low             = 0;
+  size_t high            = numBlocks;
+  while (high - low > 1)
+  {
+    size_t mid = low + (high - low) / 2;
+    MJ_UNINITIALIZED StringView restart;
+    restart.Init(pData + pStart[mid] + 1, pData[pStart[mid]]);
+    if (CompareOrdinal(restart, string) <= 0)
+    {
+      low = mid;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+
+  // Scan the block. Strings are sorted, so the shared prefix with the target
+  // can only be extended by a string that matches it up to that point.
+  const wchar_t* pIt = pData + pStart[low];
+  size_t length      = *pIt++;
+  const wchar_t* pSuffix = pIt;
+  pIt += length;
+
+  // Number of leading characters of the current string that match the target
+  size_t matched = 0;
+  while (matched < length && matched < string.len && pSuffix[matched] == string.ptr[matched])
+  {
+    matched++;
+  }
+
+  size_t blockSize = mj::min(BLOCK_SIZE, this->numStrings - low * BLOCK_SIZE);
+  for (size_t i = 0;; i++)
+  {
+    if (matched == length && length == string.len)
+    {
+      *pIndex = low * BLOCK_SIZE + i;
+      return true;
+    }
+
+    if (i + 1 >= blockSize)
+    {
+      return false;
+    }
+
+    size_t shared       = *pIt++;
+    size_t suffixLength = *pIt++;
+    pSuffix             = pIt;
+    pIt += suffixLength;
+
+    if (shared < matched)
+    {
+      // The next string diverges before the matched prefix, so it sorts after the target
+      return false;
+    }
+    else if (shared == matched)
+    {
+      size_t j = 0;
+      while (j < suffixLength && matched + j < string.len && pSuffix[j] == string.ptr[matched + j])
+      {
+        j++;
+      }
+      matched += j;
+    }
+    // else: shared > matched, the next string has the same mismatch as the current one
+
+    length = shared + suffixLength;
+  }
+}
+
+size_t mj::FrontCodedStringCache::ByteWidth() const
+{
+  return this->restarts.ByteWidth() + this->data.ByteWidth();
+}
+
+int32_t mj::CompareOrdinal(const StringView& a, const StringView& b)
+{
+  size_t length = mj::min(a.len, b.len);
+  for (size_t i = 0; i < length; i++)
+  {
+    if (a.ptr[i] != b.ptr[i])
+    {
+      return static_cast<int32_t>(a.ptr[i]) - static_cast<int32_t>(b.ptr[i]);
+    }
+  }
+
+  return a.len < b.len ? -1 : (a.len > b.len ? 1 : 0);
+}
+
+void mj::SortOrdinal(ArrayListView<StringView> strings)
+{
+  mj::Sort(strings.begin(), strings.end(),
+           [](const StringView& a, const StringView& b) { return CompareOrdinal(a, b) < 0; });
+}
+
+void mj::ReportStringCacheLayouts(StringCache& cache, AllocatorBase* pAllocator)
+{
+  ZoneScoped;
+
+  size_t numStrings = cache.Size();
+  if (numStrings == 0)
+  {
+    return;
+  }
+
+  // Sorted copy of the views, needed for front coding
+  ArrayList<StringView> sorted;
+  sorted.Init(pAllocator);
+  MJ_DEFER(sorted.Destroy());
+  StringView* pSorted = sorted.Emplace(numStrings);
+  if (!pSorted)
+  {
+    return;
+  }
+  static_cast<void>(::memcpy(pSorted, cache.begin(), numStrings * sizeof(StringView)));
+  SortOrdinal(sorted);
+
+  CompactStringCache compact;
+  compact.Init(pAllocator);
+  MJ_DEFER(compact.Destroy());
+
+  FrontCodedStringCache frontCoded;
+  frontCoded.Init(pAllocator);
+  MJ_DEFER(frontCoded.Destroy());
+
+  for (const auto& string : cache)
+  {
+    if (!compact.Add(string))
+    {
+      return;
+    }
+  }
+
+  if (!frontCoded.Build(ArrayListView<const StringView>(sorted.begin(), sorted.Size())))
+  {
+    return;
+  }
+
+  wchar_t* pDecodeBuffer = static_cast<wchar_t*>(pAllocator->Allocate((frontCoded.MaxLength() + 1) * sizeof(wchar_t)));
+  if (!pDecodeBuffer)
+  {
+    return;
+  }
+  MJ_DEFER(pAllocator->Free(pDecodeBuffer));
+
+  // Visit all indices in a scattered order, so we don't only measure sequential access.
+  // The stride is odd and coprime with most sizes; numbers of strings divisible by it fall back to 1.
+  size_t stride = 7919;
+  if (numStrings % stride == 0)
+  {
+    stride = 1;
+  }
+
+  MJ_UNINITIALIZED LARGE_INTEGER frequency;
+  MJ_UNINITIALIZED LARGE_INTEGER t0;
+  MJ_UNINITIALIZED LARGE_INTEGER t1;
+  MJ_UNINITIALIZED LARGE_INTEGER t2;
+  MJ_UNINITIALIZED LARGE_INTEGER t3;
+  MJ_UNINITIALIZED LARGE_INTEGER t4;
+  ::QueryPerformanceFrequency(&frequency);
+
+  // Sum lengths so the lookups can't be optimized away
+  size_t checksum = 0;
+
+  ::QueryPerformanceCounter(&t0);
+  for (size_t i = 0, index = 0; i < numStrings; i++, index = (index + stride) % numStrings)
+  {
+    checksum += cache[index]->len;
+  }
+  ::QueryPerformanceCounter(&t1);
+  for (size_t i = 0, index = 0; i < numStrings; i++, index = (index + stride) % numStrings)
+  {
+    checksum += compact.Get(index).len;
+  }
+  ::QueryPerformanceCounter(&t2);
+  for (size_t i = 0, index = 0; i < numStrings; i++, index = (index + stride) % numStrings)
+  {
+    checksum += frontCoded.Get(index, pDecodeBuffer).len;
+  }
+  ::QueryPerformanceCounter(&t3);
+  for (size_t i = 0, index = 0; i < numStrings; i++, index = (index + stride) % numStrings)
+  {
+    MJ_UNINITIALIZED size_t found;
+    if (frontCoded.Find(sorted[index], &found))
+    {
+      checksum += found;
+    }
+  }
+  ::QueryPerformanceCounter(&t4);
+
+  // StringCache: views + characters (including null terminators)
+  size_t numChars = 0;
+  for (const auto& string : cache)
+  {
+    numChars += string.len + 1;
+  }
+  size_t stringCacheBytes = numStrings * sizeof(StringView) + numChars * sizeof(wchar_t);
+
+  // Results are rounded to one decimal
+  auto Round = [](double value) { return static_cast<double>(static_cast<int64_t>(value * 10.0 + 0.5)) / 10.0; };
+  auto NanosecondsPerLookup = [&](const LARGE_INTEGER& begin, const LARGE_INTEGER& end) {
+    return Round(static_cast<double>(end.QuadPart - begin.QuadPart) * 1.0e9 / static_cast<double>(frequency.QuadPart) /
+                 static_cast<double>(numStrings));
+  };
+  auto BytesPerName = [&](size_t numBytes) {
+    return Round(static_cast<double>(numBytes) / static_cast<double>(numStrings));
+  };
+
+  StringBuilder sb;
+  sb.Init(pAllocator);
+  MJ_DEFER(sb.Destroy());
+
+  sb.Append(L"StringCache layouts for ").AppendUInt64(numStrings).Append(L" names (checksum ");
+  sb.AppendUInt64(checksum).Append(L")\r\n");
+  sb.Append(L"  StringCache:           ").AppendDouble(BytesPerName(stringCacheBytes)).Append(L" bytes/name, ");
+  sb.AppendDouble(NanosecondsPerLookup(t0, t1)).Append(L" ns/lookup\r\n");
+  sb.Append(L"  CompactStringCache:    ").AppendDouble(BytesPerName(compact.ByteWidth())).Append(L" bytes/name, ");
+  sb.AppendDouble(NanosecondsPerLookup(t1, t2)).Append(L" ns/lookup\r\n");
+  sb.Append(L"  FrontCodedStringCache: ").AppendDouble(BytesPerName(frontCoded.ByteWidth())).Append(L" bytes/name, ");
+  sb.AppendDouble(NanosecondsPerLookup(t2, t3)).Append(L" ns/lookup, ");
+  sb.AppendDouble(NanosecondsPerLookup(t3, t4)).Append(L" ns/find\r\n");
+  ::OutputDebugStringW(sb.ToStringClosed().ptr);
+}
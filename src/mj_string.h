@@ -14,6 +14,11 @@ namespace mj
     void Init(const wchar_t* pString);
     bool Equals(const wchar_t* pString) const;
     bool IsEmpty() const;
+
+    /// <summary>
+    /// Parses the whole string as an unsigned decimal number.
+    /// </summary>
+    /// <returns>False if the string contains a non-digit or the number does not fit</returns>
     bool ParseNumber(uint32_t* pNumber) const;
     ptrdiff_t FindLastOf(const wchar_t* pString) const;
   };
@@ -61,6 +66,11 @@ namespace mj
     StringBuilder& Append(const StringView& string);
     StringBuilder& Append(const wchar_t* pStringLiteral);
     StringBuilder& Append(int32_t integer);
+    StringBuilder& AppendUInt64(uint64_t number);
+    StringBuilder& AppendInt64(int64_t number);
+    StringBuilder& AppendDouble(double number);
+    StringBuilder& AppendByteSize(uint64_t numBytes);
+    StringBuilder& AppendFileTime(uint64_t fileTime, int32_t biasMinutes = 0);
     StringBuilder& AppendHex32(uint32_t dw);
     StringBuilder& Indent(uint32_t numSpaces);
 
@@ -98,6 +108,11 @@ namespace mj
     decltype(auto) Append(const StringView& string) { return sb.Append(string); }
     decltype(auto) Append(const wchar_t* pStringLiteral) { return sb.Append(pStringLiteral); }
     decltype(auto) Append(int32_t integer) { return sb.Append(integer); }
+    decltype(auto) AppendUInt64(uint64_t number) { return sb.AppendUInt64(number); }
+    decltype(auto) AppendInt64(int64_t number) { return sb.AppendInt64(number); }
+    decltype(auto) AppendDouble(double number) { return sb.AppendDouble(number); }
+    decltype(auto) AppendByteSize(uint64_t numBytes) { return sb.AppendByteSize(numBytes); }
+    decltype(auto) AppendFileTime(uint64_t fileTime, int32_t biasMinutes = 0) { return sb.AppendFileTime(fileTime, biasMinutes); }
     decltype(auto) AppendHex32(uint32_t dw) { return sb.AppendHex32(dw); }
     decltype(auto) Indent(uint32_t numSpaces) { return sb.Indent(numSpaces); }
 
@@ -168,4 +183,142 @@ namespace mj
 
     operator mj::ArrayListView<const StringView>();
   };
+
+  /// <summary>
+  /// Same contents as a StringCache, but stores one 32-bit end offset per string instead of a StringView.
+  /// The length of a string is derived from its offset and the offset of the previous string.
+  /// Offsets stay valid when the buffer reallocates, so nothing needs to be fixed up on Add.
+  /// The buffer contains null-terminated strings.
+  /// </summary>
+  class CompactStringCache
+  {
+  private:
+    ArrayList<uint32_t> offsets; // One past the null terminator of each string
+    ArrayList<wchar_t> buffer;
+
+  public:
+    /// <summary>
+    /// Does no allocation on construction.
+    /// </summary>
+    void Init(AllocatorBase* pAllocator);
+
+    /// <summary>
+    /// Data is freed using the assigned allocator.
+    /// </summary>
+    void Destroy();
+
+    /// <summary>
+    /// Inserts a copy of this string into the buffer.
+    /// </summary>
+    /// <returns>True if adding was successful, otherwise false (also when the buffer would exceed 4G characters)</returns>
+    bool Add(const wchar_t* pStringLiteral);
+
+    /// <summary>
+    /// Adds a deep copy of a StringView to the buffer. The string does not need to be null-terminated.
+    /// </summary>
+    /// <returns>True if adding was successful, otherwise false (also when the buffer would exceed 4G characters)</returns>
+    bool Add(const StringView& string);
+
+    /// <summary>
+    /// Makes room for more strings, so adding many strings does not reallocate for each one.
+    /// </summary>
+    /// <param name="numChars">Total length of the strings, excluding null terminators</param>
+    bool Reserve(size_t numStrings, size_t numChars);
+
+    void Pop();
+
+    bool Copy(const CompactStringCache& other);
+
+    void Clear();
+
+    size_t Size() const;
+
+    /// <summary>
+    /// The returned view is invalidated when more strings are added.
+    /// </summary>
+    StringView Get(size_t index) const;
+
+    /// <summary>
+    /// Bytes used by offsets and characters (not counting spare capacity).
+    /// </summary>
+    size_t ByteWidth() const;
+  };
+
+  /// <summary>
+  /// Read-only, front-coded storage for a sorted set of strings.
+  /// Strings are grouped in blocks of BLOCK_SIZE. The first string of a block (the restart point)
+  /// is stored in full, the others as (shared prefix length, suffix length, suffix).
+  /// Random access decodes at most one block; lookup by value is a binary search over the restart points.
+  /// Strings are limited to 32767 characters (the Windows path limit), so lengths are stored as one wchar_t.
+  /// </summary>
+  class FrontCodedStringCache
+  {
+  public:
+    static constexpr const size_t BLOCK_SIZE = 16;
+
+  private:
+    ArrayList<uint32_t> restarts; // Offset of each block in data
+    ArrayList<wchar_t> data;
+    size_t numStrings = 0;
+    size_t maxLength  = 0;
+
+  public:
+    /// <summary>
+    /// Does no allocation on construction.
+    /// </summary>
+    void Init(AllocatorBase* pAllocator);
+
+    /// <summary>
+    /// Data is freed using the assigned allocator.
+    /// </summary>
+    void Destroy();
+
+    /// <summary>
+    /// Replaces the contents with the given strings.
+    /// </summary>
+    /// <param name="sorted">Strings sorted by CompareOrdinal, e.g. using SortOrdinal</param>
+    /// <returns>False if allocation failed or a string is too long. The cache is empty afterwards.</returns>
+    bool Build(ArrayListView<const StringView> sorted);
+
+    size_t Size() const;
+
+    /// <summary>
+    /// Length of the longest string. Buffers passed to Get need to be at least this large.
+    /// </summary>
+    size_t MaxLength() const;
+
+    /// <summary>
+    /// Decodes a string into a caller-provided buffer (not null-terminated).
+    /// </summary>
+    /// <param name="pBuffer">At least MaxLength() characters</param>
+    StringView Get(size_t index, wchar_t* pBuffer) const;
+
+    /// <summary>
+    /// Finds the index of a string.
+    /// </summary>
+    /// <returns>True if found</returns>
+    bool Find(const StringView& string, size_t* pIndex) const;
+
+    /// <summary>
+    /// Bytes used by restart points and encoded data (not counting spare capacity).
+    /// </summary>
+    size_t ByteWidth() const;
+  };
+
+  /// <summary>
+  /// Compares two strings by UTF-16 code unit.
+  /// </summary>
+  /// <returns>Negative if a sorts before b, zero if equal, positive otherwise</returns>
+  int32_t CompareOrdinal(const StringView& a, const StringView& b);
+
+  /// <summary>
+  /// Sorts views in place by CompareOrdinal.
+  /// </summary>
+  void SortOrdinal(ArrayListView<StringView> strings);
+
+  /// <summary>
+  /// Compares memory use and lookup latency of StringCache, CompactStringCache and FrontCodedStringCache
+  /// for the strings in the given cache, and prints the results using OutputDebugStringW.
+  /// </summary>
+  void ReportStringCacheLayouts(StringCache& cache, AllocatorBase* pAllocator);
 } // namespace mj
@@ -0,0 +1,547 @@
+#include "pch.h"
+#include "mj_trigram.h"
+#include <emmintrin.h>
+
+namespace mj
+{
+  // Stop intersecting once this few candidates remain, verifying them is cheaper
+  static constexpr const size_t MIN_INTERSECT_CANDIDATES = 32;
+
+  // Binary search instead of a linear merge when one list is this much longer
+  static constexpr const size_t GALLOP_RATIO = 32;
+
+  struct TrigramPosting
+  {
+    MJ_UNINITIALIZED uint64_t trigram;
+    MJ_UNINITIALIZED uint32_t name;
+  };
+
+  static bool TrigramPostingLess(const TrigramPosting& a, const TrigramPosting& b)
+  {
+    return a.trigram < b.trigram || (a.trigram == b.trigram && a.name < b.name);
+  }
+
+  static uint64_t MakeTrigram(wchar_t a, wchar_t b, wchar_t c)
+  {
+    return (static_cast<uint64_t>(a) << 32) | (static_cast<uint64_t>(b) << 16) | static_cast<uint64_t>(c);
+  }
+
+  static bool WriteVarint(ArrayList<uint8_t>& bytes, uint32_t value)
+  {
+    while (value >= 0x80)
+    {
+      if (!bytes.Add(static_cast<uint8_t>(value | 0x80)))
+      {
+        return false;
+      }
+      value >>= 7;
+    }
+    return bytes.Add(static_cast<uint8_t>(value)) != nullptr;
+  }
+
+  static size_t DecodePostings(const uint8_t* pBegin, const uint8_t* pEnd, uint32_t* pOut)
+  {
+    size_t count   = 0;
+    uint32_t value = 0;
+    while (pBegin < pEnd)
+    {
+      uint32_t delta = 0;
+      uint32_t shift = 0;
+      uint8_t byte   = 0;
+      do
+      {
+        byte = *pBegin++;
+        delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        shift += 7;
+      } while (byte & 0x80);
+
+      value += delta;
+      pOut[count++] = value;
+    }
+    return count;
+  }
+
+  /// <summary>
+  /// Index of the first element >= value in a sorted list.
+  /// </summary>
+  static size_t LowerBound(const uint32_t* pList, size_t size, uint32_t value)
+  {
+    size_t begin = 0;
+    while (size > 0)
+    {
+      size_t half = size / 2;
+      if (pList[begin + half] < value)
+      {
+        begin += half + 1;
+        size -= half + 1;
+      }
+      else
+      {
+        size = half;
+      }
+    }
+    return begin;
+  }
+
+  /// <summary>
+  /// Intersects two strictly increasing lists. pOut may be equal to pA.
+  /// </summary>
+  static size_t Intersect(const uint32_t* pA, size_t sizeA, const uint32_t* pB, size_t sizeB, uint32_t* pOut)
+  {
+    size_t count = 0;
+
+    // Few candidates against a long list: look each one up
+    if (sizeB > GALLOP_RATIO * sizeA)
+    {
+      size_t j = 0;
+      for (size_t i = 0; i < sizeA && j < sizeB; i++)
+      {
+        uint32_t value = pA[i];
+        j += LowerBound(pB + j, sizeB - j, value);
+        if (j < sizeB && pB[j] == value)
+        {
+          pOut[count++] = value;
+        }
+      }
+      return count;
+    }
+
+    // Compare blocks of 4 x 4: each element of a against all rotations of b
+    size_t i = 0;
+    size_t j = 0;
+    while (i + 4 <= sizeA && j + 4 <= sizeB)
+    {
+      __m128i a  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pA + i));
+      __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pB + j));
+      __m128i b1 = _mm_shuffle_epi32(b0, _MM_SHUFFLE(0, 3, 2, 1));
+      __m128i b2 = _mm_shuffle_epi32(b0, _MM_SHUFFLE(1, 0, 3, 2));
+      __m128i b3 = _mm_shuffle_epi32(b0, _MM_SHUFFLE(2, 1, 0, 3));
+
+      __m128i equal = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(a, b0), _mm_cmpeq_epi32(a, b1)),
+                                   _mm_or_si128(_mm_cmpeq_epi32(a, b2), _mm_cmpeq_epi32(a, b3)));
+
+      // One bit per element of a. Read before writing, pOut may alias pA.
+      int mask       = _mm_movemask_ps(_mm_castsi128_ps(equal));
+      uint32_t lastA = pA[i + 3];
+      uint32_t lastB = pB[j + 3];
+      MJ_UNINITIALIZED uint32_t values[4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(values), a);
+      for (int k = 0; k < 4; k++)
+      {
+        if (mask & (1 << k))
+        {
+          pOut[count++] = values[k];
+        }
+      }
+
+      if (lastA <= lastB)
+      {
+        i += 4;
+      }
+      if (lastB <= lastA)
+      {
+        j += 4;
+      }
+    }
+
+    while (i < sizeA && j < sizeB)
+    {
+      if (pA[i] < pB[j])
+      {
+        i++;
+      }
+      else if (pB[j] < pA[i])
+      {
+        j++;
+      }
+      else
+      {
+        pOut[count++] = pA[i];
+        i++;
+        j++;
+      }
+    }
+
+    return count;
+  }
+} // namespace mj
+
+void mj::TrigramQuery::Init(const StringView& string)
+{
+  this->filter.Init(string);
+
+  const size_t length = mj::min(string.len, FilterQuery::MAX_LENGTH);
+  this->numTrigrams   = 0;
+  for (size_t i = 0; i + 2 < length; i++)
+  {
+    uint64_t trigram =
+        MakeTrigram(FoldCase(string.ptr[i]), FoldCase(string.ptr[i + 1]), FoldCase(string.ptr[i + 2]));
+
+    // Queries are short, a linear check for duplicates is fine
+    bool duplicate = false;
+    for (size_t j = 0; j < this->numTrigrams; j++)
+    {
+      duplicate = duplicate || this->trigrams[j] == trigram;
+    }
+    if (!duplicate)
+    {
+      this->trigrams[this->numTrigrams++] = trigram;
+    }
+  }
+}
+
+size_t mj::TrigramQuery::NumTrigrams() const
+{
+  return this->numTrigrams;
+}
+
+uint64_t mj::TrigramQuery::GetTrigram(size_t index) const
+{
+  return this->trigrams[index];
+}
+
+bool mj::TrigramQuery::Matches(const StringView& name) const
+{
+  return this->filter.Matches(name);
+}
+
+void mj::TrigramSegment::Init(AllocatorBase* pAllocator)
+{
+  this->pAllocator = pAllocator;
+  this->names.Init(pAllocator);
+  this->parents.Init(pAllocator);
+  this->trigrams.Init(pAllocator);
+  this->offsets.Init(pAllocator);
+  this->postings.Init(pAllocator);
+}
+
+void mj::TrigramSegment::Destroy()
+{
+  this->names.Destroy();
+  this->parents.Destroy();
+  this->trigrams.Destroy();
+  this->offsets.Destroy();
+  this->postings.Destroy();
+}
+
+bool mj::TrigramSegment::AddName(uint32_t folder, const StringView& name, bool isFolder)
+{
+  if ((folder & FOLDER_BIT) != 0 || !this->names.Add(name))
+  {
+    return false;
+  }
+
+  if (!this->parents.Add(isFolder ? folder | FOLDER_BIT : folder))
+  {
+    this->names.Pop();
+    return false;
+  }
+
+  return true;
+}
+
+bool mj::TrigramSegment::Build()
+{
+  ZoneScoped;
+
+  const size_t numNames = this->names.Size();
+
+  size_t numPostings = 0;
+  for (size_t i = 0; i < numNames; i++)
+  {
+    size_t length = this->names.Get(i).len;
+    numPostings += length > 2 ? length - 2 : 0;
+  }
+
+  this->trigrams.Clear();
+  this->offsets.Clear();
+  this->postings.Clear();
+  if (numPostings == 0)
+  {
+    return this->offsets.Add(0) != nullptr;
+  }
+
+  // All (trigram, name) pairs, sorted by trigram
+  ArrayList<TrigramPosting> pairs;
+  pairs.Init(this->pAllocator);
+  MJ_DEFER(pairs.Destroy());
+  TrigramPosting* pPairs = pairs.Emplace(numPostings);
+  if (!pPairs)
+  {
+    return false;
+  }
+
+  size_t numPairs = 0;
+  for (size_t i = 0; i < numNames; i++)
+  {
+    StringView name = this->names.Get(i);
+    if (name.len > 2)
+    {
+      wchar_t a = FoldCase(name.ptr[0]);
+      wchar_t b = FoldCase(name.ptr[1]);
+      for (size_t j = 2; j < name.len; j++)
+      {
+        wchar_t c                = FoldCase(name.ptr[j]);
+        pPairs[numPairs].trigram = MakeTrigram(a, b, c);
+        pPairs[numPairs].name    = static_cast<uint32_t>(i);
+        numPairs++;
+
+        a = b;
+        b = c;
+      }
+    }
+  }
+  mj::Sort(pPairs, pPairs + numPairs, TrigramPostingLess);
+
+  // Encode one posting list per trigram. Names are sorted within a list, duplicates are dropped.
+  size_t i = 0;
+  while (i < numPairs)
+  {
+    uint64_t trigram = pPairs[i].trigram;
+    if (!this->trigrams.Add(trigram) || !this->offsets.Add(static_cast<uint32_t>(this->postings.Size())))
+    {
+      return false;
+    }
+
+    uint32_t previous = 0;
+    bool first        = true;
+    for (; i < numPairs && pPairs[i].trigram == trigram; i++)
+    {
+      uint32_t name = pPairs[i].name;
+      if (first || name != previous)
+      {
+        if (!WriteVarint(this->postings, name - previous))
+        {
+          return false;
+        }
+        previous = name;
+        first    = false;
+      }
+    }
+  }
+
+  return this->offsets.Add(static_cast<uint32_t>(this->postings.Size())) != nullptr;
+}
+
+size_t mj::TrigramSegment::NumNames() const
+{
+  return this->names.Size();
+}
+
+size_t mj::TrigramSegment::ByteWidth() const
+{
+  return this->names.ByteWidth() + this->parents.ByteWidth() + this->trigrams.ByteWidth() + this->offsets.ByteWidth() + this->postings.ByteWidth();
+}
+
+mj::StringView mj::TrigramSegment::GetName(uint32_t index) const
+{
+  return this->names.Get(index);
+}
+
+uint32_t mj::TrigramSegment::GetFolder(uint32_t index) const
+{
+  return this->parents.Get()[index] & ~FOLDER_BIT;
+}
+
+void mj::TrigramSegment::RemapFolders(const uint32_t* pFolders)
+{
+  for (uint32_t& parent : this->parents)
+  {
+    parent = pFolders[parent & ~FOLDER_BIT] | (parent & FOLDER_BIT);
+  }
+}
+
+bool mj::TrigramSegment::IsFolder(uint32_t index) const
+{
+  return (this->parents.Get()[index] & FOLDER_BIT) != 0;
+}
+
+bool mj::TrigramSegment::FindPostings(uint64_t trigram, const uint8_t** ppBegin, const uint8_t** ppEnd) const
+{
+  const uint64_t* pTrigrams = this->trigrams.Get();
+  size_t begin              = 0;
+  size_t size               = this->trigrams.Size();
+  while (size > 0)
+  {
+    size_t half = size / 2;
+    if (pTrigrams[begin + half] < trigram)
+    {
+      begin += half + 1;
+      size -= half + 1;
+    }
+    else
+    {
+      size = half;
+    }
+  }
+
+  if (begin == this->trigrams.Size() || pTrigrams[begin] != trigram)
+  {
+    return false;
+  }
+
+  *ppBegin = this->postings.Get() + this->offsets.Get()[begin];
+  *ppEnd   = this->postings.Get() + this->offsets.Get()[begin + 1];
+  return true;
+}
+
+size_t mj::TrigramSegment::Search(const TrigramQuery& query, ArrayList<uint32_t>& candidates,
+                                  ArrayList<uint32_t>& scratch, uint32_t* pOut, size_t maxResults) const
+{
+  const size_t numNames = this->names.Size();
+  size_t numResults     = 0;
+
+  // Too short for the index: scan
+  if (query.NumTrigrams() == 0)
+  {
+    for (size_t i = 0; i < numNames && numResults < maxResults; i++)
+    {
+      if (query.Matches(this->names.Get(i)))
+      {
+        pOut[numResults++] = static_cast<uint32_t>(i);
+      }
+    }
+    return numResults;
+  }
+
+  // Every posting list is needed. Each one decodes to at most numNames indices.
+  MJ_UNINITIALIZED const uint8_t* lists[TrigramQuery::MAX_TRIGRAMS][2];
+  const size_t numLists = query.NumTrigrams();
+  for (size_t i = 0; i < numLists; i++)
+  {
+    if (!this->FindPostings(query.GetTrigram(i), &lists[i][0], &lists[i][1]))
+    {
+      return 0;
+    }
+  }
+
+  candidates.Clear();
+  scratch.Clear();
+  if (!candidates.Reserve(numNames) || !scratch.Reserve(numNames))
+  {
+    return 0;
+  }
+  uint32_t* pCandidates = candidates.begin();
+  uint32_t* pScratch    = scratch.begin();
+
+  // Start with the shortest list (fewest bytes), then intersect in order of increasing length
+  for (size_t i = 1; i < numLists; i++)
+  {
+    for (size_t j = i; j > 0 && (lists[j][1] - lists[j][0]) < (lists[j - 1][1] - lists[j - 1][0]); j--)
+    {
+      mj::swap(lists[j][0], lists[j - 1][0]);
+      mj::swap(lists[j][1], lists[j - 1][1]);
+    }
+  }
+
+  size_t numCandidates = DecodePostings(lists[0][0], lists[0][1], pCandidates);
+  for (size_t i = 1; i < numLists && numCandidates > MIN_INTERSECT_CANDIDATES; i++)
+  {
+    size_t numScratch = DecodePostings(lists[i][0], lists[i][1], pScratch);
+    numCandidates     = Intersect(pCandidates, numCandidates, pScratch, numScratch, pCandidates);
+  }
+
+  // Trigrams can match in different places, so every candidate is verified
+  for (size_t i = 0; i < numCandidates && numResults < maxResults; i++)
+  {
+    if (query.Matches(this->names.Get(pCandidates[i])))
+    {
+      pOut[numResults++] = pCandidates[i];
+    }
+  }
+
+  return numResults;
+}
+
+void mj::TrigramIndex::Init(AllocatorBase* pAllocator)
+{
+  this->pAllocator = pAllocator;
+  this->segments.Init(pAllocator);
+  this->candidates.Init(pAllocator);
+  this->scratch.Init(pAllocator);
+  this->results.Init(pAllocator);
+  this->numNames = 0;
+}
+
+void mj::TrigramIndex::Destroy()
+{
+  for (TrigramSegment* pSegment : this->segments)
+  {
+    pSegment->Destroy();
+    this->pAllocator->Free(pSegment);
+  }
+  this->segments.Destroy();
+  this->candidates.Destroy();
+  this->scratch.Destroy();
+  this->results.Destroy();
+  this->numNames = 0;
+}
+
+bool mj::TrigramIndex::Add(TrigramSegment* pSegment)
+{
+  if (!this->segments.Add(pSegment))
+  {
+    return false;
+  }
+
+  this->numNames += pSegment->NumNames();
+  return true;
+}
+
+size_t mj::TrigramIndex::NumNames() const
+{
+  return this->numNames;
+}
+
+size_t mj::TrigramIndex::ByteWidth() const
+{
+  size_t numBytes = this->segments.ByteWidth();
+  for (const TrigramSegment* pSegment : this->segments)
+  {
+    numBytes += pSegment->ByteWidth();
+  }
+  return numBytes;
+}
+
+size_t mj::TrigramIndex::Search(const StringView& query, TrigramHit* pHits, size_t maxHits)
+{
+  ZoneScoped;
+
+  MJ_UNINITIALIZED TrigramQuery trigramQuery;
+  trigramQuery.Init(query);
+
+  this->results.Clear();
+  if (maxHits == 0 || !this->results.Reserve(maxHits))
+  {
+    return 0;
+  }
+
+  size_t numHits = 0;
+  for (size_t i = 0; i < this->segments.Size() && numHits < maxHits; i++)
+  {
+    size_t numResults = this->segments[i]->Search(trigramQuery, this->candidates, this->scratch,
+                                                   this->results.begin(), maxHits - numHits);
+    for (size_t j = 0; j < numResults; j++)
+    {
+      pHits[numHits].segment = static_cast<uint32_t>(i);
+      pHits[numHits++].name  = this->results.begin()[j];
+    }
+  }
+
+  return numHits;
+}
+
+mj::StringView mj::TrigramIndex::GetName(const TrigramHit& hit) const
+{
+  return this->segments.Get()[hit.segment]->GetName(hit.name);
+}
+
+bool mj::TrigramIndex::IsFolder(const TrigramHit& hit) const
+{
+  return this->segments.Get()[hit.segment]->IsFolder(hit.name);
+}
+
+uint32_t mj::TrigramIndex::GetFolder(const TrigramHit& hit) const
+{
+  return this->segments.Get()[hit.segment]->GetFolder(hit.name);
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include "mj_string.h"
+#include "mj_filter.h"
+
+namespace mj
+{
+  /// <summary>
+  /// Case-folded substring query, split into the trigrams every matching name must contain.
+  /// </summary>
+  class TrigramQuery
+  {
+  public:
+    static constexpr const size_t MAX_TRIGRAMS = FilterQuery::MAX_LENGTH - 2;
+
+  private:
+    FilterQuery filter; // Verifies candidates
+    MJ_UNINITIALIZED uint64_t trigrams[MAX_TRIGRAMS];
+    size_t numTrigrams = 0;
+
+  public:
+    void Init(const StringView& string);
+
+    /// <summary>
+    /// Queries shorter than three characters have no trigrams and are answered by scanning.
+    /// </summary>
+    size_t NumTrigrams() const;
+    uint64_t GetTrigram(size_t index) const;
+    bool Matches(const StringView& name) const;
+  };
+
+  /// <summary>
+  /// Immutable part of a TrigramIndex: a batch of names, the folder node each is in,
+  /// and one delta-encoded posting list of name indices per trigram.
+  /// Filled and built on a worker thread, then handed to the index.
+  /// </summary>
+  class TrigramSegment
+  {
+  private:
+    static constexpr const uint32_t FOLDER_BIT = 0x80000000u;
+
+    AllocatorBase* pAllocator = nullptr;
+
+    CompactStringCache names;
+    ArrayList<uint32_t> parents; // Per name: PathTree node of its folder, FOLDER_BIT set if the name is a folder
+
+    ArrayList<uint64_t> trigrams;  // Sorted
+    ArrayList<uint32_t> offsets;   // Per trigram: start of its posting list. One extra for the end.
+    ArrayList<uint8_t> postings;   // Varint deltas, the first value of a list is stored as-is
+
+  public:
+    /// <summary>
+    /// The allocator must be thread-safe: segments are built on a worker and destroyed on the main thread.
+    /// </summary>
+    void Init(AllocatorBase* pAllocator);
+    void Destroy();
+
+    /// <summary>
+    /// Adds a name in a folder, identified by a PathTree node.
+    /// </summary>
+    bool AddName(uint32_t folder, const StringView& name, bool isFolder);
+
+    /// <summary>
+    /// Creates the posting lists. Call once after adding all names.
+    /// </summary>
+    bool Build();
+
+    size_t NumNames() const;
+    size_t ByteWidth() const;
+    StringView GetName(uint32_t index) const;
+    uint32_t GetFolder(uint32_t index) const;
+    bool IsFolder(uint32_t index) const;
+
+    /// <summary>
+    /// Replaces every folder node with pFolders[node], e.g. to move from a worker's tree to the shared one.
+    /// </summary>
+    void RemapFolders(const uint32_t* pFolders);
+
+    /// <summary>
+    /// Finds names containing the query, in index order.
+    /// </summary>
+    /// <param name="candidates">Scratch space</param>
+    /// <param name="scratch">Scratch space</param>
+    /// <param name="pOut">Receives at most maxResults name indices</param>
+    /// <returns>Number of indices written</returns>
+    size_t Search(const TrigramQuery& query, ArrayList<uint32_t>& candidates, ArrayList<uint32_t>& scratch,
+                  uint32_t* pOut, size_t maxResults) const;
+
+  private:
+    bool FindPostings(uint64_t trigram, const uint8_t** ppBegin, const uint8_t** ppEnd) const;
+  };
+
+  struct TrigramHit
+  {
+    MJ_UNINITIALIZED uint32_t segment;
+    MJ_UNINITIALIZED uint32_t name;
+  };
+
+  /// <summary>
+  /// Inverted trigram index over every name seen by the folder walker.
+  /// Grows incrementally by adding segments, which can be built in parallel.
+  /// </summary>
+  class TrigramIndex
+  {
+  private:
+    AllocatorBase* pAllocator = nullptr;
+    ArrayList<TrigramSegment*> segments;
+    size_t numNames = 0;
+
+    // Reused between queries
+    ArrayList<uint32_t> candidates;
+    ArrayList<uint32_t> scratch;
+    ArrayList<uint32_t> results;
+
+  public:
+    void Init(AllocatorBase* pAllocator);
+
+    /// <summary>
+    /// Destroys and frees all segments.
+    /// </summary>
+    void Destroy();
+
+    /// <summary>
+    /// Takes ownership of a built segment. The segment must have been allocated with New on the index allocator.
+    /// </summary>
+    bool Add(TrigramSegment* pSegment);
+
+    size_t NumNames() const;
+    size_t ByteWidth() const;
+
+    /// <summary>
+    /// Finds names containing the query (case-insensitive), in the order they were added.
+    /// </summary>
+    /// <returns>Number of hits written, at most maxHits</returns>
+    size_t Search(const StringView& query, TrigramHit* pHits, size_t maxHits);
+
+    StringView GetName(const TrigramHit& hit) const;
+    bool IsFolder(const TrigramHit& hit) const;
+
+    /// <summary>
+    /// PathTree node of the folder containing a hit.
+    /// </summary>
+    uint32_t GetFolder(const TrigramHit& hit) const;
+  };
+} // namespace mj